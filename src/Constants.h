@@ -79,6 +79,8 @@ const Pose kInitPose =
 static constexpr double kWrenchReg = 1e-10;
 // zero threshold
 static constexpr double kWrenchNormThresh = 1e-5;
+// relative tolerance of the solver cross-check
+static constexpr double kQPCrossCheckTol = 1e-6;
 
 constexpr double kExpandMesh = 0.002; // 2mm
 
@@ -175,6 +177,11 @@ const char* const kAlgorithms[] = {
 
 enum class CostFunctionEnum : int { kGradientBased = 0, kSP = 1 };
 
+// kExact: CGAL with exact arithmetic
+// kFast: active set in double precision
+enum class QPSolverEnum : int { kExact = 0, kFast = 1 };
+const char* const kQPSolvers[] = {"Exact", "Fast"};
+
 namespace colors {
 const Eigen::RowVector3d kPurple = Eigen::RowVector3d(219, 76, 178) / 255;
 const Eigen::RowVector3d kOrange = Eigen::RowVector3d(239, 126, 50) / 255;
@@ -3,6 +3,7 @@
 #include <igl/copyleft/cgal/mesh_boolean.h>
 #include <igl/writeSTL.h>
 #include <exception>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <string>
@@ -35,10 +36,6 @@ void ProcessFrom(std::string raw_fn,
   Log() << "Processing " << raw_fn << std::endl;
 
   std::string psg_fn = raw_fn + ".psg";
-  std::ifstream psg_file(psg_fn, std::ios::in | std::ios::binary);
-  if (!psg_file.is_open()) {
-    throw std::invalid_argument("> Cannot open psg file " + psg_fn);
-  }
 
   std::string cp_fn = raw_fn + ".cpx";
   std::ifstream cp_file(cp_fn, std::ios::in | std::ios::binary);
@@ -46,8 +43,11 @@ void ProcessFrom(std::string raw_fn,
     throw std::invalid_argument("> Cannot open cp file " + cp_fn);
   }
 
+  // Mesh acceleration structures are cached next to the psg
+  psg::core::models::MeshDependentResource::SetCacheDirectory(
+      std::filesystem::absolute(psg_fn).parent_path().string());
   psg::core::PassiveGripper psg;
-  psg.Deserialize(psg_file);
+  psg.Load(psg_fn);
   Log() << "> Loaded " << psg_fn << std::endl;
 
   stgo.Apply(psg);
@@ -1,6 +1,9 @@
 #include "CostFunctions.h"
 
-#include <igl/copyleft/cgal/intersect_other.h>
+#include <CGAL/Exact_predicates_inexact_constructions_kernel.h>
+#include <CGAL/intersections.h>
+#include <atomic>
+#include <tuple>
 #include "GeometryUtils.h"
 #include "robots/Robots.h"
 
@@ -8,29 +11,46 @@ namespace psg {
 namespace core {
 
 // See CHOMP paper page 4
-static double PotentialSDF(double s, double& out_dP_ds) {
-  static constexpr double epsilon = 0.001;
+template <typename Scalar>
+static Scalar PotentialSDF(Scalar s, Scalar& out_dP_ds) {
+  static constexpr Scalar epsilon = 0.001;
   if (s > epsilon) {
     out_dP_ds = 0;
     return 0;
   }
   if (s < 0) {
     out_dP_ds = -1;
-    return -s + (epsilon / 2.);
+    return -s + (epsilon / 2);
   }
-  double tmp = s - epsilon;
+  Scalar tmp = s - epsilon;
   out_dP_ds = s / epsilon - 1;
-  return tmp * tmp / (2. * epsilon);
+  return tmp * tmp / (2 * epsilon);
 }
 
 static double GetDist(const Eigen::Vector3d& p,
                       const CostSettings& settings,
                       const MeshDependentResource& mdr,
                       Eigen::RowVector3d& out_ds_dp) {
+  double sFloor = p.y() - settings.floor;
+  if (settings.sdf_grid) {
+    const SignedDistanceGrid& grid =
+        mdr.GetSDFGrid(settings.sdf_grid_res, settings.sdf_grid_band);
+    double s;
+    Eigen::RowVector3d ds_dp;
+    // Falls back to the exact query outside of the grid
+    if (grid.Query(p, s, ds_dp)) {
+      if (s < sFloor) {
+        out_ds_dp = ds_dp;
+        return s;
+      } else {
+        out_ds_dp = Eigen::RowVector3d::UnitY();
+        return sFloor;
+      }
+    }
+  }
   Eigen::RowVector3d c;
   double sign;
   double s = mdr.ComputeSignedDistance(p, c, sign);
-  double sFloor = p.y() - settings.floor;
   if (s < sFloor) {
     if (s < 0)
       out_ds_dp = (c - p.transpose()).normalized();
@@ -43,6 +63,65 @@ static double GetDist(const Eigen::Vector3d& p,
   }
 }
 
+// Batched GetDist, one query per row of P, in Scalar precision
+template <typename Scalar>
+static void GetDistBatch(const Eigen::Matrix<Scalar, Eigen::Dynamic, 3>& P,
+                         const CostSettings& settings,
+                         const MeshDependentResource& mdr,
+                         Eigen::Matrix<Scalar, Eigen::Dynamic, 1>& out_s,
+                         Eigen::Matrix<Scalar, Eigen::Dynamic, 3>& out_ds_dp) {
+  typedef Eigen::Matrix<Scalar, 3, 1> Vector3;
+  typedef Eigen::Matrix<Scalar, 1, 3> RowVector3;
+  const long long n = P.rows();
+  out_s.resize(n);
+  out_ds_dp.resize(n, 3);
+
+  std::vector<long long> exact_ids;
+  if (settings.sdf_grid) {
+    const SignedDistanceGrid& grid =
+        mdr.GetSDFGrid(settings.sdf_grid_res, settings.sdf_grid_band);
+    std::vector<char> found(n);
+#pragma omp parallel for
+    for (long long i = 0; i < n; i++) {
+      RowVector3 ds_dp;
+      found[i] = grid.Query(Vector3(P.row(i).transpose()), out_s(i), ds_dp);
+      out_ds_dp.row(i) = ds_dp;
+    }
+    for (long long i = 0; i < n; i++) {
+      if (!found[i]) exact_ids.push_back(i);
+    }
+  } else {
+    exact_ids.resize(n);
+    for (long long i = 0; i < n; i++) exact_ids[i] = i;
+  }
+
+  if (!exact_ids.empty()) {
+    Eigen::Matrix<Scalar, Eigen::Dynamic, 3> Q(exact_ids.size(), 3);
+    for (size_t i = 0; i < exact_ids.size(); i++) {
+      Q.row(i) = P.row(exact_ids[i]);
+    }
+    Eigen::Matrix<Scalar, Eigen::Dynamic, 1> S;
+    Eigen::Matrix<Scalar, Eigen::Dynamic, 3> C;
+    mdr.ComputeSignedDistanceBatch(Q, S, C);
+    for (size_t i = 0; i < exact_ids.size(); i++) {
+      long long id = exact_ids[i];
+      out_s(id) = S(i);
+      if (S(i) < 0)
+        out_ds_dp.row(id) = (C.row(i) - Q.row(i)).normalized();
+      else
+        out_ds_dp.row(id) = (Q.row(i) - C.row(i)).normalized();
+    }
+  }
+
+  for (long long i = 0; i < n; i++) {
+    Scalar sFloor = P(i, 1) - (Scalar)settings.floor;
+    if (!(out_s(i) < sFloor)) {
+      out_s(i) = sFloor;
+      out_ds_dp.row(i) = RowVector3::UnitY();
+    }
+  }
+}
+
 static double Norm(const Eigen::Vector3d& x1,
                    const Eigen::Vector3d& x2,
                    Eigen::RowVector3d& out_dNorm_dx1) {
@@ -63,6 +142,50 @@ double EvalAt(const Eigen::Vector3d& p,
   return result;
 }
 
+void EvalAtBatch(const Eigen::MatrixX3d& P,
+                 const CostSettings& settings,
+                 const MeshDependentResource& mdr,
+                 Eigen::VectorXd& out_c,
+                 Eigen::MatrixX3d& out_dc_dp) {
+  Eigen::VectorXd s;
+  GetDistBatch(P, settings, mdr, s, out_dc_dp);
+  out_c.resize(P.rows());
+  for (long long i = 0; i < P.rows(); i++) {
+    double dP_ds;
+    out_c(i) = PotentialSDF(s(i), dP_ds);
+    out_dc_dp.row(i) *= dP_ds;
+  }
+}
+
+// EvalAtBatch with the distance queries and the potential in Scalar
+// precision
+template <typename Scalar>
+static void EvalAtBatchT(const Eigen::MatrixX3d& P,
+                         const CostSettings& settings,
+                         const MeshDependentResource& mdr,
+                         Eigen::VectorXd& out_c,
+                         Eigen::MatrixX3d& out_dc_dp) {
+  Eigen::Matrix<Scalar, Eigen::Dynamic, 1> s;
+  Eigen::Matrix<Scalar, Eigen::Dynamic, 3> ds_dp;
+  GetDistBatch<Scalar>(P.cast<Scalar>(), settings, mdr, s, ds_dp);
+  out_c.resize(P.rows());
+  out_dc_dp.resize(P.rows(), 3);
+  for (long long i = 0; i < P.rows(); i++) {
+    Scalar dP_ds;
+    out_c(i) = PotentialSDF(s(i), dP_ds);
+    out_dc_dp.row(i) = (ds_dp.row(i) * dP_ds).template cast<double>();
+  }
+}
+
+template <>
+void EvalAtBatchT<double>(const Eigen::MatrixX3d& P,
+                          const CostSettings& settings,
+                          const MeshDependentResource& mdr,
+                          Eigen::VectorXd& out_c,
+                          Eigen::MatrixX3d& out_dc_dp) {
+  EvalAtBatch(P, settings, mdr, out_c, out_dc_dp);
+}
+
 double ComputeDuration(const Pose& p1,
                        const Pose& p2,
                        double ang_velocity,
@@ -84,12 +207,18 @@ double ComputeDuration(const Pose& p1,
   return duration;
 }
 
-double ComputeCost(const GripperParams& params,
-                   const GripperParams& init_params,
-                   const GripperSettings& settings,
-                   const MeshDependentResource& mdr,
-                   GripperParams& out_dCost_dParam,
-                   Debugger* const debugger) {
+// Same cost and gradient as ComputeCost, computed in flat passes:
+//  1. forward kinematics and Jacobian of every frame
+//  2. evaluation of every (frame, finger) block of samples
+//  3. contribution of every (frame pair, finger) into its own partial
+//     gradient vector
+//  4. a fixed-shape pairwise reduction of the partial vectors
+// The result does not depend on the number of threads.
+template <typename Scalar>
+static double ComputeCostFlat(const GripperParams& params,
+                              const GripperSettings& settings,
+                              const MeshDependentResource& mdr,
+                              GripperParams& out_dCost_dParam) {
   const size_t nTrajectorySteps = settings.cost.n_trajectory_steps;
   const long long nFingerSteps = settings.cost.n_finger_steps;
   const double angVelocity = settings.cost.ang_velocity;
@@ -100,28 +229,408 @@ double ComputeCost(const GripperParams& params,
   const size_t nFingers = params.fingers.size();
   const size_t nFingerJoints = settings.finger.n_finger_joints;
   const size_t nEvalsPerFingerPerFrame = (nFingerJoints - 1) * nFingerSteps + 1;
+  const size_t nFrames = (nKeyframes - 1) * nTrajectorySteps + 1;
+  const size_t nItems = (nFrames - 1) * nFingers;
 
-  struct _Data {
+  // Layout of a partial gradient vector
+  const size_t kFingerOffset = 1;
+  const size_t kThetaOffset = kFingerOffset + nFingers * nFingerJoints * 3;
+  const size_t kPartialSize = kThetaOffset + nKeyframes * kNumDOFs;
+
+  // Build the grid outside of the parallel region
+  if (settings.cost.sdf_grid) {
+    mdr.GetSDFGrid(settings.cost.sdf_grid_res, settings.cost.sdf_grid_band);
+  }
+
+  Eigen::Affine3d fingerTransInv = robots::Forward(params.trajectory.front());
+  fingerTransInv = fingerTransInv.inverse();
+
+  // Finger samples in effector space
+  std::vector<double> fingerTs(nEvalsPerFingerPerFrame);
+  std::vector<size_t> iJoints(nEvalsPerFingerPerFrame);
+  std::vector<Eigen::MatrixX3d> effFingers(
+      nFingers, Eigen::MatrixX3d(nEvalsPerFingerPerFrame, 3));
+  for (long long jj = 0; jj < (long long)nEvalsPerFingerPerFrame; jj++) {
+    long long kk = (jj - 1) % nFingerSteps + 1;
+    long long joint = (jj - 1) / nFingerSteps + 1;
+    fingerTs[jj] = kk * fingerStep;
+    iJoints[jj] = joint - 1;
+  }
+  for (size_t i = 0; i < nFingers; i++) {
+    Eigen::MatrixXd effFinger =
+        (fingerTransInv *
+         params.fingers[i].transpose().colwise().homogeneous())
+            .transpose();
+    for (long long jj = 0; jj < (long long)nEvalsPerFingerPerFrame; jj++) {
+      effFingers[i].row(jj) = effFinger.row(iJoints[jj]) * (1. - fingerTs[jj]) +
+                              effFinger.row(iJoints[jj] + 1) * fingerTs[jj];
+    }
+  }
+
+  struct _Duration {
+    double duration;
+    size_t idx;
+    bool flip;
+  };
+  std::vector<_Duration> durations(nKeyframes);
+  for (size_t iKf = 1; iKf < nKeyframes; iKf++) {
+    durations[iKf].duration = ComputeDuration(params.trajectory[iKf - 1],
+                                              params.trajectory[iKf],
+                                              angVelocity,
+                                              durations[iKf].idx,
+                                              durations[iKf].flip);
+  }
+
+  struct _Frame {
+    Eigen::Affine3d H;
+    Eigen::Matrix3d R;  // dLerpedJoint/dJoint up to the lerp weight
+    robots::JacobianEvaluator J;
+  };
+  struct _Sample {
     double eval;
     Eigen::Vector3d lerpedJoint;
-    Eigen::RowVector3d dEval_dLerpedJoint;
-    Eigen::Matrix3d dLerpedJoint_dJoint1;
-    Eigen::Matrix3d dLerpedJoint_dJoint2;
-    size_t iJoint;  // iJoint -- (iJoint + 1)
-    Jacobian dpos_dtheta;
+    Eigen::RowVector3d dEval_dJoint;  // without the lerp weight
+    Eigen::Matrix<double, 1, kNumDOFs> dEval_dTheta;
+  };
+  std::vector<_Frame> frames(nFrames);
+  std::vector<_Sample> samples(nFrames * nFingers * nEvalsPerFingerPerFrame);
+  Eigen::MatrixXd partials =
+      Eigen::MatrixXd::Zero(kPartialSize, std::max<size_t>(nItems, 1));
+
+  std::vector<Pose> poses(nFrames);
+  poses[0] = params.trajectory.front();
+  for (size_t f = 1; f < nFrames; f++) {
+    size_t iKf = (f - 1) / nTrajectorySteps + 1;
+    size_t j = (f - 1) % nTrajectorySteps + 1;
+    double trajectoryT = j * trajectoryStep;
+    poses[f] = params.trajectory[iKf - 1] * (1 - trajectoryT) +
+               params.trajectory[iKf] * trajectoryT;
+  }
+  std::vector<robots::Kinematics> kinematics;
+  robots::ForwardKinematicsBatch(poses, kinematics);
+
+#pragma omp parallel
+  {
+#pragma omp for schedule(dynamic)
+    for (long long f = 0; f < (long long)nFrames; f++) {
+      frames[f].H = kinematics[f].effector;
+      if (f == 0)
+        frames[f].R.setIdentity();
+      else
+        frames[f].R = (frames[f].H * fingerTransInv).linear();
+      frames[f].J = kinematics[f].jacobian;
+    }
+
+#pragma omp for schedule(dynamic)
+    for (long long fi = 0; fi < (long long)(nFrames * nFingers); fi++) {
+      const _Frame& frame = frames[fi / nFingers];
+      const Eigen::MatrixX3d& effFinger = effFingers[fi % nFingers];
+      Eigen::MatrixX3d P = (frame.H * effFinger.transpose()).transpose();
+      Eigen::VectorXd evals;
+      Eigen::MatrixX3d dEvals;
+      EvalAtBatchT<Scalar>(P, settings.cost, mdr, evals, dEvals);
+      Eigen::Matrix<double, Eigen::Dynamic, kNumDOFs> dEvals_dTheta;
+      frame.J.Evaluate(effFinger, dEvals * frame.H.linear(), dEvals_dTheta);
+      _Sample* block = samples.data() + fi * nEvalsPerFingerPerFrame;
+      for (long long jj = 0; jj < (long long)nEvalsPerFingerPerFrame; jj++) {
+        block[jj].eval = evals(jj);
+        block[jj].lerpedJoint = P.row(jj);
+        block[jj].dEval_dJoint = dEvals.row(jj) * frame.R;
+        block[jj].dEval_dTheta = dEvals_dTheta.row(jj);
+      }
+    }
+
+#pragma omp for schedule(dynamic)
+    for (long long item = 0; item < (long long)nItems; item++) {
+      const size_t f = item / nFingers + 1;
+      const size_t i = item % nFingers;
+      const size_t iKf = (f - 1) / nTrajectorySteps + 1;
+      const size_t j = (f - 1) % nTrajectorySteps + 1;
+      const double trajectoryT = j * trajectoryStep;
+      const double lastTrajectoryT = (j - 1) * trajectoryStep;
+      const _Duration& d = durations[iKf];
+      const _Sample* cur = samples.data() +
+                           (f * nFingers + i) * nEvalsPerFingerPerFrame;
+      const _Sample* last = samples.data() +
+                            ((f - 1) * nFingers + i) * nEvalsPerFingerPerFrame;
+
+      auto partial = partials.col(item);
+      auto dCost_dFinger = [&partial, kFingerOffset, nFingerJoints, i](
+                               size_t iJoint) {
+        return partial.segment<3>(kFingerOffset +
+                                  (i * nFingerJoints + iJoint) * 3);
+      };
+      auto dCost_dTheta_0 =
+          partial.segment<kNumDOFs>(kThetaOffset + (iKf - 1) * kNumDOFs);
+      auto dCost_dTheta_1 =
+          partial.segment<kNumDOFs>(kThetaOffset + iKf * kNumDOFs);
+
+      auto ApplyGradient = [&](const _Sample& sample,
+                               size_t jj,
+                               double factor,
+                               bool isLast) {
+        double fingerT = fingerTs[jj];
+        dCost_dFinger(iJoints[jj]) +=
+            (sample.dEval_dJoint * ((1. - fingerT) * factor)).transpose();
+        dCost_dFinger(iJoints[jj] + 1) +=
+            (sample.dEval_dJoint * (fingerT * factor)).transpose();
+        double t = isLast ? lastTrajectoryT : trajectoryT;
+        dCost_dTheta_0 += sample.dEval_dTheta.transpose() * ((1. - t) * factor);
+        dCost_dTheta_1 += sample.dEval_dTheta.transpose() * (t * factor);
+      };
+
+      for (long long jj = 1; jj < (long long)nEvalsPerFingerPerFrame; jj++) {
+        Eigen::RowVector3d dFingerLen_dLerpedJoint1;
+        double finger_len = Norm(cur[jj - 1].lerpedJoint,
+                                 cur[jj].lerpedJoint,
+                                 dFingerLen_dLerpedJoint1);
+        double total_eval = cur[jj - 1].eval + 2 * cur[jj].eval +
+                            2 * last[jj - 1].eval + last[jj].eval;
+        double non_eval_factor = finger_len * trajectoryStep * d.duration;
+
+        partial(0) += total_eval * non_eval_factor;
+
+        ApplyGradient(cur[jj - 1], jj - 1, non_eval_factor, false);
+        ApplyGradient(cur[jj], jj, 2 * non_eval_factor, false);
+        ApplyGradient(last[jj - 1], jj - 1, 2 * non_eval_factor, true);
+        ApplyGradient(last[jj], jj, non_eval_factor, true);
+
+        double non_finger_len_factor = total_eval * trajectoryStep * d.duration;
+        const Eigen::Matrix3d& R = frames[f].R;
+        Eigen::RowVector3d g = dFingerLen_dLerpedJoint1 * R;
+        dCost_dFinger(iJoints[jj - 1]) +=
+            (g * ((1. - fingerTs[jj - 1]) * non_finger_len_factor)).transpose();
+        dCost_dFinger(iJoints[jj - 1] + 1) +=
+            (g * (fingerTs[jj - 1] * non_finger_len_factor)).transpose();
+        dCost_dFinger(iJoints[jj]) -=
+            (g * ((1. - fingerTs[jj]) * non_finger_len_factor)).transpose();
+        dCost_dFinger(iJoints[jj] + 1) -=
+            (g * (fingerTs[jj] * non_finger_len_factor)).transpose();
+
+        double ddTheta = total_eval * finger_len * trajectoryStep / angVelocity;
+        if (d.flip) ddTheta = -ddTheta;
+        dCost_dTheta_0(d.idx) -= ddTheta;
+        dCost_dTheta_1(d.idx) += ddTheta;
+      }
+    }
+  }
+
+  // Pairwise reduction with a shape that only depends on nItems
+  for (size_t stride = 1; stride < nItems; stride *= 2) {
+#pragma omp parallel for
+    for (long long k = 0; k < (long long)nItems; k += 2 * stride) {
+      if (k + stride < nItems) partials.col(k) += partials.col(k + stride);
+    }
+  }
+
+  Eigen::VectorXd total = partials.col(0) / 6.;
+  out_dCost_dParam.fingers.resize(nFingers);
+  for (size_t i = 0; i < nFingers; i++) {
+    out_dCost_dParam.fingers[i] = Eigen::Map<
+        const Eigen::Matrix<double, Eigen::Dynamic, 3, Eigen::RowMajor>>(
+        total.data() + kFingerOffset + i * nFingerJoints * 3, nFingerJoints, 3);
+  }
+  out_dCost_dParam.trajectory.resize(nKeyframes);
+  for (size_t k = 0; k < nKeyframes; k++) {
+    out_dCost_dParam.trajectory[k] =
+        total.segment<kNumDOFs>(kThetaOffset + k * kNumDOFs).array();
+  }
+  return total(0);
+}
+
+void CostWorkspace::Resize(size_t n_fingers,
+                           size_t n_finger_joints,
+                           size_t n_finger_steps) {
+  const long long nSamples = (n_finger_joints - 1) * n_finger_steps + 1;
+  finger_t.resize(nSamples);
+  joint.resize(nSamples);
+  for (long long jj = 0; jj < nSamples; jj++) {
+    long long kk = (jj - 1) % (long long)n_finger_steps + 1;
+    finger_t(jj) = kk * (1. / n_finger_steps);
+    joint(jj) = (int)((jj - 1) / (long long)n_finger_steps);
+  }
+  eff_fingers.resize(n_fingers);
+  last.resize(n_fingers);
+  cur.resize(n_fingers);
+  for (size_t i = 0; i < n_fingers; i++) {
+    // No-ops unless the shape changed
+    eff_fingers[i].resize(nSamples, 3);
+    for (FrameData* data : {&last[i], &cur[i]}) {
+      data->pos.resize(nSamples, 3);
+      data->eval.resize(nSamples);
+      data->dEval_dPos.resize(nSamples, 3);
+      data->dEval_dTheta.resize(nSamples, kNumDOFs);
+    }
+  }
+}
+
+// Positions, evaluations and derivatives of the samples of one finger at
+// the frame with forward kinematics H
+template <typename Scalar = double>
+static void EvalFrame(const Eigen::MatrixX3d& effFinger,
+                      const Eigen::Affine3d& H,
+                      const robots::JacobianEvaluator& J,
+                      const CostSettings& settings,
+                      const MeshDependentResource& mdr,
+                      CostWorkspace::FrameData& out_data) {
+  out_data.pos.noalias() = effFinger * H.linear().transpose();
+  out_data.pos.rowwise() += H.translation().transpose();
+  EvalAtBatchT<Scalar>(
+      out_data.pos, settings, mdr, out_data.eval, out_data.dEval_dPos);
+  J.Evaluate(
+      effFinger, out_data.dEval_dPos * H.linear(), out_data.dEval_dTheta);
+}
+
+// Samples of a finger in effector space, one row per sample
+static void ComputeEffFinger(const Eigen::MatrixXd& finger,
+                             const Eigen::Affine3d& fingerTransInv,
+                             const Eigen::VectorXd& fingerT,
+                             const Eigen::VectorXi& iJoint,
+                             Eigen::MatrixX3d& out_eff) {
+  Eigen::MatrixX3d effFinger =
+      (fingerTransInv * finger.transpose().colwise().homogeneous())
+          .transpose();
+  for (long long jj = 0; jj < fingerT.size(); jj++) {
+    out_eff.row(jj) = effFinger.row(iJoint(jj)) * (1. - fingerT(jj)) +
+                      effFinger.row(iJoint(jj) + 1) * fingerT(jj);
+  }
+}
+
+// Constants of one trajectory step of the ComputeCost kernel
+struct _Step {
+  const Eigen::VectorXd& fingerT;
+  const Eigen::VectorXi& iJoint;
+  // Linear part of dLerpedJoint/dJoint, scaled by (1 - fingerT) for iJoint
+  // and by fingerT for iJoint + 1
+  const Eigen::Matrix3d& lastR;
+  const Eigen::Matrix3d& curR;
+  double lastTrajectoryT;
+  double trajectoryT;
+  double trajectoryStep;
+  double duration;
+  double angVelocity;
+  size_t duration_idx;
+  bool duration_flip;
+};
+
+// Adds the contribution of the samples jj - 1 and jj of one finger between
+// the frames last and cur, not yet divided by 6
+static void AccumulateSample(const CostWorkspace::FrameData& last,
+                             const CostWorkspace::FrameData& cur,
+                             long long jj,
+                             const _Step& step,
+                             CostBlock& out_block) {
+  const Eigen::VectorXd& fingerT = step.fingerT;
+  const Eigen::VectorXi& iJoint = step.iJoint;
+
+  auto ApplyGradient = [&step, &fingerT, &iJoint, &out_block](
+                           const CostWorkspace::FrameData& data,
+                           long long jj,
+                           double factor,
+                           bool last) {
+    Eigen::RowVector3d dEval_dJoint =
+        data.dEval_dPos.row(jj) * (last ? step.lastR : step.curR);
+
+    // dEval/dFinger * factor
+    out_block.dCost_dFinger.row(iJoint(jj)) +=
+        dEval_dJoint * ((1. - fingerT(jj)) * factor);
+    out_block.dCost_dFinger.row(iJoint(jj) + 1) +=
+        dEval_dJoint * (fingerT(jj) * factor);
+
+    // dEval/dTheta * factor
+    double t = last ? step.lastTrajectoryT : step.trajectoryT;
+    out_block.dCost_dTheta0 +=
+        data.dEval_dTheta.row(jj).array() * ((1. - t) * factor);
+    out_block.dCost_dTheta1 +=
+        data.dEval_dTheta.row(jj).array() * (t * factor);
   };
 
-  std::vector<std::vector<_Data>> lastData(
-      nFingers, std::vector<_Data>(nEvalsPerFingerPerFrame));
-  std::vector<std::vector<_Data>> curData(
-      nFingers, std::vector<_Data>(nEvalsPerFingerPerFrame));
+  Eigen::RowVector3d dFingerLen_dLerpedJoint1;
+  // dFingerLen_dLerpedJoint2 = -dFingerLen_dLerpedJoint1
+  double finger_len =
+      Norm(cur.pos.row(jj - 1), cur.pos.row(jj), dFingerLen_dLerpedJoint1);
+  double total_eval = cur.eval(jj - 1) + 2 * cur.eval(jj) +
+                      2 * last.eval(jj - 1) + last.eval(jj);
+  double non_eval_factor = finger_len * step.trajectoryStep * step.duration;
+
+  // The cost
+  out_block.cost += total_eval * non_eval_factor;
+
+  // Apply eval part of gradient
+  ApplyGradient(cur, jj - 1, non_eval_factor, false);
+  ApplyGradient(cur, jj, 2 * non_eval_factor, false);
+  ApplyGradient(last, jj - 1, 2 * non_eval_factor, true);
+  ApplyGradient(last, jj, non_eval_factor, true);
+
+  // total_eval * dFingerLen/dFinger * trajectoryStep * duration
+  double non_finger_len_factor =
+      total_eval * step.trajectoryStep * step.duration;
+  Eigen::RowVector3d dFingerLen_dJoint1 =
+      dFingerLen_dLerpedJoint1 * step.curR * non_finger_len_factor;
+  out_block.dCost_dFinger.row(iJoint(jj - 1)) +=
+      dFingerLen_dJoint1 * (1. - fingerT(jj - 1));
+  out_block.dCost_dFinger.row(iJoint(jj - 1) + 1) +=
+      dFingerLen_dJoint1 * fingerT(jj - 1);
+  out_block.dCost_dFinger.row(iJoint(jj)) -=
+      dFingerLen_dJoint1 * (1. - fingerT(jj));
+  out_block.dCost_dFinger.row(iJoint(jj) + 1) -=
+      dFingerLen_dJoint1 * fingerT(jj);
+
+  // total_eval * finger_len * trajectoryStep * dDuration/dTheta
+  double ddTheta =
+      total_eval * finger_len * step.trajectoryStep / step.angVelocity;
+  if (step.duration_flip) ddTheta = -ddTheta;
+  out_block.dCost_dTheta0(step.duration_idx) -= ddTheta;
+  out_block.dCost_dTheta1(step.duration_idx) += ddTheta;
+}
+
+double ComputeCost(const GripperParams& params,
+                   const GripperParams& init_params,
+                   const GripperSettings& settings,
+                   const MeshDependentResource& mdr,
+                   GripperParams& out_dCost_dParam,
+                   Debugger* const debugger) {
+  CostWorkspace workspace;
+  return ComputeCost(params,
+                     init_params,
+                     settings,
+                     mdr,
+                     workspace,
+                     out_dCost_dParam,
+                     debugger);
+}
+
+// ComputeCost with the samples evaluated in Scalar precision. Everything
+// else, including the accumulation, stays in double.
+template <typename Scalar>
+static double ComputeCostT(const GripperParams& params,
+                           const GripperParams& init_params,
+                           const GripperSettings& settings,
+                           const MeshDependentResource& mdr,
+                           CostWorkspace& workspace,
+                           GripperParams& out_dCost_dParam,
+                           Debugger* const debugger) {
+  if (settings.cost.flat_parallel) {
+    return ComputeCostFlat<Scalar>(params, settings, mdr, out_dCost_dParam);
+  }
+
+  const size_t nTrajectorySteps = settings.cost.n_trajectory_steps;
+  const long long nFingerSteps = settings.cost.n_finger_steps;
+  const double angVelocity = settings.cost.ang_velocity;
+  const double trajectoryStep = 1. / nTrajectorySteps;
+
+  const size_t nKeyframes = params.trajectory.size();
+  const size_t nFingers = params.fingers.size();
+  const size_t nFingerJoints = settings.finger.n_finger_joints;
+  const size_t nEvalsPerFingerPerFrame = (nFingerJoints - 1) * nFingerSteps + 1;
 
-  // Finger in effector space
-  std::vector<std::vector<Eigen::Vector3d>> effFingers(
-      nFingers, std::vector<Eigen::Vector3d>(nEvalsPerFingerPerFrame));
+  workspace.Resize(nFingers, nFingerJoints, nFingerSteps);
+  const Eigen::VectorXd& fingerT = workspace.finger_t;
+  const Eigen::VectorXi& iJoint = workspace.joint;
 
-  Eigen::Affine3d lastH;
-  Eigen::Affine3d curH;
+  // See _Step
+  Eigen::Matrix3d lastR;
+  Eigen::Matrix3d curR;
 
   std::vector<Eigen::MatrixXd> dCost_dFinger(
       nFingers, Eigen::MatrixXd::Zero(nFingerJoints, 3));
@@ -132,37 +641,14 @@ double ComputeCost(const GripperParams& params,
   Eigen::Affine3d fingerTransInv = fingerTrans.inverse();
 
   {
-    curH = robots::Forward(params.trajectory.front());
-    JacobianFunc J = robots::ComputeJacobian(params.trajectory.front());
+    robots::JacobianEvaluator J(params.trajectory.front());
     for (size_t i = 0; i < nFingers; i++) {
-      const Eigen::MatrixXd& finger = params.fingers[i];
-      Eigen::MatrixXd effFinger =
-          (fingerTransInv * finger.transpose().colwise().homogeneous())
-              .transpose();
-#pragma omp parallel for
-      for (long long jj = 0; jj < nEvalsPerFingerPerFrame; jj++) {
-        _Data& data = lastData[i][jj];
-        long long kk = (jj - 1) % nFingerSteps + 1;
-        long long joint = (jj - 1) / nFingerSteps + 1;
-        double fingerT = kk * fingerStep;
-
-        // precompute finger
-        Eigen::Vector3d lerpedJoint =
-            curH *
-            (effFingers[i][jj] = effFinger.row(joint - 1) * (1. - fingerT) +
-                                 effFinger.row(joint) * fingerT);
-
-        data.lerpedJoint = lerpedJoint;
-        data.dLerpedJoint_dJoint1 =
-            (1. - fingerT) * Eigen::Matrix3d::Identity();
-        data.dLerpedJoint_dJoint2 = fingerT * Eigen::Matrix3d::Identity();
-        data.eval =
-            EvalAt(lerpedJoint, settings.cost, mdr, data.dEval_dLerpedJoint);
-        data.iJoint = joint - 1;
-        data.dpos_dtheta = J(effFingers[i][jj]);
-      }
+      Eigen::MatrixX3d& eff = workspace.eff_fingers[i];
+      ComputeEffFinger(params.fingers[i], fingerTransInv, fingerT, iJoint, eff);
+      EvalFrame<Scalar>(
+          eff, fingerTrans, J, settings.cost, mdr, workspace.last[i]);
     }
-    lastH = curH;
+    lastR.setIdentity();
   }
 
   double totalCost = 0.;
@@ -174,128 +660,57 @@ double ComputeCost(const GripperParams& params,
                                       angVelocity,
                                       duration_idx,
                                       duration_flip);
-    // std::cout << std::setprecision(12) << duration << " " << duration_idx <<
-    // " "
-    //<< duration_flip << std::endl;
-    Pose t_lerpedKeyframe;
+    // Kinematics of all the steps between the two keyframes at once
+    workspace.poses.resize(nTrajectorySteps);
+    for (long long j = 1; j <= nTrajectorySteps; j++) {
+      double trajectoryT = j * trajectoryStep;
+      workspace.poses[j - 1] = params.trajectory[iKf - 1] * (1 - trajectoryT) +
+                               params.trajectory[iKf] * trajectoryT;
+    }
+    robots::ForwardKinematicsBatch(workspace.poses, workspace.kinematics);
     for (long long j = 1; j <= nTrajectorySteps; j++) {
       double trajectoryT = j * trajectoryStep;
       double lastTrajectoryT = (j - 1) * trajectoryStep;
-      t_lerpedKeyframe = params.trajectory[iKf - 1] * (1 - trajectoryT) +
-                         params.trajectory[iKf] * trajectoryT;
-      curH = robots::Forward(t_lerpedKeyframe);
-      JacobianFunc J = robots::ComputeJacobian(t_lerpedKeyframe);
-      Eigen::Affine3d curTrans = curH * fingerTransInv;
+      const Eigen::Affine3d& curH = workspace.kinematics[j - 1].effector;
+      const robots::JacobianEvaluator& J = workspace.kinematics[j - 1].jacobian;
+      curR = (curH * fingerTransInv).linear();
+      const _Step step{fingerT,
+                       iJoint,
+                       lastR,
+                       curR,
+                       lastTrajectoryT,
+                       trajectoryT,
+                       trajectoryStep,
+                       duration,
+                       angVelocity,
+                       duration_idx,
+                       duration_flip};
       for (size_t i = 0; i < nFingers; i++) {
-#pragma omp parallel for
-        for (long long jj = 0; jj < nEvalsPerFingerPerFrame; jj++) {
-          _Data& data = curData[i][jj];
-          long long kk = (jj - 1) % nFingerSteps + 1;
-          long long joint = (jj - 1) / nFingerSteps + 1;
-          double fingerT = kk * fingerStep;
-
-          Eigen::Vector3d lerpedJoint = curH * effFingers[i][jj];
-
-          data.lerpedJoint = lerpedJoint;
-          data.dLerpedJoint_dJoint1 = (1. - fingerT) * curTrans.linear();
-          data.dLerpedJoint_dJoint2 = fingerT * curTrans.linear();
-          data.eval =
-              EvalAt(lerpedJoint, settings.cost, mdr, data.dEval_dLerpedJoint);
-          data.iJoint = joint - 1;
-          data.dpos_dtheta = J(effFingers[i][jj]);
-        }
+        const CostWorkspace::FrameData& last = workspace.last[i];
+        CostWorkspace::FrameData& cur = workspace.cur[i];
+        EvalFrame<Scalar>(
+            workspace.eff_fingers[i], curH, J, settings.cost, mdr, cur);
 
 #pragma omp parallel
         {
-          double t_curCost = 0.;
-          Eigen::MatrixXd t_dCost_dFinger =
-              Eigen::MatrixXd::Zero(nFingerJoints, 3);
-          Pose t_dCost_dTheta_0 = Pose::Zero();
-          Pose t_dCost_dTheta_1 = Pose::Zero();
-
-          auto t_ApplyGradient =
-              [&t_dCost_dTheta_0,
-               &t_dCost_dTheta_1,
-               &t_dCost_dFinger,
-               &curH,
-               &lastH,
-               iKf,
-               lastTrajectoryT,
-               trajectoryT](const _Data& data, double factor, bool last) {
-                Eigen::RowVector3d dEval_dJoint1 =
-                    data.dEval_dLerpedJoint * data.dLerpedJoint_dJoint1;
-                Eigen::RowVector3d dEval_dJoint2 =
-                    data.dEval_dLerpedJoint * data.dLerpedJoint_dJoint2;
-
-                Eigen::Matrix<double, 1, 6> dEval_dTheta =
-                    data.dEval_dLerpedJoint * (last ? lastH : curH).linear() *
-                    data.dpos_dtheta;
-
-                // dEval/dFinger * factor
-                t_dCost_dFinger.row(data.iJoint) += dEval_dJoint1 * factor;
-                t_dCost_dFinger.row(data.iJoint + 1) += dEval_dJoint2 * factor;
-
-                // dEval/dTheta * factor
-                double t = last ? lastTrajectoryT : trajectoryT;
-                t_dCost_dTheta_0 += dEval_dTheta.array() * ((1. - t) * factor);
-                t_dCost_dTheta_1 += dEval_dTheta.array() * (t * factor);
-              };
+          CostBlock t_block;
+          t_block.SetZero(nFingerJoints);
 #pragma omp for
           for (long long jj = 1; jj < nEvalsPerFingerPerFrame; jj++) {
-            Eigen::RowVector3d dFingerLen_dLerpedJoint1;
-            // dFingerLen_dLerpedJoint2 = -dFingerLen_dLerpedJoint1
-            double finger_len = Norm(curData[i][jj - 1].lerpedJoint,
-                                     curData[i][jj].lerpedJoint,
-                                     dFingerLen_dLerpedJoint1);
-            double total_eval =
-                curData[i][jj - 1].eval + 2 * curData[i][jj].eval +
-                2 * lastData[i][jj - 1].eval + lastData[i][jj].eval;
-            double non_eval_factor = finger_len * trajectoryStep * duration;
-
-            // The cost
-            t_curCost += total_eval * non_eval_factor;
-
-            // Apply eval part of gradient
-            t_ApplyGradient(curData[i][jj - 1], non_eval_factor, false);
-            t_ApplyGradient(curData[i][jj], 2 * non_eval_factor, false);
-            t_ApplyGradient(lastData[i][jj - 1], 2 * non_eval_factor, true);
-            t_ApplyGradient(lastData[i][jj], non_eval_factor, true);
-
-            // total_eval * dFingerLen/dFinger * trajectoryStep * duration
-            double non_finger_len_factor =
-                total_eval * trajectoryStep * duration;
-            t_dCost_dFinger.row(curData[i][jj - 1].iJoint) +=
-                dFingerLen_dLerpedJoint1 *
-                curData[i][jj - 1].dLerpedJoint_dJoint1 * non_finger_len_factor;
-            t_dCost_dFinger.row(curData[i][jj - 1].iJoint + 1) +=
-                dFingerLen_dLerpedJoint1 *
-                curData[i][jj - 1].dLerpedJoint_dJoint2 * non_finger_len_factor;
-            t_dCost_dFinger.row(curData[i][jj].iJoint) +=
-                -dFingerLen_dLerpedJoint1 *
-                curData[i][jj].dLerpedJoint_dJoint1 * non_finger_len_factor;
-            t_dCost_dFinger.row(curData[i][jj].iJoint + 1) +=
-                -dFingerLen_dLerpedJoint1 *
-                curData[i][jj].dLerpedJoint_dJoint2 * non_finger_len_factor;
-
-            // total_eval * finger_len * trajectoryStep * dDuration/dTheta
-            double ddTheta =
-                total_eval * finger_len * trajectoryStep / angVelocity;
-            if (duration_flip) ddTheta = -ddTheta;
-            t_dCost_dTheta_0(duration_idx) -= ddTheta;
-            t_dCost_dTheta_1(duration_idx) += ddTheta;
+            AccumulateSample(last, cur, jj, step, t_block);
           }
 
 #pragma omp critical
           {
-            totalCost += t_curCost;
-            dCost_dFinger[i] += t_dCost_dFinger;
-            dCost_dTheta[iKf - 1] += t_dCost_dTheta_0;
-            dCost_dTheta[iKf] += t_dCost_dTheta_1;
+            totalCost += t_block.cost;
+            dCost_dFinger[i] += t_block.dCost_dFinger;
+            dCost_dTheta[iKf - 1] += t_block.dCost_dTheta0;
+            dCost_dTheta[iKf] += t_block.dCost_dTheta1;
           }
         }
       }
-      lastH = curH;
-      std::swap(curData, lastData);
+      lastR = curR;
+      std::swap(workspace.cur, workspace.last);
     }
   }
   totalCost /= 6.;
@@ -310,6 +725,153 @@ double ComputeCost(const GripperParams& params,
   return totalCost;
 }
 
+double ComputeCost(const GripperParams& params,
+                   const GripperParams& init_params,
+                   const GripperSettings& settings,
+                   const MeshDependentResource& mdr,
+                   CostWorkspace& workspace,
+                   GripperParams& out_dCost_dParam,
+                   Debugger* const debugger) {
+  return ComputeCostT<double>(params,
+                              init_params,
+                              settings,
+                              mdr,
+                              workspace,
+                              out_dCost_dParam,
+                              debugger);
+}
+
+double ComputeCostFloat(const GripperParams& params,
+                        const GripperParams& init_params,
+                        const GripperSettings& settings,
+                        const MeshDependentResource& mdr,
+                        GripperParams& out_dCost_dParam,
+                        Debugger* const debugger) {
+  CostWorkspace workspace;
+  return ComputeCostFloat(params,
+                          init_params,
+                          settings,
+                          mdr,
+                          workspace,
+                          out_dCost_dParam,
+                          debugger);
+}
+
+double ComputeCostFloat(const GripperParams& params,
+                        const GripperParams& init_params,
+                        const GripperSettings& settings,
+                        const MeshDependentResource& mdr,
+                        CostWorkspace& workspace,
+                        GripperParams& out_dCost_dParam,
+                        Debugger* const debugger) {
+  return ComputeCostT<float>(params,
+                             init_params,
+                             settings,
+                             mdr,
+                             workspace,
+                             out_dCost_dParam,
+                             debugger);
+}
+
+void CostBlock::SetZero(size_t n_finger_joints) {
+  cost = 0;
+  dCost_dFinger.setZero(n_finger_joints, 3);
+  dCost_dTheta0.setZero();
+  dCost_dTheta1.setZero();
+}
+
+void ComputeCostBlock(const GripperParams& params,
+                      const GripperSettings& settings,
+                      const MeshDependentResource& mdr,
+                      size_t finger,
+                      size_t keyframe,
+                      CostWorkspace& workspace,
+                      CostBlock& out_block) {
+  const size_t nTrajectorySteps = settings.cost.n_trajectory_steps;
+  const long long nFingerSteps = settings.cost.n_finger_steps;
+  const double angVelocity = settings.cost.ang_velocity;
+  const double trajectoryStep = 1. / nTrajectorySteps;
+
+  const size_t nFingerJoints = settings.finger.n_finger_joints;
+  const size_t nEvalsPerFingerPerFrame = (nFingerJoints - 1) * nFingerSteps + 1;
+
+  workspace.Resize(1, nFingerJoints, nFingerSteps);
+  const Eigen::VectorXd& fingerT = workspace.finger_t;
+  const Eigen::VectorXi& iJoint = workspace.joint;
+
+  Eigen::Affine3d fingerTransInv =
+      robots::Forward(params.trajectory.front()).inverse();
+  ComputeEffFinger(params.fingers[finger],
+                   fingerTransInv,
+                   fingerT,
+                   iJoint,
+                   workspace.eff_fingers[0]);
+
+  size_t duration_idx;
+  bool duration_flip;
+  double duration = ComputeDuration(params.trajectory[keyframe - 1],
+                                    params.trajectory[keyframe],
+                                    angVelocity,
+                                    duration_idx,
+                                    duration_flip);
+
+  // Unlike ComputeCost, the first frame of the segment is evaluated here
+  // rather than reused from the previous segment
+  workspace.poses.resize(nTrajectorySteps + 1);
+  for (size_t j = 0; j <= nTrajectorySteps; j++) {
+    double trajectoryT = j * trajectoryStep;
+    workspace.poses[j] =
+        params.trajectory[keyframe - 1] * (1 - trajectoryT) +
+        params.trajectory[keyframe] * trajectoryT;
+  }
+  robots::ForwardKinematicsBatch(workspace.poses, workspace.kinematics);
+
+  Eigen::Matrix3d lastR;
+  Eigen::Matrix3d curR;
+  if (keyframe == 1)
+    lastR.setIdentity();
+  else
+    lastR = (workspace.kinematics[0].effector * fingerTransInv).linear();
+  EvalFrame(workspace.eff_fingers[0],
+            workspace.kinematics[0].effector,
+            workspace.kinematics[0].jacobian,
+            settings.cost,
+            mdr,
+            workspace.last[0]);
+
+  out_block.SetZero(nFingerJoints);
+  for (size_t j = 1; j <= nTrajectorySteps; j++) {
+    const robots::Kinematics& kinematics = workspace.kinematics[j];
+    curR = (kinematics.effector * fingerTransInv).linear();
+    EvalFrame(workspace.eff_fingers[0],
+              kinematics.effector,
+              kinematics.jacobian,
+              settings.cost,
+              mdr,
+              workspace.cur[0]);
+    const _Step step{fingerT,
+                     iJoint,
+                     lastR,
+                     curR,
+                     (j - 1) * trajectoryStep,
+                     j * trajectoryStep,
+                     trajectoryStep,
+                     duration,
+                     angVelocity,
+                     duration_idx,
+                     duration_flip};
+    for (long long jj = 1; jj < nEvalsPerFingerPerFrame; jj++) {
+      AccumulateSample(workspace.last[0], workspace.cur[0], jj, step, out_block);
+    }
+    lastR = curR;
+    std::swap(workspace.cur, workspace.last);
+  }
+  out_block.cost /= 6.;
+  out_block.dCost_dFinger /= 6.;
+  out_block.dCost_dTheta0 /= 6.;
+  out_block.dCost_dTheta1 /= 6.;
+}
+
 double ComputeCost1(const GripperParams& params,
                     const GripperParams& init_params,
                     const GripperSettings& settings,
@@ -564,9 +1126,156 @@ double ComputeCost1(const GripperParams& params,
   return cost;
 }
 
+// MinDistance over the finger samples D_fingers (effector space) at every
+// pose of the subdivided trajectory, querying one sample per block of finger
+// samples and one pose per block of poses first. The distance (including the floor) is 1-Lipschitz,
+// so a block whose query minus the largest displacement of its samples
+// from the queried one is not below the current minimum cannot lower it.
+// Only the other blocks are queried sample by sample, which gives the same
+// result as querying everything.
+//  trans: Forward of every pose
+//  seg_begin: poses of segment i are [seg_begin[i], seg_begin[i + 1])
+//  seg_sub: number of pose steps per segment
+static double MinDistanceHierarchical(const Eigen::MatrixXd& D_fingers,
+                                      const Trajectory& trajectory,
+                                      const std::vector<Eigen::Affine3d>& trans,
+                                      const std::vector<size_t>& seg_begin,
+                                      const std::vector<size_t>& seg_sub,
+                                      const CostSettings& settings,
+                                      const MeshDependentResource& mdr,
+                                      size_t& out_n_skipped) {
+  constexpr size_t kFingerBlock = 16;
+  constexpr size_t kPoseBlock = 8;
+  // Covers the rounding errors of the queries and of the bounds
+  constexpr double kMargin = 1e-9;
+
+  // Upper bound of the distance from the axis of joint k to the effector
+  double reach[kNumDOFs + 1];
+  reach[kNumDOFs] = 0;
+  for (size_t k = kNumDOFs; k-- > 0;) {
+    reach[k] = reach[k + 1] + std::hypot(kRobotA[k], kRobotD[k]);
+  }
+
+  struct _FingerBlock {
+    size_t begin;
+    size_t end;
+    size_t mid;
+    double radius;  // around the middle sample
+    double norm;    // distance to the effector
+  };
+  std::vector<_FingerBlock> f_blocks;
+  for (size_t begin = 0; begin < (size_t)D_fingers.rows();
+       begin += kFingerBlock) {
+    _FingerBlock b;
+    b.begin = begin;
+    b.end = std::min<size_t>(begin + kFingerBlock, D_fingers.rows());
+    b.mid = (b.begin + b.end) / 2;
+    b.radius = 0;
+    b.norm = 0;
+    for (size_t i = b.begin; i < b.end; i++) {
+      b.radius = std::max(b.radius,
+                          (D_fingers.row(i) - D_fingers.row(b.mid)).norm());
+      b.norm = std::max(b.norm, D_fingers.row(i).norm());
+    }
+    f_blocks.push_back(b);
+  }
+
+  // A point at distance r from the effector moves by at most
+  // sum_k |dTheta_k| * (r + reach[k]) for a joint step dTheta. The
+  // displacement from the middle pose of a block is at most
+  // a * r + b. Blocks do not straddle segments since the step is per
+  // segment.
+  struct _PoseBlock {
+    size_t begin;
+    size_t end;
+    size_t mid;
+    double a;
+    double b;
+  };
+  std::vector<_PoseBlock> p_blocks;
+  for (size_t i = 0; i + 1 < seg_begin.size(); i++) {
+    Pose step = (trajectory[i + 1] - trajectory[i]).abs() / seg_sub[i];
+    double step_sum = step.sum();
+    double step_reach = 0;
+    for (size_t k = 0; k < kNumDOFs; k++) step_reach += step(k) * reach[k];
+    for (size_t begin = seg_begin[i]; begin < seg_begin[i + 1];
+         begin += kPoseBlock) {
+      _PoseBlock b;
+      b.begin = begin;
+      b.end = std::min(begin + kPoseBlock, seg_begin[i + 1]);
+      b.mid = (b.begin + b.end) / 2;
+      double n_steps = std::max(b.mid - b.begin, b.end - 1 - b.mid);
+      b.a = n_steps * step_sum;
+      b.b = n_steps * step_reach;
+      p_blocks.push_back(b);
+    }
+  }
+
+  const size_t nFBlocks = f_blocks.size();
+  const size_t nPBlocks = p_blocks.size();
+  if (nFBlocks == 0 || nPBlocks == 0) return 0;
+
+  Eigen::VectorXd s;
+  Eigen::MatrixX3d ds_dp;  // unused
+
+  // Coarse pass, the queried samples are actual samples so they count
+  // toward the minimum
+  Eigen::MatrixX3d coarse(nPBlocks * nFBlocks, 3);
+#pragma omp parallel for
+  for (long long pb = 0; pb < (long long)nPBlocks; pb++) {
+    const Eigen::Affine3d& T = trans[p_blocks[pb].mid];
+    for (size_t fb = 0; fb < nFBlocks; fb++) {
+      Eigen::Vector3d p = D_fingers.row(f_blocks[fb].mid);
+      coarse.row(pb * nFBlocks + fb) = (T * p).transpose();
+    }
+  }
+  GetDistBatch(coarse, settings, mdr, s, ds_dp);
+  double min_dist = std::min(0., s.minCoeff());
+
+  // Fine pass
+  std::vector<std::pair<size_t, size_t>> refine;
+  std::vector<size_t> refine_offset;
+  size_t n_fine = 0;
+  out_n_skipped = 0;
+  for (size_t pb = 0; pb < nPBlocks; pb++) {
+    const _PoseBlock& p = p_blocks[pb];
+    for (size_t fb = 0; fb < nFBlocks; fb++) {
+      const _FingerBlock& f = f_blocks[fb];
+      double lower = s(pb * nFBlocks + fb) - f.radius - (p.a * f.norm + p.b) -
+                     kMargin;
+      size_t n = (p.end - p.begin) * (f.end - f.begin);
+      if (lower >= min_dist) {
+        out_n_skipped += n - 1;
+      } else {
+        refine.push_back({pb, fb});
+        refine_offset.push_back(n_fine);
+        n_fine += n;
+      }
+    }
+  }
+  if (n_fine == 0) return min_dist;
+
+  Eigen::MatrixX3d fine(n_fine, 3);
+#pragma omp parallel for schedule(dynamic)
+  for (long long r = 0; r < (long long)refine.size(); r++) {
+    const _PoseBlock& p = p_blocks[refine[r].first];
+    const _FingerBlock& f = f_blocks[refine[r].second];
+    size_t row = refine_offset[r];
+    for (size_t j = p.begin; j < p.end; j++) {
+      for (size_t i = f.begin; i < f.end; i++) {
+        Eigen::Vector3d q = D_fingers.row(i);
+        fine.row(row++) = (trans[j] * q).transpose();
+      }
+    }
+  }
+  GetDistBatch(fine, settings, mdr, s, ds_dp);
+  return std::min(min_dist, s.minCoeff());
+}
+
 double MinDistance(const GripperParams& params,
                    const GripperSettings& settings,
-                   const MeshDependentResource& mdr) {
+                   const MeshDependentResource& mdr,
+                   size_t* out_n_skipped) {
   constexpr double precision = 0.001;  // 1mm
 
   Eigen::Affine3d finger_trans_inv =
@@ -595,50 +1304,65 @@ double MinDistance(const GripperParams& params,
   }
 
   // discretize time
-  Trajectory new_trajectory;
-  std::vector<std::vector<Eigen::MatrixXd>> new_fingers;
-  std::vector<std::pair<int, double>> traj_contrib;
-  AdaptiveSubdivideTrajectory(params.trajectory,
-                              params.fingers,
-                              precision,
-                              new_trajectory,
-                              new_fingers,
-                              traj_contrib);
+  TrajectorySubdivider subdivider;
+  SubdividedTrajectory sub;
+  subdivider.Subdivide(params.trajectory, params.fingers, precision, sub);
+  const Trajectory& new_trajectory = sub.poses;
   size_t n_trajectory = new_trajectory.size();
 
-  double min_dist = 0;
-
+  std::vector<Pose> poses;
+  std::vector<size_t> seg_begin(n_trajectory);
+  std::vector<size_t> seg_sub(n_trajectory - 1);
   for (size_t i = 0; i < n_trajectory - 1; i++) {
     double max_deviation = 0;
-    for (size_t j = 0; j < new_fingers[i].size(); j++) {
-      double dev = (new_fingers[i + 1][j] - new_fingers[i][j])
-                       .rowwise()
-                       .norm()
-                       .maxCoeff();
-      max_deviation = std::max(max_deviation, dev);
+    if (sub.n_rows > 0) {
+      max_deviation = (sub.FingersAt(i + 1) - sub.FingersAt(i))
+                          .rowwise()
+                          .norm()
+                          .maxCoeff();
     }
     size_t cur_sub = std::max<size_t>(std::ceil(max_deviation / precision), 1);
 
     size_t iters = cur_sub;
     if (i == n_trajectory - 2) iters++;
 
+    seg_begin[i] = poses.size();
+    seg_sub[i] = cur_sub;
     for (size_t j = 0; j < iters; j++) {
       double t = (double)j / cur_sub;
-      Pose pose = new_trajectory[i] * (1. - t) + new_trajectory[i + 1] * t;
-      Eigen::MatrixXd f = TransformMatrix(D_fingers, robots::Forward(pose));
-#pragma omp parallel
-      {
-        double t_min = 0;
-        Eigen::RowVector3d ds_dp;  // unused
-#pragma omp for nowait
-        for (long long k = 0; k < f.rows(); k++) {
-          t_min = std::min(t_min, GetDist(f.row(k), settings.cost, mdr, ds_dp));
-        }
-#pragma omp critical
-        min_dist = std::min(min_dist, t_min);
-      }
+      poses.push_back(new_trajectory[i] * (1. - t) +
+                      new_trajectory[i + 1] * t);
+    }
+  }
+  seg_begin[n_trajectory - 1] = poses.size();
+  std::vector<Eigen::Affine3d> trans;
+  robots::ForwardBatch(poses, trans);
+
+  // Always report the exact distance
+  CostSettings exact_settings = settings.cost;
+  exact_settings.sdf_grid = false;
+
+  size_t n_skipped = 0;
+  double min_dist = 0;
+  if (settings.cost.hierarchical_min_dist) {
+    min_dist = MinDistanceHierarchical(D_fingers,
+                                       new_trajectory,
+                                       trans,
+                                       seg_begin,
+                                       seg_sub,
+                                       exact_settings,
+                                       mdr,
+                                       n_skipped);
+  } else {
+    for (size_t j = 0; j < trans.size(); j++) {
+      Eigen::MatrixX3d f = TransformMatrix(D_fingers, trans[j]);
+      Eigen::VectorXd s;
+      Eigen::MatrixX3d ds_dp;  // unused
+      GetDistBatch(f, exact_settings, mdr, s, ds_dp);
+      if (s.size() > 0) min_dist = std::min(min_dist, s.minCoeff());
     }
   }
+  if (out_n_skipped != nullptr) *out_n_skipped = n_skipped;
   return min_dist;
 }
 
@@ -653,26 +1377,34 @@ struct _SegState {
 #define soft_assert(x) \
   if (!(x)) fprintf(stderr, "Assertion Error: " #x "" __FILE__ ":%d", __LINE__)
 
+// hits: scratch buffer, reused between calls to avoid reallocations
 static double ComputeCollisionPenaltySegment(const Eigen::Vector3d& A,
                                              const Eigen::Vector3d& B,
                                              const MeshDependentResource& mdr,
                                              _SegState& state,
+                                             std::vector<igl::Hit>& hits,
                                              Debugger* const debugger) {
-  const Eigen::MatrixXd& SP_ = mdr.GetSP();
-  const Eigen::MatrixXi& SP_par_ = mdr.GetSPPar();
+  const GeodesicCache& geodesic = mdr.GetGeodesic();
   Eigen::RowVector3d dir = B - A;
   double norm = dir.norm();
   if (norm < 1e-12 || isnan(norm)) return 0;
   dir /= norm;
   // std::cout << dir << std::endl;
-  std::vector<igl::Hit> hits;
+  hits.clear();
   int num_rays;
-  mdr.intersector.intersectRay(
-      A.cast<float>(), dir.cast<float>(), hits, num_rays);
-  bool is_A_in = hits.size() % 2 == 1;
-
   if (state.is_first) {
-    state.is_in = is_A_in;
+    // Whether A is inside needs the parity of the whole ray
+    mdr.GetIntersector().intersectRay(
+        A.cast<float>(), dir.cast<float>(), hits, num_rays);
+    state.is_in = hits.size() % 2 == 1;
+  } else {
+    // Only the hits within the segment are used
+    mdr.GetIntersector().intersectRay(A.cast<float>(),
+                                      dir.cast<float>(),
+                                      hits,
+                                      num_rays,
+                                      0.f,
+                                      (float)(norm * (1. + 1e-6)));
   }
 
   double total_dis = 0;
@@ -702,7 +1434,8 @@ static double ComputeCollisionPenaltySegment(const Eigen::Vector3d& A,
         // state.last_pos |----| P
         soft_assert(state.last_pos_vid != -1llu);
 
-        total_dis += state.last_pos_vid_dis + SP_(state.last_pos_vid, vid) +
+        total_dis += state.last_pos_vid_dis +
+                     geodesic.GetDistance(state.last_pos_vid, vid) +
                      best_dist + (P.transpose() - state.last_pos).norm();
       }
       state.last_pos_vid = -1llu;
@@ -745,10 +1478,180 @@ double ComputeFloorCost(Eigen::RowVector3d p0,
   return cost + p01.norm();
 }
 
+// ComputeFloorCost and its gradient with respect to both points
+static double ComputeFloorCostGrad(const Eigen::RowVector3d& p0,
+                                   const Eigen::RowVector3d& p1,
+                                   double floor,
+                                   Eigen::RowVector3d& out_dCost_dp0,
+                                   Eigen::RowVector3d& out_dCost_dp1) {
+  out_dCost_dp0.setZero();
+  out_dCost_dp1.setZero();
+  if (p0.y() >= floor && p1.y() >= floor) return 0;
+  bool crossing = p0.y() < floor != p1.y() < floor;
+  bool swapped = crossing && p1.y() < floor;
+  // lo is below the floor
+  const Eigen::RowVector3d& lo = swapped ? p1 : p0;
+  const Eigen::RowVector3d& hi = swapped ? p0 : p1;
+  Eigen::RowVector3d u = hi - lo;
+  double r = crossing ? (floor - lo.y()) / u.y() : 1.;
+  Eigen::RowVector3d v = u * r;
+  Eigen::RowVector3d v_xz = v;
+  v_xz.y() = 0;
+  double norm = v.norm();
+  double norm_xz = v_xz.norm();
+
+  Eigen::RowVector3d g_v = Eigen::RowVector3d::Zero();
+  if (norm > 1e-12) g_v += v / norm;
+  if (norm_xz > 1e-12) g_v += v_xz / norm_xz;
+  Eigen::RowVector3d g_lo = -r * g_v;
+  Eigen::RowVector3d g_hi = r * g_v;
+  if (crossing) {
+    // r = (floor - lo.y) / (hi.y - lo.y)
+    double g_r = g_v.dot(u);
+    g_lo.y() -= g_r * (1. - r) / u.y();
+    g_hi.y() -= g_r * r / u.y();
+  }
+  (swapped ? out_dCost_dp1 : out_dCost_dp0) = g_lo;
+  (swapped ? out_dCost_dp0 : out_dCost_dp1) = g_hi;
+  return norm + norm_xz;
+}
+
+// Sum of ComputeCollisionPenaltySegment and ComputeFloorCost along the
+// polyline P (one point per row), and its gradient with respect to every
+// point. A hit moves with its segment along the surface, and the geodesic
+// distance between the closest vertices is locally constant.
+static double ComputePathCostGrad(const Eigen::MatrixX3d& P,
+                                  const MeshDependentResource& mdr,
+                                  double floor,
+                                  std::vector<igl::Hit>& hits,
+                                  Eigen::MatrixX3d& out_dCost_dP) {
+  struct _Hit {
+    size_t seg;
+    double s;  // P = A + s * (B - A)
+    Eigen::RowVector3d u;
+    Eigen::RowVector3d normal;
+    Eigen::RowVector3d pos;
+    size_t vid;
+    double vid_dis;
+  };
+
+  const GeodesicCache& geodesic = mdr.GetGeodesic();
+  out_dCost_dP.setZero(P.rows(), 3);
+
+  auto Unit = [](const Eigen::RowVector3d& v) -> Eigen::RowVector3d {
+    double norm = v.norm();
+    return norm > 1e-12 ? Eigen::RowVector3d(v / norm)
+                        : Eigen::RowVector3d::Zero();
+  };
+  // dpos/dA = (1 - s) M, dpos/dB = s M with M = I - u n^T / (n . u)
+  auto AddHitGrad = [&out_dCost_dP](const _Hit& hit,
+                                    const Eigen::RowVector3d& g) {
+    Eigen::RowVector3d g_m = g;
+    double nu = hit.normal.dot(hit.u);
+    if (std::abs(nu) > 1e-12) g_m -= g.dot(hit.u) / nu * hit.normal;
+    out_dCost_dP.row(hit.seg) += (1. - hit.s) * g_m;
+    out_dCost_dP.row(hit.seg + 1) += hit.s * g_m;
+  };
+
+  double cost = 0;
+  bool is_first = true;
+  bool is_in = false;
+  _Hit last;
+  Eigen::RowVector3d g0;
+  Eigen::RowVector3d g1;
+  for (size_t k = 0; k + 1 < (size_t)P.rows(); k++) {
+    Eigen::RowVector3d A = P.row(k);
+    Eigen::RowVector3d B = P.row(k + 1);
+    cost += ComputeFloorCostGrad(A, B, floor, g0, g1);
+    out_dCost_dP.row(k) += g0;
+    out_dCost_dP.row(k + 1) += g1;
+
+    Eigen::RowVector3d u = B - A;
+    double norm = u.norm();
+    if (norm < 1e-12 || isnan(norm)) continue;
+    Eigen::RowVector3d dir = u / norm;
+    hits.clear();
+    int num_rays;
+    mdr.GetIntersector().intersectRay(
+        A.cast<float>(), dir.cast<float>(), hits, num_rays);
+    if (is_first) is_in = hits.size() % 2 == 1;
+
+    for (const auto& h : hits) {
+      if (h.t >= norm) break;
+      _Hit hit;
+      hit.seg = k;
+      hit.s = h.t / norm;
+      hit.u = u;
+      hit.normal = mdr.GetFN().row(h.id);
+      hit.pos = A + dir * h.t;
+      hit.vid_dis = std::numeric_limits<double>::max();
+      for (size_t i = 0; i < 3; i++) {
+        int v = mdr.F(h.id, i);
+        double d = (hit.pos - mdr.V.row(v)).squaredNorm();
+        if (d < hit.vid_dis) {
+          hit.vid_dis = d;
+          hit.vid = v;
+        }
+      }
+      hit.vid_dis = sqrt(hit.vid_dis);
+
+      if (is_in) {
+        if (is_first) {
+          cost += (hit.pos - A).norm();
+          Eigen::RowVector3d g = Unit(hit.pos - A);
+          AddHitGrad(hit, g);
+          out_dCost_dP.row(k) -= g;
+        } else {
+          cost += last.vid_dis + geodesic.GetDistance(last.vid, hit.vid) +
+                  hit.vid_dis + (hit.pos - last.pos).norm();
+          Eigen::RowVector3d g = Unit(hit.pos - last.pos);
+          AddHitGrad(last, Unit(last.pos - mdr.V.row(last.vid)) - g);
+          AddHitGrad(hit, Unit(hit.pos - mdr.V.row(hit.vid)) + g);
+        }
+      } else {
+        last = hit;
+      }
+      is_in = !is_in;
+      is_first = false;
+    }
+
+    if (is_in) {
+      if (is_first) {
+        cost += norm;
+        out_dCost_dP.row(k) -= dir;
+        out_dCost_dP.row(k + 1) += dir;
+      } else {
+        cost += (B - last.pos).norm();
+        Eigen::RowVector3d g = Unit(B - last.pos);
+        out_dCost_dP.row(k + 1) += g;
+        AddHitGrad(last, -g);
+      }
+    }
+  }
+  return cost;
+}
+
+double ComputeCost_SP(const GripperParams& params,
+                      const GripperParams& init_params,
+                      const GripperSettings& settings,
+                      const MeshDependentResource& remeshed_mdr,
+                      GripperParams& out_dCost_dParam,
+                      Debugger* const debugger) {
+  CostWorkspace workspace;
+  return ComputeCost_SP(params,
+                        init_params,
+                        settings,
+                        remeshed_mdr,
+                        workspace,
+                        out_dCost_dParam,
+                        debugger);
+}
+
 double ComputeCost_SP(const GripperParams& params,
                       const GripperParams& init_params,
                       const GripperSettings& settings,
                       const MeshDependentResource& remeshed_mdr,
+                      CostWorkspace& workspace,
                       GripperParams& out_dCost_dParam,
                       Debugger* const debugger) {
   constexpr double precision = 0.001;  // 1mm
@@ -766,56 +1669,54 @@ double ComputeCost_SP(const GripperParams& params,
 
   // Cost between two points
   const double floor = settings.cost.floor;
-  auto MyCost = [floor, debugger, &remeshed_mdr](const Eigen::RowVector3d& p0,
-                                                 const Eigen::RowVector3d& p1,
-                                                 _SegState& state) -> double {
+  auto MyCost = [floor, debugger, &remeshed_mdr](
+                    const Eigen::RowVector3d& p0,
+                    const Eigen::RowVector3d& p1,
+                    _SegState& state,
+                    std::vector<igl::Hit>& hits) -> double {
     return ComputeCollisionPenaltySegment(
-               p0, p1, remeshed_mdr, state, debugger) +
+               p0, p1, remeshed_mdr, state, hits, debugger) +
            ComputeFloorCost(p0, p1, floor);
   };
 
   // discretize time
-  auto ProcessFinger = [&MyCost](const Fingers& fingers) -> double {
+  auto ProcessFinger = [&MyCost](const Fingers& fingers,
+                                 std::vector<igl::Hit>& hits) -> double {
     double cost = 0;
     _SegState state;
     for (size_t i = 0; i < fingers.size(); i++) {
       state.is_first = true;
       for (size_t j = 0; j < fingers[i].rows() - 1; j++) {
-        cost += MyCost(fingers[i].row(j), fingers[i].row(j + 1), state);
+        cost += MyCost(fingers[i].row(j), fingers[i].row(j + 1), state, hits);
       }
     }
     return cost;
   };
 
-  Trajectory new_trajectory;
-  std::vector<Fingers> new_fingers;
-  std::vector<std::pair<int, double>> traj_contrib;
-  AdaptiveSubdivideTrajectory(params.trajectory,
-                              params.fingers,
-                              precision,
-                              new_trajectory,
-                              new_fingers,
-                              traj_contrib);
+  SubdividedTrajectory& sub = workspace.sub;
+  workspace.subdivider.Subdivide(
+      params.trajectory, params.fingers, precision, sub);
+  const Trajectory& new_trajectory = sub.poses;
   size_t n_trajectory = new_trajectory.size();
-  std::vector<bool> traj_skip(n_trajectory - 1, false);
+  // char instead of bool so that the elements can be written concurrently
+  std::vector<char> traj_skip(n_trajectory - 1, false);
   std::vector<size_t> traj_subs(n_trajectory - 1, 0);
 
-  // #pragma omp parallel for
+#pragma omp parallel for schedule(dynamic)
   for (long long i = 0; i < n_trajectory - 1; i++) {
     double max_deviation = 0;
     bool intersects = false;
-    for (size_t j = 0; j < new_fingers[i].size(); j++) {
-      double dev = (new_fingers[i + 1][j] - new_fingers[i][j])
-                       .rowwise()
-                       .norm()
-                       .maxCoeff();
+    for (size_t j = 0; j + 1 < sub.finger_begin.size(); j++) {
+      size_t begin = sub.finger_begin[j];
+      size_t n_rows = sub.finger_begin[j + 1] - begin;
+      auto f0 = sub.FingersAt(i).middleRows(begin, n_rows);
+      auto f1 = sub.FingersAt(i + 1).middleRows(begin, n_rows);
+      double dev = (f1 - f0).rowwise().norm().maxCoeff();
       max_deviation = std::max(max_deviation, dev);
       Eigen::RowVector3d p_min =
-          new_fingers[i][j].colwise().minCoeff().cwiseMin(
-              new_fingers[i + 1][j].colwise().minCoeff());
+          f0.colwise().minCoeff().cwiseMin(f1.colwise().minCoeff());
       Eigen::RowVector3d p_max =
-          new_fingers[i][j].colwise().maxCoeff().cwiseMax(
-              new_fingers[i + 1][j].colwise().maxCoeff());
+          f0.colwise().maxCoeff().cwiseMax(f1.colwise().maxCoeff());
       p_min.array() -= precision;
       p_max.array() += precision;
       intersects = intersects ||
@@ -826,32 +1727,52 @@ double ComputeCost_SP(const GripperParams& params,
     traj_skip[i] = !intersects;
   }
 
-  double traj_max = 0;
+  // Samples of every segment that is not skipped, as (segment, step), so
+  // that they are all evaluated in a single parallel region
+  std::vector<std::pair<size_t, size_t>> traj_samples;
   for (size_t i = 0; i < n_trajectory - 1; i++) {
     if (traj_skip[i]) continue;
-    size_t cur_sub = traj_subs[i];
-    size_t iters = cur_sub;
+    size_t iters = traj_subs[i];
     if (i == n_trajectory - 2) iters++;
+    for (size_t j = 0; j < iters; j++) {
+      traj_samples.push_back({i, j});
+    }
+  }
 
+  // max is exact, so the result does not depend on the schedule. Ties go
+  // to the first sample so that the gradient does not either.
+  double traj_max = 0;
+  long long traj_argmax = -1;
 #pragma omp parallel
-    {
-      double t_max = 0;
+  {
+    double t_max = 0;
+    long long t_argmax = -1;
+    std::vector<igl::Hit> hits;
 
-#pragma omp for
-      for (long long j = 0; j < iters; j++) {
-        double t = (double)j / cur_sub;
-        Pose pose = new_trajectory[i] * (1. - t) + new_trajectory[i + 1] * t;
-        auto f = TransformFingers(fingers, robots::Forward(pose));
-        t_max = std::max(t_max, ProcessFinger(f));
+#pragma omp for schedule(dynamic, 16)
+    for (long long s = 0; s < (long long)traj_samples.size(); s++) {
+      size_t i = traj_samples[s].first;
+      double t = (double)traj_samples[s].second / traj_subs[i];
+      Pose pose = new_trajectory[i] * (1. - t) + new_trajectory[i + 1] * t;
+      auto f = TransformFingers(fingers, robots::Forward(pose));
+      double cost = ProcessFinger(f, hits);
+      if (cost > t_max) {
+        t_max = cost;
+        t_argmax = s;
       }
+    }
 
 #pragma omp critical
-      traj_max = std::max(traj_max, t_max);
+    if (t_max > traj_max || (t_max == traj_max && t_argmax < traj_argmax)) {
+      traj_max = t_max;
+      traj_argmax = t_argmax;
     }
   }
 
   // discretize fingers
   std::vector<Eigen::Vector3d> d_fingers;
+  // Finger, joint j and t of every d_finger
+  std::vector<std::tuple<size_t, size_t, double>> d_finger_src;
   for (size_t i = 0; i < fingers.size(); i++) {
     for (size_t j = 1; j < fingers[i].rows(); j++) {
       double norm = (fingers[i].row(j) - fingers[i].row(j - 1)).norm();
@@ -861,6 +1782,7 @@ double ComputeCost_SP(const GripperParams& params,
         double t = (double)k / subs;
         d_fingers.push_back(fingers[i].row(j - 1) * (1. - t) +
                             fingers[i].row(j) * t);
+        d_finger_src.push_back({i, j, t});
       }
     }
   }
@@ -871,27 +1793,37 @@ double ComputeCost_SP(const GripperParams& params,
   }
 
   double finger_max = 0;
+  long long finger_argmax = -1;
 
 #pragma omp parallel
   {
     double t_max = 0;
+    long long t_argmax = -1;
     _SegState state;
+    std::vector<igl::Hit> hits;
 
-#pragma omp for
+#pragma omp for schedule(dynamic, 16)
     for (long long j = 0; j < d_fingers.size(); j++) {
       Eigen::Vector3d p0 = new_trans[0] * d_fingers[j];
       state.is_first = true;
       double cur_cost = 0;
       for (size_t k = 1; k < new_trajectory.size(); k++) {
         Eigen::Vector3d p1 = new_trans[k] * d_fingers[j];
-        cur_cost += MyCost(p0, p1, state);
+        cur_cost += MyCost(p0, p1, state, hits);
         p0 = p1;
       }
-      t_max = std::max(t_max, cur_cost);
+      if (cur_cost > t_max) {
+        t_max = cur_cost;
+        t_argmax = j;
+      }
     }
 
 #pragma omp critical
-    finger_max = std::max(finger_max, t_max);
+    if (t_max > finger_max ||
+        (t_max == finger_max && t_argmax < finger_argmax)) {
+      finger_max = t_max;
+      finger_argmax = t_argmax;
+    }
   }
 
   // Robot floor collision
@@ -899,10 +1831,13 @@ double ComputeCost_SP(const GripperParams& params,
   double max_penetration = 0;
   constexpr double robot_floor_sig = 1000;
   constexpr double robot_clearance = 0.05;
-  for (const auto& trans : new_trans) {
-    max_penetration =
-        std::max(max_penetration,
-                 std::max(0., robot_clearance - trans.translation()(1)));
+  long long robot_floor_argmax = -1;
+  for (size_t k = 0; k < new_trans.size(); k++) {
+    double penetration = robot_clearance - new_trans[k].translation()(1);
+    if (penetration > max_penetration) {
+      max_penetration = penetration;
+      robot_floor_argmax = k;
+    }
   }
   robot_floor = max_penetration;
 
@@ -914,15 +1849,162 @@ double ComputeCost_SP(const GripperParams& params,
                     .squaredNorm();
   }
 
+  // Gradient. The maximum terms are differentiated at their maximizing
+  // sample, with the subdivision held fixed.
+  out_dCost_dParam.fingers.resize(params.fingers.size());
+  for (size_t i = 0; i < params.fingers.size(); i++) {
+    out_dCost_dParam.fingers[i].setZero(params.fingers[i].rows(), 3);
+  }
+  out_dCost_dParam.trajectory.assign(params.trajectory.size(), Pose::Zero());
+
+  // Subdivided pose k to its keyframes
+  auto AddPoseGrad = [&sub, &out_dCost_dParam](size_t k, const Pose& g) {
+    size_t a = sub.traj_contrib[k].first;
+    double t = sub.traj_contrib[k].second;
+    out_dCost_dParam.trajectory[a] += (1. - t) * g;
+    if (t > 0) out_dCost_dParam.trajectory[a + 1] += t * g;
+  };
+  // e: effector space position of a finger point, which also depends on
+  // the first keyframe through finger_trans_inv
+  //  returns: gradient with respect to the finger point
+  const Eigen::Matrix3d R0_inv = finger_trans_inv.linear();
+  const robots::JacobianEvaluator jacobian0(params.trajectory.front());
+  auto AddEffectorGrad = [&R0_inv, &jacobian0, &out_dCost_dParam](
+                             const Eigen::Vector3d& e,
+                             const Eigen::RowVector3d& dCost_de)
+      -> Eigen::RowVector3d {
+    Eigen::RowVector3d g = dCost_de * R0_inv;
+    out_dCost_dParam.trajectory.front() -=
+        (g * jacobian0(e)).transpose().array();
+    return g;
+  };
+
+  std::vector<igl::Hit> hits;
+  Eigen::MatrixX3d dCost_dP;
+  if (traj_argmax >= 0) {
+    size_t i = traj_samples[traj_argmax].first;
+    double t = (double)traj_samples[traj_argmax].second / traj_subs[i];
+    Pose pose = new_trajectory[i] * (1. - t) + new_trajectory[i + 1] * t;
+    robots::JacobianEvaluator jacobian(pose);
+    auto f = TransformFingers(fingers, robots::Forward(pose));
+    Pose dCost_dPose = Pose::Zero();
+    for (size_t j = 0; j < f.size(); j++) {
+      ComputePathCostGrad(f[j], remeshed_mdr, floor, hits, dCost_dP);
+      for (size_t r = 0; r < (size_t)f[j].rows(); r++) {
+        Eigen::Vector3d e = fingers[j].row(r);
+        Eigen::RowVector3d g = dCost_dP.row(r);
+        dCost_dPose += (g * jacobian(e)).transpose().array();
+        out_dCost_dParam.fingers[j].row(r) +=
+            AddEffectorGrad(e, g * jacobian.R);
+      }
+    }
+    AddPoseGrad(i, (1. - t) * dCost_dPose);
+    AddPoseGrad(i + 1, t * dCost_dPose);
+  }
+
+  if (finger_argmax >= 0) {
+    const Eigen::Vector3d& e = d_fingers[finger_argmax];
+    Eigen::MatrixX3d path(n_trajectory, 3);
+    for (size_t k = 0; k < n_trajectory; k++) {
+      path.row(k) = new_trans[k] * e;
+    }
+    ComputePathCostGrad(path, remeshed_mdr, floor, hits, dCost_dP);
+    Eigen::RowVector3d dCost_de = Eigen::RowVector3d::Zero();
+    for (size_t k = 0; k < n_trajectory; k++) {
+      Eigen::RowVector3d g = dCost_dP.row(k);
+      if (g.isZero()) continue;
+      robots::JacobianEvaluator jacobian(new_trajectory[k]);
+      dCost_de += g * jacobian.R;
+      AddPoseGrad(k, (g * jacobian(e)).transpose().array());
+    }
+    size_t i, j;
+    double t;
+    std::tie(i, j, t) = d_finger_src[finger_argmax];
+    Eigen::RowVector3d g = AddEffectorGrad(e, dCost_de);
+    out_dCost_dParam.fingers[i].row(j - 1) += (1. - t) * g;
+    out_dCost_dParam.fingers[i].row(j) += t * g;
+  }
+
+  if (robot_floor_argmax >= 0) {
+    robots::JacobianEvaluator jacobian(new_trajectory[robot_floor_argmax]);
+    AddPoseGrad(robot_floor_argmax,
+                -robot_floor_sig *
+                    jacobian(Eigen::Vector3d::Zero()).row(1).transpose().array());
+  }
+
+  for (size_t i = 1; i < params.trajectory.size() - 1; i++) {
+    out_dCost_dParam.trajectory[i] +=
+        2. * settings.cost.regularization *
+        (params.trajectory[i] - init_params.trajectory[i]);
+  }
+
   return traj_max + finger_max + robot_floor_sig * robot_floor +
          settings.cost.regularization * traj_reg;
 }
 
+typedef CGAL::Exact_predicates_inexact_constructions_kernel _Kernel;
+
+static inline _Kernel::Point_3 ToPoint(const Eigen::RowVector3d& p) {
+  return _Kernel::Point_3(p.x(), p.y(), p.z());
+}
+
+// Exact test of a facet of mdr against the triangle abc, which can be
+// degenerate, e.g. when a finger joint does not move between two frames
+static bool FacetIntersects(const MeshDependentResource& mdr,
+                            int fid,
+                            const Eigen::RowVector3d& a,
+                            const Eigen::RowVector3d& b,
+                            const Eigen::RowVector3d& c) {
+  _Kernel::Triangle_3 facet(ToPoint(mdr.V.row(mdr.F(fid, 0))),
+                            ToPoint(mdr.V.row(mdr.F(fid, 1))),
+                            ToPoint(mdr.V.row(mdr.F(fid, 2))));
+  if (facet.is_degenerate()) return false;
+  _Kernel::Triangle_3 tri(ToPoint(a), ToPoint(b), ToPoint(c));
+  if (!tri.is_degenerate()) return CGAL::do_intersect(facet, tri);
+  // The points are collinear, so the triangle is its longest edge
+  Eigen::RowVector3d p = a;
+  Eigen::RowVector3d q = b;
+  if ((c - a).squaredNorm() > (q - p).squaredNorm()) q = c;
+  if ((c - b).squaredNorm() > (q - p).squaredNorm()) {
+    p = b;
+    q = c;
+  }
+  _Kernel::Segment_3 seg(ToPoint(p), ToPoint(q));
+  if (!seg.is_degenerate()) return CGAL::do_intersect(facet, seg);
+  return CGAL::do_intersect(facet, ToPoint(p));
+}
+
+// Whether the triangle abc intersects mdr, testing only the facets whose
+// boxes in mdr.GetTree() overlap the box of the triangle
+static bool TriangleIntersects(const MeshDependentResource& mdr,
+                               const Eigen::RowVector3d& a,
+                               const Eigen::RowVector3d& b,
+                               const Eigen::RowVector3d& c) {
+  typedef igl::AABB<Eigen::MatrixXd, 3> Tree;
+  Eigen::AlignedBox3d box(a.transpose());
+  box.extend(b.transpose());
+  box.extend(c.transpose());
+
+  std::vector<const Tree*> stack;
+  stack.push_back(&mdr.GetTree());
+  while (!stack.empty()) {
+    const Tree* node = stack.back();
+    stack.pop_back();
+    if (!node->m_box.intersects(box)) continue;
+    if (node->is_leaf()) {
+      if (FacetIntersects(mdr, node->m_primitive, a, b, c)) return true;
+      continue;
+    }
+    stack.push_back(node->m_left);
+    stack.push_back(node->m_right);
+  }
+  return false;
+}
+
 bool Intersects(const GripperParams& params,
                 const GripperSettings& settings,
                 const MeshDependentResource& mdr) {
   const size_t nTrajectorySteps = settings.cost.n_trajectory_steps;
-  const double trajectoryStep = 1. / nTrajectorySteps;
 
   const size_t nKeyframes = params.trajectory.size();
   const size_t nFingers = params.fingers.size();
@@ -932,47 +2014,63 @@ bool Intersects(const GripperParams& params,
   if (params.fingers.size() == 0 || params.trajectory.size() <= 1llu)
     return false;
 
-  std::vector<Eigen::MatrixXd> sv_V(
-      nFingers, Eigen::MatrixXd(nFingerJoints * nFrames, 3));
-  Eigen::MatrixXi sv_F((nFingerJoints - 1) * (nFrames - 1) * 2, 3);
-
   Eigen::Affine3d finger_trans_inv =
       robots::Forward(params.trajectory.front()).inverse();
 
-  Eigen::MatrixXi sv_F_template((nFingerJoints - 1) * 2, 3);
-  for (size_t i = 0; i < nFingerJoints - 1; i++) {
-    sv_F_template.row(i * 2) = Eigen::RowVector3i(i, i + nFingerJoints, i + 1);
-    sv_F_template.row(i * 2 + 1) =
-        Eigen::RowVector3i(i + 1, i + nFingerJoints, i + nFingerJoints + 1);
-  }
-  for (size_t j = 0; j < nFrames - 1; j++) {
-    sv_F.block(j * (nFingerJoints - 1) * 2, 0, (nFingerJoints - 1) * 2, 3) =
-        sv_F_template.array() + (j * nFingerJoints);
-  }
-  for (size_t i = 0; i < nFingers; i++) {
-    for (size_t j = 0; j < nFrames; j++) {
-      size_t a = j / nTrajectorySteps;
-      size_t b = j % nTrajectorySteps;
-      if (a == nKeyframes - 1) {
-        a--;
-        b = nTrajectorySteps;
-      }
-      double t = (double)b / nTrajectorySteps;
+  std::vector<Pose> poses(nFrames);
+  for (size_t j = 0; j < nFrames; j++) {
+    size_t a = j / nTrajectorySteps;
+    size_t b = j % nTrajectorySteps;
+    if (a == nKeyframes - 1) {
+      a--;
+      b = nTrajectorySteps;
+    }
+    double t = (double)b / nTrajectorySteps;
 
-      Pose l_pose =
-          params.trajectory[a] * (1. - t) + params.trajectory[a + 1] * (t);
+    poses[j] = params.trajectory[a] * (1. - t) + params.trajectory[a + 1] * (t);
+  }
+  std::vector<Eigen::Affine3d> trans;
+  robots::ForwardBatch(poses, trans);
 
-      Eigen::Affine3d cur_trans = robots::Forward(l_pose) * finger_trans_inv;
-      sv_V[i].block(j * nFingerJoints, 0, nFingerJoints, 3) =
+  // Finger i at frame j: rows (i * nFrames + j) * nFingerJoints onwards
+  Eigen::MatrixX3d P(nFingers * nFrames * nFingerJoints, 3);
+#pragma omp parallel for
+  for (long long j = 0; j < (long long)nFrames; j++) {
+    Eigen::Affine3d cur_trans = trans[j] * finger_trans_inv;
+    for (size_t i = 0; i < nFingers; i++) {
+      P.middleRows((i * nFrames + j) * nFingerJoints, nFingerJoints) =
           (cur_trans * params.fingers[i].transpose().colwise().homogeneous())
               .transpose();
     }
-    Eigen::MatrixXi IF;
-    bool intersect = igl::copyleft::cgal::intersect_other(
-        mdr.V, mdr.F, sv_V[i], sv_F, true, IF);
-    if (intersect) return true;
   }
-  return false;
+
+  // The swept surface of a finger between two frames is a strip of quads,
+  // split into triangles the same way as the swept volume
+  std::atomic_bool found(false);
+  const long long nIntervals = nFingers * (nFrames - 1);
+#pragma omp parallel for schedule(dynamic)
+  for (long long k = 0; k < nIntervals; k++) {
+    if (found) continue;
+    size_t i = k / (nFrames - 1);
+    size_t j = k % (nFrames - 1);
+    auto S0 = P.middleRows((i * nFrames + j) * nFingerJoints, nFingerJoints);
+    auto S1 =
+        P.middleRows((i * nFrames + j + 1) * nFingerJoints, nFingerJoints);
+
+    // Broad phase against the whole strip
+    Eigen::AlignedBox3d box(
+        S0.colwise().minCoeff().cwiseMin(S1.colwise().minCoeff()).transpose(),
+        S0.colwise().maxCoeff().cwiseMax(S1.colwise().maxCoeff()).transpose());
+    if (!mdr.Intersects(box)) continue;
+
+    for (size_t l = 0; l + 1 < nFingerJoints && !found; l++) {
+      if (TriangleIntersects(mdr, S0.row(l), S1.row(l), S0.row(l + 1)) ||
+          TriangleIntersects(mdr, S0.row(l + 1), S1.row(l), S1.row(l + 1))) {
+        found = true;
+      }
+    }
+  }
+  return found;
 }
 
 }  // namespace core
@@ -5,9 +5,11 @@
 #include <vector>
 #include "../Constants.h"
 #include "Debugger.h"
+#include "GeometryUtils.h"
 #include "models/GripperParams.h"
 #include "models/GripperSettings.h"
 #include "models/MeshDependentResource.h"
+#include "robots/Robots.h"
 
 namespace psg {
 namespace core {
@@ -19,6 +21,13 @@ double EvalAt(const Eigen::Vector3d& p,
               const MeshDependentResource& mdr,
               Eigen::RowVector3d& out_dc_dp);
 
+// Batched EvalAt, one query per row of P
+void EvalAtBatch(const Eigen::MatrixX3d& P,
+                 const CostSettings& settings,
+                 const MeshDependentResource& mdr,
+                 Eigen::VectorXd& out_c,
+                 Eigen::MatrixX3d& out_dc_dp);
+
 double ComputeCost(const GripperParams& params,
                    const GripperParams& init_params,
                    const GripperSettings& settings,
@@ -26,6 +35,86 @@ double ComputeCost(const GripperParams& params,
                    GripperParams& out_dCost_dParam,
                    Debugger* const debugger);
 
+// Sample buffers of ComputeCost in structure-of-arrays layout, kept between
+// evaluations to avoid reallocation. One workspace per concurrent
+// evaluation.
+struct CostWorkspace {
+  // Samples of a finger at one frame, one row per sample
+  struct FrameData {
+    Eigen::MatrixX3d pos;
+    Eigen::VectorXd eval;
+    Eigen::MatrixX3d dEval_dPos;
+    Eigen::Matrix<double, Eigen::Dynamic, kNumDOFs> dEval_dTheta;
+  };
+
+  // Sample jj lies between joint(jj) and joint(jj) + 1 with weight
+  // finger_t(jj) on the latter. Same for all fingers.
+  Eigen::VectorXd finger_t;
+  Eigen::VectorXi joint;
+  // Samples in effector space, per finger
+  std::vector<Eigen::MatrixX3d> eff_fingers;
+  // Per finger
+  std::vector<FrameData> last;
+  std::vector<FrameData> cur;
+  // Trajectory steps between two keyframes
+  std::vector<Pose> poses;
+  std::vector<robots::Kinematics> kinematics;
+  // Subdivided trajectory of ComputeCost_SP
+  TrajectorySubdivider subdivider;
+  SubdividedTrajectory sub;
+
+  void Resize(size_t n_fingers, size_t n_finger_joints, size_t n_finger_steps);
+};
+
+// ComputeCost reusing the buffers in workspace
+double ComputeCost(const GripperParams& params,
+                   const GripperParams& init_params,
+                   const GripperSettings& settings,
+                   const MeshDependentResource& mdr,
+                   CostWorkspace& workspace,
+                   GripperParams& out_dCost_dParam,
+                   Debugger* const debugger);
+
+// ComputeCost with the distance queries and the potential evaluated in
+// single precision, for the coarse phase of the optimization. The gradient
+// is still accumulated in double.
+double ComputeCostFloat(const GripperParams& params,
+                        const GripperParams& init_params,
+                        const GripperSettings& settings,
+                        const MeshDependentResource& mdr,
+                        GripperParams& out_dCost_dParam,
+                        Debugger* const debugger);
+
+double ComputeCostFloat(const GripperParams& params,
+                        const GripperParams& init_params,
+                        const GripperSettings& settings,
+                        const MeshDependentResource& mdr,
+                        CostWorkspace& workspace,
+                        GripperParams& out_dCost_dParam,
+                        Debugger* const debugger);
+
+// Contribution of one finger over the segment between two consecutive
+// keyframes to ComputeCost and its gradient
+struct CostBlock {
+  double cost;
+  Eigen::MatrixXd dCost_dFinger;
+  // Keyframes keyframe - 1 and keyframe
+  Pose dCost_dTheta0;
+  Pose dCost_dTheta1;
+
+  void SetZero(size_t n_finger_joints);
+};
+
+// Depends only on the finger, the two keyframes and the first keyframe.
+// ComputeCost is the sum of all blocks (with keyframe >= 1) up to rounding.
+void ComputeCostBlock(const GripperParams& params,
+                      const GripperSettings& settings,
+                      const MeshDependentResource& mdr,
+                      size_t finger,
+                      size_t keyframe,
+                      CostWorkspace& workspace,
+                      CostBlock& out_block);
+
 double ComputeCost1(const GripperParams& params,
                     const GripperParams& init_params,
                     const GripperSettings& settings,
@@ -37,12 +126,24 @@ double ComputeCost_SP(const GripperParams& params,
                       const GripperParams& init_params,
                       const GripperSettings& settings,
                       const MeshDependentResource& remeshed_mdr,
-                      GripperParams& out_dCost_dParam, /* unused*/
+                      GripperParams& out_dCost_dParam,
                       Debugger* const debugger);
 
+// ComputeCost_SP reusing the subdivision buffers in workspace
+double ComputeCost_SP(const GripperParams& params,
+                      const GripperParams& init_params,
+                      const GripperSettings& settings,
+                      const MeshDependentResource& remeshed_mdr,
+                      CostWorkspace& workspace,
+                      GripperParams& out_dCost_dParam,
+                      Debugger* const debugger);
+
+// out_n_skipped: number of distance queries skipped by the hierarchical
+// mode (settings.cost.hierarchical_min_dist)
 double MinDistance(const GripperParams& params,
                    const GripperSettings& settings,
-                   const MeshDependentResource& mdr);
+                   const MeshDependentResource& mdr,
+                   size_t* out_n_skipped = nullptr);
 
 bool Intersects(const GripperParams& params,
                 const GripperSettings& settings,
@@ -67,7 +168,7 @@ const CostFunctionItem kCostFunctions[] = {
                      &ComputeCost,
                      CostFunctionEnum::kGradientBased,
                      true},
-    CostFunctionItem{"SP", &ComputeCost_SP, CostFunctionEnum::kSP, false}};
+    CostFunctionItem{"SP", &ComputeCost_SP, CostFunctionEnum::kSP, true}};
 
 }  // namespace core
 }  // namespace psg
\ No newline at end of file
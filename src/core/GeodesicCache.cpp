@@ -0,0 +1,137 @@
+#include "GeodesicCache.h"
+
+#include <queue>
+
+namespace psg {
+namespace core {
+
+GeodesicCache::GeodesicCache(const Eigen::MatrixXd& V,
+                             const Eigen::MatrixXi& F,
+                             size_t capacity)
+    : n_vertices_(V.rows()), capacity_(std::max<size_t>(capacity, 1)) {
+  // Directed half-edges of every face, same as the dense version
+  std::vector<int> degree(n_vertices_ + 1, 0);
+  for (long long i = 0; i < F.rows(); i++) {
+    for (int k = 0; k < 3; k++) {
+      degree[F(i, k) + 1]++;
+    }
+  }
+  adj_start_.resize(n_vertices_ + 1);
+  adj_start_[0] = 0;
+  for (size_t i = 0; i < n_vertices_; i++) {
+    adj_start_[i + 1] = adj_start_[i] + degree[i + 1];
+  }
+  adj_vid_.resize(adj_start_.back());
+  adj_len_.resize(adj_start_.back());
+  std::vector<int> fill(adj_start_.begin(), adj_start_.end() - 1);
+  for (long long i = 0; i < F.rows(); i++) {
+    for (int k = 0; k < 3; k++) {
+      int u = F(i, k);
+      int v = F(i, (k + 1) % 3);
+      adj_vid_[fill[u]] = v;
+      adj_len_[fill[u]] = (V.row(u) - V.row(v)).norm();
+      fill[u]++;
+    }
+  }
+}
+
+std::shared_ptr<const GeodesicCache::Row> GeodesicCache::ComputeRow(
+    size_t src) const {
+  auto row = std::make_shared<Row>();
+  row->dist.setConstant(n_vertices_, std::numeric_limits<double>::max() / 2.);
+  row->par.setConstant(n_vertices_, -1);
+
+  struct VertexInfo {
+    int id;
+    double dist;
+    bool operator<(const VertexInfo& r) const { return dist > r.dist; }
+  };
+  std::priority_queue<VertexInfo> q;
+  q.push(VertexInfo{(int)src, 0});
+  row->dist(src) = 0;
+  while (!q.empty()) {
+    VertexInfo u = q.top();
+    q.pop();
+    if (u.dist > row->dist(u.id)) continue;
+    for (int e = adj_start_[u.id]; e < adj_start_[u.id + 1]; e++) {
+      int v = adj_vid_[e];
+      double curDis = u.dist + adj_len_[e];
+      if (curDis < row->dist(v)) {
+        row->dist(v) = curDis;
+        row->par(v) = u.id;
+        q.push(VertexInfo{v, curDis});
+      }
+    }
+  }
+  return row;
+}
+
+void GeodesicCache::Evict() const {
+  while (rows_.size() > capacity_) {
+    rows_.erase(lru_.back());
+    lru_.pop_back();
+  }
+}
+
+std::shared_ptr<const GeodesicCache::Row> GeodesicCache::GetRow(
+    size_t src) const {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = rows_.find(src);
+    if (it != rows_.end()) {
+      lru_.splice(lru_.begin(), lru_, it->second.second);
+      return it->second.first;
+    }
+  }
+
+  // Compute outside of the lock so other sources are not blocked
+  std::shared_ptr<const Row> row = ComputeRow(src);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = rows_.find(src);
+  if (it != rows_.end()) {
+    // Another thread got there first
+    lru_.splice(lru_.begin(), lru_, it->second.second);
+    return it->second.first;
+  }
+  lru_.push_front(src);
+  rows_.insert({src, {row, lru_.begin()}});
+  Evict();
+  return row;
+}
+
+double GeodesicCache::GetDistance(size_t v, size_t src) const {
+  return GetRow(src)->dist(v);
+}
+
+void GeodesicCache::GetPath(size_t v,
+                            size_t src,
+                            std::vector<int>& out_path) const {
+  std::shared_ptr<const Row> row = GetRow(src);
+  out_path.clear();
+  int cur = (int)v;
+  out_path.push_back(cur);
+  while (row->par(cur) != -1) {
+    cur = row->par(cur);
+    out_path.push_back(cur);
+  }
+}
+
+void GeodesicCache::SetCapacity(size_t capacity) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  capacity_ = std::max<size_t>(capacity, 1);
+  Evict();
+}
+
+size_t GeodesicCache::GetCapacity() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return capacity_;
+}
+
+size_t GeodesicCache::GetNumCachedRows() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return rows_.size();
+}
+
+}  // namespace core
+}  // namespace psg
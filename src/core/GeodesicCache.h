@@ -0,0 +1,66 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace psg {
+namespace core {
+
+// Shortest path along mesh edges, a proxy for geodesic distance.
+// Single-source rows are computed on first request and kept in an LRU of
+// bounded size. All queries are thread-safe.
+class GeodesicCache {
+ public:
+  struct Row {
+    // dist(v): distance from the source to v
+    Eigen::VectorXd dist;
+    // par(v): next vertex on the path from v to the source, -1 at the source
+    Eigen::VectorXi par;
+  };
+
+  static constexpr size_t kDefaultCapacity = 256;
+
+  GeodesicCache(const Eigen::MatrixXd& V,
+                const Eigen::MatrixXi& F,
+                size_t capacity = kDefaultCapacity);
+
+  // The returned row stays valid even after being evicted
+  std::shared_ptr<const Row> GetRow(size_t src) const;
+
+  // Distance from v to src
+  double GetDistance(size_t v, size_t src) const;
+
+  // Vertices on the path from v to src (both included)
+  void GetPath(size_t v, size_t src, std::vector<int>& out_path) const;
+
+  void SetCapacity(size_t capacity);
+  size_t GetCapacity() const;
+  size_t GetNumCachedRows() const;
+
+ private:
+  size_t n_vertices_;
+  // Adjacency in CSR layout
+  std::vector<int> adj_start_;
+  std::vector<int> adj_vid_;
+  std::vector<double> adj_len_;
+
+  // Guarded by mutex_, like the rows
+  size_t capacity_;
+  mutable std::mutex mutex_;
+  // Most recently used first
+  mutable std::list<size_t> lru_;
+  mutable std::unordered_map<
+      size_t,
+      std::pair<std::shared_ptr<const Row>, std::list<size_t>::iterator>>
+      rows_;
+
+  std::shared_ptr<const Row> ComputeRow(size_t src) const;
+  void Evict() const;
+};
+
+}  // namespace core
+}  // namespace psg
@@ -1,5 +1,6 @@
 #include "GeometryUtils.h"
 
+#include <algorithm>
 #include <unordered_map>
 #include <unordered_set>
 
@@ -11,10 +12,10 @@
 #include <igl/volume.h>
 #include <libqhullcpp/Qhull.h>
 #include <libqhullcpp/QhullFacetList.h>
+#include <libqhullcpp/QhullHyperplane.h>
 #include <libqhullcpp/QhullPoint.h>
 #include <libqhullcpp/QhullVertexSet.h>
 #include <libqhullcpp/RboxPoints.h>
-#include <list>
 
 #include "robots/Robots.h"
 
@@ -32,42 +33,117 @@ Fingers TransformFingers(const Fingers& fingers, const Eigen::Affine3d& trans) {
   return out_fingers;
 }
 
-struct _AdtTrajData {
-  Fingers fingers;
-  Pose pose;
-  size_t traj_idx;
-  double t;
-};
+size_t TrajectorySubdivider::AddNode(const Pose& pose,
+                                     const std::pair<int, double>& contrib,
+                                     const Eigen::Affine3d& trans) {
+  if ((n_nodes_ + 1) * n_rows_ > (size_t)fingers_.rows()) {
+    fingers_.conservativeResize(
+        std::max<size_t>(2 * fingers_.rows(), (n_nodes_ + 1) * n_rows_), 3);
+  }
+  if (n_nodes_ >= poses_.size()) poses_.resize(n_nodes_ + 1);
+  if (n_nodes_ >= contrib_.size()) contrib_.resize(n_nodes_ + 1);
+  poses_[n_nodes_] = pose;
+  contrib_[n_nodes_] = contrib;
+  fingers_.middleRows(n_nodes_ * n_rows_, n_rows_) =
+      TransformMatrix(eff_fingers_, trans);
+  return n_nodes_++;
+}
 
-static void AdaptiveSubdivideTrajectoryImpl(
-    const Fingers& fingers,
-    double flatness,
-    std::list<_AdtTrajData>& l,
-    std::list<_AdtTrajData>::iterator l_p0,
-    std::list<_AdtTrajData>::iterator l_p2) {
-  Pose p1 = (l_p0->pose + l_p2->pose) / 2.;
-  Fingers fingers_p1 = TransformFingers(fingers, robots::Forward(p1));
-
-  double t2 = l_p2->t;
-  if (l_p2->traj_idx != l_p0->traj_idx) t2 = 1;
-
-  double max_deviation = 0;
-  for (size_t j = 0; j < fingers_p1.size(); j++) {
-    Eigen::MatrixXd fingers_p02 =
-        (l_p2->fingers[j] - l_p0->fingers[j]).rowwise().normalized();
-    Eigen::MatrixXd fingers_p01 = (fingers_p1[j] - l_p0->fingers[j]);
-    for (size_t i = 0; i < fingers_p02.rows(); i++) {
-      Eigen::RowVector3d p02 = fingers_p02.row(i);
-      Eigen::RowVector3d p01 = fingers_p01.row(i);
-      max_deviation = std::max(max_deviation, p01.cross(p02).norm());
-    }
+void TrajectorySubdivider::Subdivide(const Trajectory& trajectory,
+                                     const Fingers& fingers,
+                                     double flatness,
+                                     SubdividedTrajectory& out) {
+  constexpr double kMinLength = 1. / (1 << kMaxDepth);
+  const size_t n_keyframes = trajectory.size();
+
+  size_t n_rows = 0;
+  out.finger_begin.resize(fingers.size() + 1);
+  for (size_t i = 0; i < fingers.size(); i++) {
+    out.finger_begin[i] = n_rows;
+    n_rows += fingers[i].rows();
   }
-  if (max_deviation > flatness) {
-    auto l_p1 = l.insert(
-        l_p2,
-        _AdtTrajData{fingers_p1, p1, l_p0->traj_idx, (l_p0->t + t2) / 2.});
-    AdaptiveSubdivideTrajectoryImpl(fingers, flatness, l, l_p0, l_p1);
-    AdaptiveSubdivideTrajectoryImpl(fingers, flatness, l, l_p1, l_p2);
+  out.finger_begin[fingers.size()] = n_rows;
+
+  n_rows_ = n_rows;
+
+  Eigen::Affine3d finger_trans_inv =
+      robots::Forward(trajectory.front()).inverse();
+  eff_fingers_.resize(n_rows, 3);
+  for (size_t i = 0; i < fingers.size(); i++) {
+    eff_fingers_.middleRows(out.finger_begin[i], fingers[i].rows()) =
+        TransformMatrix(fingers[i], finger_trans_inv);
+  }
+
+  // Initial nodes: the keyframes
+  mid_poses_ = trajectory;
+  contrib_.resize(n_keyframes);
+  for (size_t k = 0; k < n_keyframes; k++) contrib_[k] = {(int)k, 0.};
+  robots::ForwardBatch(mid_poses_, mid_trans_);
+  n_nodes_ = 0;
+  intervals_.clear();
+  for (size_t k = 0; k < mid_poses_.size(); k++) {
+    AddNode(mid_poses_[k], contrib_[k], mid_trans_[k]);
+    if (k > 0) intervals_.push_back({k - 1, k});
+  }
+
+  while (!intervals_.empty()) {
+    const long long n = intervals_.size();
+    mid_poses_.resize(n);
+    for (long long i = 0; i < n; i++) {
+      mid_poses_[i] =
+          (poses_[intervals_[i].first] + poses_[intervals_[i].second]) / 2.;
+    }
+    robots::ForwardBatch(mid_poses_, mid_trans_);
+
+    mid_fingers_.resize(n * n_rows, 3);
+    split_.resize(n);
+#pragma omp parallel for if (n > 16)
+    for (long long i = 0; i < n; i++) {
+      auto f0 = fingers_.middleRows(intervals_[i].first * n_rows, n_rows);
+      auto f2 = fingers_.middleRows(intervals_[i].second * n_rows, n_rows);
+      auto f1 = mid_fingers_.middleRows(i * n_rows, n_rows);
+      f1 = TransformMatrix(eff_fingers_, mid_trans_[i]);
+
+      double max_deviation = 0;
+      for (size_t r = 0; r < n_rows; r++) {
+        Eigen::RowVector3d p02 = (f2.row(r) - f0.row(r)).normalized();
+        Eigen::RowVector3d p01 = f1.row(r) - f0.row(r);
+        max_deviation = std::max(max_deviation, p01.cross(p02).norm());
+      }
+      split_[i] = max_deviation > flatness;
+    }
+
+    next_intervals_.clear();
+    for (long long i = 0; i < n; i++) {
+      if (!split_[i]) continue;
+      const auto& c0 = contrib_[intervals_[i].first];
+      const auto& c2 = contrib_[intervals_[i].second];
+      double t2 = c2.first != c0.first ? 1. : c2.second;
+      if (t2 - c0.second <= kMinLength) continue;
+      size_t p1 = AddNode(
+          mid_poses_[i], {c0.first, (c0.second + t2) / 2.}, mid_trans_[i]);
+      next_intervals_.push_back({intervals_[i].first, p1});
+      next_intervals_.push_back({p1, intervals_[i].second});
+    }
+    std::swap(intervals_, next_intervals_);
+  }
+
+  // Nodes in trajectory order
+  order_.resize(n_nodes_);
+  for (size_t k = 0; k < n_nodes_; k++) order_[k] = k;
+  std::sort(order_.begin(), order_.end(), [this](size_t a, size_t b) {
+    return contrib_[a] < contrib_[b];
+  });
+
+  out.n_rows = n_rows;
+  out.poses.resize(n_nodes_);
+  out.traj_contrib.resize(n_nodes_);
+  out.fingers.resize(n_nodes_ * n_rows, 3);
+  for (size_t k = 0; k < n_nodes_; k++) {
+    out.poses[k] = poses_[order_[k]];
+    out.traj_contrib[k] = contrib_[order_[k]];
+    out.fingers.middleRows(k * n_rows, n_rows) =
+        fingers_.middleRows(order_[k] * n_rows, n_rows);
   }
 }
 
@@ -78,39 +154,19 @@ void AdaptiveSubdivideTrajectory(
     Trajectory& out_trajectory,
     std::vector<Fingers>& out_t_fingers,
     std::vector<std::pair<int, double>>& out_traj_contrib) {
-  Eigen::Affine3d finger_trans_inv =
-      robots::Forward(trajectory.front()).inverse();
-
-  Fingers fingers0 = TransformFingers(fingers, finger_trans_inv);
-
-  std::list<_AdtTrajData> l;
-
-  size_t n_keyframes = trajectory.size();
-  for (size_t i = 0; i < n_keyframes; i++) {
-    l.push_back(
-        _AdtTrajData{TransformFingers(fingers0, robots::Forward(trajectory[i])),
-                     trajectory[i],
-                     i,
-                     0});
-  }
-
-  std::list<_AdtTrajData>::iterator l_p0 = l.begin();
-  std::list<_AdtTrajData>::iterator l_p2 = ++l.begin();
-  for (size_t i = 1; i < n_keyframes; i++) {
-    AdaptiveSubdivideTrajectoryImpl(fingers0, flatness, l, l_p0, l_p2);
-    l_p0 = l_p2;
-    l_p2++;
-  }
-  size_t n_new_keyframes = l.size();
-  out_trajectory.resize(n_new_keyframes);
-  out_t_fingers.resize(n_new_keyframes);
-  out_traj_contrib.resize(n_new_keyframes);
-  std::list<_AdtTrajData>::iterator l_it = l.begin();
-  for (size_t i = 0; i < n_new_keyframes; i++) {
-    out_trajectory[i] = l_it->pose;
-    out_t_fingers[i] = l_it->fingers;
-    out_traj_contrib[i] = {l_it->traj_idx, l_it->t};
-    l_it++;
+  TrajectorySubdivider subdivider;
+  SubdividedTrajectory sub;
+  subdivider.Subdivide(trajectory, fingers, flatness, sub);
+
+  out_trajectory = sub.poses;
+  out_traj_contrib = sub.traj_contrib;
+  out_t_fingers.resize(sub.size());
+  for (size_t k = 0; k < sub.size(); k++) {
+    out_t_fingers[k].resize(fingers.size());
+    for (size_t i = 0; i < fingers.size(); i++) {
+      out_t_fingers[k][i] = sub.FingersAt(k).middleRows(
+          sub.finger_begin[i], sub.finger_begin[i + 1] - sub.finger_begin[i]);
+    }
   }
 }
 
@@ -169,7 +225,8 @@ void Barycentric(const Eigen::Vector3d& p,
 
 bool ComputeConvexHull(const Eigen::MatrixXd& points,
                        std::vector<size_t>& out_hullIndices,
-                       std::vector<std::vector<size_t>>& out_facets) {
+                       std::vector<std::vector<size_t>>& out_facets,
+                       Eigen::MatrixXd* out_planes) {
   using namespace orgQhull;
   RboxPoints rbox;
   size_t dim = points.cols();
@@ -195,8 +252,16 @@ bool ComputeConvexHull(const Eigen::MatrixXd& points,
   }
 
   out_facets.clear();
+  if (out_planes != nullptr) out_planes->resize(qHull.facetCount(), dim + 1);
   for (const QhullFacet& facet : qHull.facetList()) {
     if (!facet.isGood()) continue;
+    if (out_planes != nullptr) {
+      QhullHyperplane plane = facet.hyperplane();
+      for (size_t j = 0; j < dim; j++) {
+        (*out_planes)(out_facets.size(), j) = plane.coordinates()[j];
+      }
+      (*out_planes)(out_facets.size(), dim) = plane.offset();
+    }
     std::vector<size_t> vertices;
     if (!facet.isTopOrient() && facet.isSimplicial()) {
       QhullVertexSet vs = facet.vertices();
@@ -212,6 +277,9 @@ bool ComputeConvexHull(const Eigen::MatrixXd& points,
     }
     out_facets.push_back(vertices);
   }
+  if (out_planes != nullptr) {
+    out_planes->conservativeResize(out_facets.size(), dim + 1);
+  }
   return true;
 }
 
@@ -355,7 +423,7 @@ void ComputeConnectivityFrom(const MeshDependentResource& mdr,
     Eigen::RowVector3d direction = mdr.V.row(i) - from.transpose();
     igl::Hit hit;
     direction -= direction.normalized() * 1e-7;
-    if (!mdr.intersector.intersectSegment(
+    if (!mdr.GetIntersector().intersectSegment(
             effector_pos_f, direction.cast<float>(), hit)) {
       dist[i] = (mdr.V.row(i) - from.transpose()).norm();
       par[i] = -1;
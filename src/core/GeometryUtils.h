@@ -20,6 +20,63 @@ inline auto TransformMatrix(const Eigen::MatrixXd& mat,
   return (trans * mat.transpose().colwise().homogeneous()).transpose();
 }
 
+// Adaptively subdivided trajectory as a struct of arrays
+struct SubdividedTrajectory {
+  Trajectory poses;
+  // Finger joints of every finger at pose k, in world space:
+  // rows [k * n_rows, (k + 1) * n_rows), finger i being rows
+  // [finger_begin[i], finger_begin[i + 1]) of these
+  Eigen::MatrixX3d fingers;
+  size_t n_rows = 0;
+  std::vector<size_t> finger_begin;
+  // Keyframe and interpolation parameter of each pose
+  std::vector<std::pair<int, double>> traj_contrib;
+
+  inline size_t size() const { return poses.size(); }
+  inline auto FingersAt(size_t k) const {
+    return fingers.middleRows(k * n_rows, n_rows);
+  }
+};
+
+// Iterative AdaptiveSubdivideTrajectory that splits all the intervals of a
+// level together, with a single batched forward kinematics call. Buffers
+// are kept between calls so that reusing an instance does not allocate.
+class TrajectorySubdivider {
+ public:
+  // Intervals shorter than 2^-kMaxDepth of a keyframe segment are not split
+  static constexpr size_t kMaxDepth = 20;
+
+  void Subdivide(const Trajectory& trajectory,
+                 const Fingers& fingers,
+                 double flatness,
+                 SubdividedTrajectory& out);
+
+ private:
+  // One node per pose, in creation order
+  size_t n_nodes_ = 0;
+  Trajectory poses_;
+  std::vector<std::pair<int, double>> contrib_;
+  Eigen::MatrixX3d fingers_;
+
+  // Finger joints in effector space
+  Eigen::MatrixXd eff_fingers_;
+  size_t n_rows_ = 0;
+
+  // Pairs of nodes
+  std::vector<std::pair<size_t, size_t>> intervals_;
+  std::vector<std::pair<size_t, size_t>> next_intervals_;
+  Trajectory mid_poses_;
+  std::vector<Eigen::Affine3d> mid_trans_;
+  Eigen::MatrixX3d mid_fingers_;
+  std::vector<char> split_;
+  std::vector<size_t> order_;
+
+  size_t AddNode(const Pose& pose,
+                 const std::pair<int, double>& contrib,
+                 const Eigen::Affine3d& trans);
+};
+
+// Same as TrajectorySubdivider::Subdivide with fingers split per pose
 void AdaptiveSubdivideTrajectory(
     const Trajectory& trajectory,
     const Fingers& fingers,
@@ -43,9 +100,12 @@ void Barycentric(const Eigen::Vector3d& p,
                  double& out_w);
 
 // points: N by dim matrix
+// out_planes: optional, one row per facet, the unit outward normal followed
+// by the offset. Points x inside satisfy normal . x + offset <= 0.
 bool ComputeConvexHull(const Eigen::MatrixXd& points,
                        std::vector<size_t>& out_hull_indices,
-                       std::vector<std::vector<size_t>>& out_facets);
+                       std::vector<std::vector<size_t>>& out_facets,
+                       Eigen::MatrixXd* out_planes = nullptr);
 
 // Computes binormal B and tangential T given N.
 // Assumes N is normalized
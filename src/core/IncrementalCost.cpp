@@ -0,0 +1,96 @@
+#include "IncrementalCost.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace psg {
+namespace core {
+
+double IncrementalCost::Evaluate(const GripperParams& params,
+                                 const GripperSettings& settings,
+                                 const MeshDependentResource& mdr,
+                                 GripperParams& out_dCost_dParam) {
+  const size_t nKeyframes = params.trajectory.size();
+  const size_t nFingers = params.fingers.size();
+  const size_t nFingerJoints = settings.finger.n_finger_joints;
+  const size_t nSegments = nKeyframes > 0 ? nKeyframes - 1 : 0;
+
+  // The first keyframe moves every finger in effector space
+  bool all_dirty = !valid_ || nKeyframes == 0 ||
+                   fingers_.size() != nFingers ||
+                   trajectory_.size() != nKeyframes ||
+                   !(trajectory_.front() == params.trajectory.front()).all();
+  std::vector<bool> finger_dirty(nFingers, true);
+  std::vector<bool> keyframe_dirty(nKeyframes, true);
+  if (!all_dirty) {
+    for (size_t i = 0; i < nFingers; i++) {
+      finger_dirty[i] = !(fingers_[i].rows() == params.fingers[i].rows() &&
+                          fingers_[i] == params.fingers[i]);
+    }
+    for (size_t k = 0; k < nKeyframes; k++) {
+      keyframe_dirty[k] = !(trajectory_[k] == params.trajectory[k]).all();
+    }
+  }
+
+  blocks_.resize(nFingers * nSegments);
+  std::vector<size_t> dirty;
+  for (size_t i = 0; i < nFingers; i++) {
+    for (size_t k = 1; k < nKeyframes; k++) {
+      if (finger_dirty[i] || keyframe_dirty[k - 1] || keyframe_dirty[k]) {
+        dirty.push_back(i * nSegments + (k - 1));
+      }
+    }
+  }
+
+#ifdef _OPENMP
+  size_t n_threads = omp_get_max_threads();
+#else
+  size_t n_threads = 1;
+#endif
+  if (workspaces_.size() < n_threads) workspaces_.resize(n_threads);
+
+  // A single block is left to the parallel loops inside ComputeCostBlock
+#pragma omp parallel for schedule(dynamic) if (dirty.size() > 1)
+  for (long long d = 0; d < (long long)dirty.size(); d++) {
+#ifdef _OPENMP
+    CostWorkspace& workspace = workspaces_[omp_get_thread_num()];
+#else
+    CostWorkspace& workspace = workspaces_[0];
+#endif
+    size_t b = dirty[d];
+    ComputeCostBlock(params,
+                     settings,
+                     mdr,
+                     b / nSegments,
+                     b % nSegments + 1,
+                     workspace,
+                     blocks_[b]);
+  }
+
+  fingers_ = params.fingers;
+  trajectory_ = params.trajectory;
+  valid_ = true;
+  n_blocks_evaluated_ += dirty.size();
+  n_blocks_requested_ += blocks_.size();
+
+  // Summed in a fixed order so that the result does not depend on which
+  // blocks were recomputed
+  double cost = 0;
+  out_dCost_dParam.fingers.assign(nFingers,
+                                  Eigen::MatrixXd::Zero(nFingerJoints, 3));
+  out_dCost_dParam.trajectory.assign(nKeyframes, Pose::Zero());
+  for (size_t i = 0; i < nFingers; i++) {
+    for (size_t k = 1; k < nKeyframes; k++) {
+      const CostBlock& block = blocks_[i * nSegments + (k - 1)];
+      cost += block.cost;
+      out_dCost_dParam.fingers[i] += block.dCost_dFinger;
+      out_dCost_dParam.trajectory[k - 1] += block.dCost_dTheta0;
+      out_dCost_dParam.trajectory[k] += block.dCost_dTheta1;
+    }
+  }
+  return cost;
+}
+
+}  // namespace core
+}  // namespace psg
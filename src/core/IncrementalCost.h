@@ -0,0 +1,46 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <vector>
+
+#include "CostFunctions.h"
+
+namespace psg {
+namespace core {
+
+// ComputeCost that keeps the contribution of every (finger, segment) block
+// and only recomputes the blocks whose inputs changed since the previous
+// call. A block depends on its finger, the two keyframes around its segment
+// and the first keyframe, so perturbing a single coordinate recomputes
+// either one finger or at most two segments.
+// Not thread-safe, use one instance per optimization.
+class IncrementalCost {
+ public:
+  double Evaluate(const GripperParams& params,
+                  const GripperSettings& settings,
+                  const MeshDependentResource& mdr,
+                  GripperParams& out_dCost_dParam);
+
+  // Forces the next evaluation to recompute everything, e.g. after the
+  // settings or the mesh changed
+  inline void Invalidate() { valid_ = false; }
+
+  inline long long GetNumBlocksEvaluated() const { return n_blocks_evaluated_; }
+  inline long long GetNumBlocksRequested() const { return n_blocks_requested_; }
+
+ private:
+  bool valid_ = false;
+  // Inputs of the cached blocks
+  Fingers fingers_;
+  Trajectory trajectory_;
+  // blocks_[i * (n_keyframes - 1) + (k - 1)]: finger i, keyframes k - 1 to k
+  std::vector<CostBlock> blocks_;
+  // One per thread
+  std::vector<CostWorkspace> workspaces_;
+
+  long long n_blocks_evaluated_ = 0;
+  long long n_blocks_requested_ = 0;
+};
+
+}  // namespace core
+}  // namespace psg
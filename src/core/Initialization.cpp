@@ -1,7 +1,12 @@
 #include "Initialization.h"
 
 #include <igl/random_points_on_mesh.h>
-#include <random>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <iterator>
+#include <optional>
+#include <utility>
 #include "DiscreteDistanceField.h"
 #include "GeometryUtils.h"
 #include "QualityMetric.h"
@@ -11,6 +16,10 @@
 #include <autodiff/forward/real/eigen.hpp>
 #include "../utils.h"
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 namespace psg {
 namespace core {
 
@@ -37,7 +46,7 @@ static bool ShouldPopB(Eigen::Vector3d a,
     return false;
 
   igl::Hit hit;
-  return !mdr.intersector.intersectSegment(
+  return !mdr.GetIntersector().intersectSegment(
       a.transpose().cast<float>(), (c - a).transpose().cast<float>(), hit);
 }
 
@@ -106,16 +115,16 @@ Eigen::MatrixXd InitializeFinger(const ContactPoint contact_point,
 
   // Expand segment by 0.01 or half the clearance
   for (size_t j = 1; j < finger.size() - 1; j++) {
-    Eigen::RowVector3d normal = mdr.VN.row(fingerVid[j]);
+    Eigen::RowVector3d normal = mdr.GetVN().row(fingerVid[j]);
     igl::Hit hit;
     double avail_dis = 0.01;
-    if (mdr.intersector.intersectRay(
+    if (mdr.GetIntersector().intersectRay(
             (mdr.V.row(fingerVid[j]) + normal * 1e-6).cast<float>(),
             normal.cast<float>(),
             hit)) {
       avail_dis = std::min(avail_dis, hit.t / 2.);
     }
-    finger[j] += mdr.VN.row(fingerVid[j]) * avail_dis;
+    finger[j] += mdr.GetVN().row(fingerVid[j]) * avail_dis;
   }
 
   // Fix number of segment
@@ -299,7 +308,8 @@ void InitializeContactPointSeeds(const PassiveGripper& psg,
                                  size_t num_seeds,
                                  const ContactPointFilter& filter,
                                  std::vector<int>& out_FI,
-                                 std::vector<Eigen::Vector3d>& out_X) {
+                                 std::vector<Eigen::Vector3d>& out_X,
+                                 unsigned int seed) {
   const MeshDependentResource& mdr_floor = psg.GetFloorMDR();
   const MeshDependentResource& mdr_remeshed = psg.GetRemeshedMDR();
   const MeshDependentResource& mdr = psg.GetMDR();
@@ -312,13 +322,15 @@ void InitializeContactPointSeeds(const PassiveGripper& psg,
   std::vector<int> v_par;
   ComputeConnectivityFrom(mdr_floor, effector_pos, v_dist, v_par);
 
-  Eigen::VectorXd K = mdr_remeshed.PV1.cwiseMax(mdr_remeshed.PV2);
+  Eigen::VectorXd K = mdr_remeshed.GetPV1().cwiseMax(mdr_remeshed.GetPV2());
 
   out_X.clear();
   out_FI.clear();
 
   double cos_angle = -cos(filter.angle);
 
+  // igl::random_points_on_mesh draws from std::rand
+  srand(seed);
   while (out_FI.size() < num_seeds) {
     Eigen::MatrixXd B_;
     Eigen::VectorXi out_FI_;
@@ -339,11 +351,11 @@ void InitializeContactPointSeeds(const PassiveGripper& psg,
 
       /*
       // filter angle
-      Eigen::RowVector3d n = mdr.FN.row(out_FI_(i));
+      Eigen::RowVector3d n = mdr.GetFN().row(out_FI_(i));
       if (n.y() > cos_angle) continue;
       // filter hole
       igl::Hit hit;
-      if (mdr.intersector.intersectRay(
+      if (mdr.GetIntersector().intersectRay(
               (x + n * 1e-6).cast<float>(), n.cast<float>(), hit)) {
         if (hit.t < filter.hole) continue;
       }
@@ -371,27 +383,58 @@ void InitializeContactPointSeeds(const PassiveGripper& psg,
   Log() << "Num seeds: " << out_X.size() << std::endl;
 }
 
+// Counter-based random stream (SplitMix64). The draws of a trial only depend
+// on the seed and the trial index, not on the thread running it.
+class TrialRandom {
+ public:
+  TrialRandom(uint64_t seed, uint64_t trial) : state_(Mix(Mix(seed) + trial)) {}
+
+  // Uniform in [0, n). The modulo bias is negligible for n << 2^64.
+  inline size_t Index(size_t n) {
+    state_ += 0x9e3779b97f4a7c15ull;
+    return (size_t)(Mix(state_) % n);
+  }
+
+ private:
+  static inline uint64_t Mix(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+  }
+
+  uint64_t state_;
+};
+
+ContactPointStats& ContactPointStats::operator+=(
+    const ContactPointStats& other) {
+  n_seeds += other.n_seeds;
+  n_trials += other.n_trials;
+  n_distinct += other.n_distinct;
+  n_spread += other.n_spread;
+  n_opposition += other.n_opposition;
+  n_partial_closure += other.n_partial_closure;
+  n_approach += other.n_approach;
+  return *this;
+}
+
 std::vector<ContactPointMetric> InitializeContactPoints(
     const PassiveGripper& psg,
     const ContactPointFilter& filter,
     size_t num_candidates,
-    size_t num_seeds) {
+    size_t num_seeds,
+    unsigned int seed,
+    ContactPointStats* out_stats) {
   const MeshDependentResource& mdr = psg.GetMDR();
   const ContactSettings& settings = psg.GetContactSettings();
+  const QualitySettings& quality_settings = psg.GetQualitySettings();
   Eigen::Vector3d effector_pos =
       robots::Forward(psg.GetParams().trajectory.front()).translation();
 
   std::vector<int> FI;
   std::vector<Eigen::Vector3d> X;
 
-  InitializeContactPointSeeds(psg, num_seeds, filter, FI, X);
-
-  std::mt19937 gen;
-  std::uniform_int_distribution<int> dist(0, num_seeds - 1);
-
-  std::vector<ContactPointMetric> prelim;
-  prelim.reserve(num_candidates);
-  size_t total_iters = 0;
+  // Floor and reachability are filtered per seed
+  InitializeContactPointSeeds(psg, num_seeds, filter, FI, X, seed);
 
   // To be used for tolerance check
   Log() << "Building neighbor info" << std::endl;
@@ -401,47 +444,80 @@ std::vector<ContactPointMetric> InitializeContactPoints(
   Log() << "Building distance field" << std::endl;
   DiscreteDistanceField distanceField(mdr.V, mdr.F, 50, effector_pos);
   Log() << "Done building distance field" << std::endl;
-#pragma omp parallel
-  {
-    size_t iters = 0;
-    while (true) {
-      iters++;
-      bool toContinue;
-#pragma omp critical
-      {
-        toContinue = prelim.size() < num_candidates;
-        if (iters >= 1000) {
-          total_iters += iters;
-          iters = 0;
-          if (total_iters > num_candidates * 1000 &&
-              total_iters > 10000 * prelim.size())  // success rate < 0.01%
-            toContinue = false;
-        }
-      }
-      if (!toContinue) break;
+
+  // Trials run in fixed size batches. Each thread appends its candidates,
+  // tagged with the trial index, to its own buffer. Keeping the first
+  // num_candidates by trial index makes the result independent of the
+  // number of threads.
+  constexpr long long kTrialBatch = 4096;
+  // Normals sampled within the tolerance per triplet
+  constexpr int kToleranceSamples = 1;
+#ifdef _OPENMP
+  size_t n_threads = omp_get_max_threads();
+#else
+  size_t n_threads = 1;
+#endif
+  std::vector<std::vector<std::pair<long long, ContactPointMetric>>>
+      thread_found(n_threads);
+  std::vector<ContactPointStats> thread_stats(n_threads);
+  const double min_distance2 = filter.min_distance * filter.min_distance;
+  size_t n_found = 0;
+  long long n_trials = 0;
+  // Progress is logged every kLogInterval candidates
+  constexpr size_t kLogInterval = 500;
+  while (n_found < num_candidates) {
+    // success rate < 0.01%
+    if (n_trials > (long long)num_candidates * 1000 &&
+        n_trials > 10000 * (long long)n_found)
+      break;
+
+#pragma omp parallel for schedule(dynamic, 16)
+    for (long long trial = n_trials; trial < n_trials + kTrialBatch; trial++) {
+#ifdef _OPENMP
+      size_t thread_id = omp_get_thread_num();
+#else
+      size_t thread_id = 0;
+#endif
+      auto& found = thread_found[thread_id];
+      ContactPointStats& stats = thread_stats[thread_id];
+      TrialRandom random(seed, trial);
+      stats.n_trials++;
+
+      // Stages are ordered by cost, each one only runs on the survivors of
+      // the previous ones
 
       // Random 3 contact points
-      int pids[3] = {dist(gen), dist(gen), dist(gen)};
+      int pids[3] = {(int)random.Index(num_seeds),
+                     (int)random.Index(num_seeds),
+                     (int)random.Index(num_seeds)};
       if (pids[0] == pids[1] || pids[1] == pids[2] || pids[0] == pids[2])
         continue;
+      stats.n_distinct++;
+
+      if ((X[pids[0]] - X[pids[1]]).squaredNorm() < min_distance2 ||
+          (X[pids[1]] - X[pids[2]]).squaredNorm() < min_distance2 ||
+          (X[pids[0]] - X[pids[2]]).squaredNorm() < min_distance2)
+        continue;
+      stats.n_spread++;
+
       std::vector<ContactPoint> contactPoints(3);
-      std::vector<std::vector<int>> neighbors;
       for (int i = 0; i < 3; i++) {
         contactPoints[i].position = X[pids[i]];
-        contactPoints[i].normal = mdr.FN.row(FI[pids[i]]);
+        contactPoints[i].normal = mdr.GetFN().row(FI[pids[i]]);
         contactPoints[i].fid = FI[pids[i]];
-
-        // Check tolerance
-        neighbors.push_back(
-            neighborInfo.GetNeighbors(contactPoints[i], mdr.V, mdr.F, 0.001));
       }
+      // Check tolerance
+      // Only looked up if there is another sample
+      std::vector<std::vector<int>> neighbors;
 
       // Check Feasibility: Minimum Wrench
+      bool passOpposition = true;
       bool passMinimumWrench = true;
-      std::vector<ContactPoint> contact_cones;
+      // Of the first sample
+      std::optional<GraspAnalysis> analysis;
       double partialMinWrench = 0;
       int sample;
-      for (sample = 0; sample < 1; sample++) {
+      for (sample = 0; sample < kToleranceSamples; sample++) {
         std::vector<ContactPoint> sample_contact_cones;
         sample_contact_cones.reserve(3 * settings.cone_res);
         for (size_t i = 0; i < 3; i++) {
@@ -451,14 +527,23 @@ std::vector<ContactPointMetric> InitializeContactPoints(
               sample_contact_cones.end(), cone.begin(), cone.end());
         }
 
-        double samplePartialMinWrench =
-            ComputePartialMinWrenchQP(sample_contact_cones,
+        // Normal cone opposition: the forces alone must resist gravity
+        if (!CheckForceOppositionQP(sample_contact_cones,
+                                    -Eigen::Vector3d::UnitY())) {
+          passOpposition = false;
+          passMinimumWrench = false;
+          break;
+        }
+
+        GraspAnalysis sample_analysis(sample_contact_cones,
                                       mdr.center_of_mass,
                                       -Eigen::Vector3d::UnitY(),
-                                      Eigen::Vector3d::Zero());
+                                      Eigen::Vector3d::Zero(),
+                                      quality_settings);
+        double samplePartialMinWrench = sample_analysis.GetPartialMinWrench();
 
         if (sample == 0) {
-          contact_cones = sample_contact_cones;
+          analysis = std::move(sample_analysis);
           partialMinWrench = samplePartialMinWrench;
         }
 
@@ -467,21 +552,31 @@ std::vector<ContactPointMetric> InitializeContactPoints(
           break;
         }
 
+        if (sample + 1 == kToleranceSamples) break;
+
         // Prepare next sample
+        if (neighbors.empty()) {
+          for (size_t i = 0; i < 3; i++) {
+            neighbors.push_back(neighborInfo.GetNeighbors(
+                contactPoints[i], mdr.V, mdr.F, 0.001));
+          }
+        }
         for (size_t i = 0; i < 3; i++) {
-          std::uniform_int_distribution<> dist(0, neighbors[i].size() - 1);
-          int fid = neighbors[i][dist(gen)];
-          contactPoints[i].normal = mdr.FN.row(fid);
+          int fid = neighbors[i][random.Index(neighbors[i].size())];
+          contactPoints[i].normal = mdr.GetFN().row(fid);
         }
       }
+      if (!passOpposition) continue;
+      stats.n_opposition++;
       // Get at least a partial closure
       if (!passMinimumWrench) {
         // std::cout << "Failed after " << sample << " samples" << std::endl;
         continue;
       }
+      stats.n_partial_closure++;
 
       for (int i = 0; i < 3; i++) {
-        contactPoints[i].normal = mdr.FN.row(contactPoints[i].fid);
+        contactPoints[i].normal = mdr.GetFN().row(contactPoints[i].fid);
       }
 
       // Check Feasiblity: Approach Direction
@@ -491,8 +586,10 @@ std::vector<ContactPointMetric> InitializeContactPoints(
         // std::cout << "Failed due to approach direction" << std::endl;
         continue;
       }
+      stats.n_approach++;
       // std::cout << "Success" << std::endl;
-      double minWrench = ComputeMinWrenchQP(contact_cones, mdr.center_of_mass);
+      // Shares the convex hull with the partial min wrench
+      double minWrench = analysis->GetMinWrench();
 
       ContactPointMetric candidate;
       candidate.contact_points = contactPoints;
@@ -501,14 +598,38 @@ std::vector<ContactPointMetric> InitializeContactPoints(
       candidate.trans = trans;
       candidate.finger_distance =
           GetFingerDistance(distanceField, contactPoints);
-#pragma omp critical
-      {
-        prelim.push_back(candidate);
-        if (prelim.size() % 500 == 0)
-          Log() << ">> prelim prog: " << prelim.size() << "/" << num_candidates
-                << std::endl;
-      }
+      found.emplace_back(trial, candidate);
     }
+    n_trials += kTrialBatch;
+
+    size_t n_found_prev = n_found;
+    n_found = 0;
+    for (const auto& buffer : thread_found) n_found += buffer.size();
+    if (std::min(n_found, num_candidates) / kLogInterval !=
+        n_found_prev / kLogInterval) {
+      Log() << ">> prelim prog: " << std::min(n_found, num_candidates) << "/"
+            << num_candidates << std::endl;
+    }
+  }
+
+  // Merge
+  std::vector<std::pair<long long, ContactPointMetric>> found;
+  found.reserve(n_found);
+  for (auto& buffer : thread_found) {
+    std::move(buffer.begin(), buffer.end(), std::back_inserter(found));
+  }
+  std::sort(found.begin(),
+            found.end(),
+            [](const auto& a, const auto& b) { return a.first < b.first; });
+  if (found.size() > num_candidates) found.resize(num_candidates);
+  std::vector<ContactPointMetric> prelim;
+  prelim.reserve(found.size());
+  for (auto& kv : found) prelim.push_back(std::move(kv.second));
+
+  if (out_stats != nullptr) {
+    *out_stats = ContactPointStats();
+    out_stats->n_seeds = X.size();
+    for (const ContactPointStats& stats : thread_stats) *out_stats += stats;
   }
 
   if (prelim.size() < num_candidates) {
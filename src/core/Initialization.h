@@ -27,17 +27,43 @@ Trajectory InitializeTrajectory(const std::vector<Eigen::MatrixXd>& fingers,
                                 const Pose& init_pose,
                                 size_t n_keyframes);
 
+// seed: the seeds and the candidates are the same for a given seed,
+// whatever the number of threads
 void InitializeContactPointSeeds(const PassiveGripper& psg,
                                  size_t num_seeds,
                                  const ContactPointFilter& filter,
                                  std::vector<int>& out_FI,
-                                 std::vector<Eigen::Vector3d>& out_X);
+                                 std::vector<Eigen::Vector3d>& out_X,
+                                 unsigned int seed = 0);
 
+// Number of triplets passing each stage of InitializeContactPoints, in the
+// order the stages run. Counts every trial run, including those past the
+// last candidate kept.
+struct ContactPointStats {
+  size_t n_seeds = 0;
+  size_t n_trials = 0;
+  // Three different seeds
+  size_t n_distinct = 0;
+  // Pairwise distance at least filter.min_distance
+  size_t n_spread = 0;
+  // The contact forces alone can resist gravity (normal cone opposition)
+  size_t n_opposition = 0;
+  // Partial closure QP
+  size_t n_partial_closure = 0;
+  // Approach direction
+  size_t n_approach = 0;
+
+  ContactPointStats& operator+=(const ContactPointStats& other);
+};
+
+// out_stats: optional, number of triplets passing each stage
 std::vector<ContactPointMetric> InitializeContactPoints(
     const PassiveGripper& psg,
     const ContactPointFilter& filter,
     size_t num_candidates,
-    size_t num_seeds);
+    size_t num_seeds,
+    unsigned int seed = 0,
+    ContactPointStats* out_stats = nullptr);
 
 void InitializeGripperBound(const PassiveGripper& psg,
                             Eigen::Vector3d& out_lb,
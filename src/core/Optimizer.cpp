@@ -1,5 +1,12 @@
 #include "Optimizer.h"
 
+#include <random>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "../utils.h"
+
 namespace psg {
 namespace core {
 
@@ -73,82 +80,243 @@ void MyUnflatten(GripperParams& meta, const double* x) {
   }
 }
 
+void CheckGradient(const CostFunction& cost_function,
+                   const GripperParams& params,
+                   const GripperParams& init_params,
+                   const GripperSettings& settings,
+                   const MeshDependentResource& mdr,
+                   double step,
+                   Eigen::VectorXd& out_analytic,
+                   Eigen::VectorXd& out_numeric) {
+  size_t dimension = MyFlattenSize(params);
+  GripperParams dCost_dParam;
+  cost_function(params, init_params, settings, mdr, dCost_dParam, nullptr);
+  out_analytic.resize(dimension);
+  MyFlattenGrad(dCost_dParam, out_analytic.data());
+
+  Eigen::VectorXd x(dimension);
+  MyFlattenGrad(params, x.data());
+  out_numeric.resize(dimension);
+  GripperParams cur_params = params;
+  for (size_t i = 0; i < dimension; i++) {
+    double x_i = x(i);
+    x(i) = x_i + step;
+    MyUnflatten(cur_params, x.data());
+    double cost_p = cost_function(
+        cur_params, init_params, settings, mdr, dCost_dParam, nullptr);
+    x(i) = x_i - step;
+    MyUnflatten(cur_params, x.data());
+    double cost_m = cost_function(
+        cur_params, init_params, settings, mdr, dCost_dParam, nullptr);
+    x(i) = x_i;
+    out_numeric(i) = (cost_p - cost_m) / (2. * step);
+  }
+}
+
+// Interval (in evaluations) between two checks of a start against the
+// global best, and the ratio above which it is terminated
+static constexpr long long kCullInterval = 100;
+static constexpr double kCullRatio = 2.;
+
 static double ComputeCostWrapper(unsigned n,
                                  const double* x,
                                  double* grad,
                                  void* data) {
-  // ignore grad
-  return reinterpret_cast<Optimizer*>(data)->ComputeCostInternal(n, x, grad);
+  auto start = reinterpret_cast<std::pair<Optimizer*, size_t>*>(data);
+  return start->first->ComputeCostInternal(start->second, n, x, grad);
 }
 
 Optimizer::~Optimizer() {
   Cancel();
-  if (opt_ != nullptr) nlopt_destroy(opt_);
+  for (auto& start : starts_) {
+    if (start->opt != nullptr) nlopt_destroy(start->opt);
+  }
 }
 
 void Optimizer::Optimize(const PassiveGripper& psg) {
   Cancel();
-  params_ = psg.GetParams();
+  for (auto& start : starts_) {
+    if (start->opt != nullptr) nlopt_destroy(start->opt);
+  }
+  starts_.clear();
+  start_data_.clear();
+
   params_proto_ = psg.GetParams();
   init_params_ = psg.GetParams();
-  const auto& mdr = psg.GetRemeshedMDR();
-  mdr_.init(mdr);
+  // Shared: the gripper replaces rather than modifies it on mesh changes
+  mdr_ = psg.GetSharedRemeshedMDR();
   settings_ = psg.GetSettings();
 
   cost_function_ = kCostFunctions[(int)settings_.cost.cost_function];
 
-  dimension_ = MyFlattenSize(params_);
-  x_.reset(new double[dimension_]);
+  dimension_ = MyFlattenSize(init_params_);
   lb_.reset(new double[dimension_]);
   ub_.reset(new double[dimension_]);
   g_min_x_.reset(new double[dimension_]);
-  MyFlatten(params_, settings_.opt, x_.get(), lb_.get(), ub_.get());
+  std::unique_ptr<double[]> x0(new double[dimension_]);
+  MyFlatten(init_params_, settings_.opt, x0.get(), lb_.get(), ub_.get());
 
-  if (opt_ != nullptr) nlopt_destroy(opt_);
-  opt_ = nlopt_create(settings_.opt.algorithm, dimension_);
-  if (settings_.opt.population > 0) {
-    nlopt_set_population(opt_, settings_.opt.population);
-  }
+  // Split the threads between the starts
+  size_t n_starts = std::max<size_t>(settings_.opt.n_starts, 1);
+#ifdef _OPENMP
+  n_threads_per_start_ = std::max(1, omp_get_max_threads() / (int)n_starts);
+#else
+  n_threads_per_start_ = 1;
+#endif
+
+  std::mt19937 gen(0);
+  std::uniform_real_distribution<double> dis(-1., 1.);
+  start_data_.resize(n_starts);
+  for (size_t i = 0; i < n_starts; i++) {
+    starts_.emplace_back(new Start());
+    Start& start = *starts_.back();
+    start.index = i;
+    start.params = init_params_;
+    start.x.reset(new double[dimension_]);
+
+    // The first start is the initial params, the others are perturbed
+    // within the bounds
+    for (int j = 0; j < dimension_; j++) {
+      double half_range = (ub_[j] - lb_[j]) / 2.;
+      double perturbation =
+          (i == 0) ? 0. : dis(gen) * settings_.opt.start_perturbation;
+      start.x[j] = std::min(
+          std::max(x0[j] + perturbation * half_range, lb_[j]), ub_[j]);
+    }
+
+    if (settings_.opt.batched_population) {
+      start.population_opt.reset(
+          new PopulationOptimizer(dimension_,
+                                  settings_.opt.population,
+                                  n_threads_per_start_,
+                                  lb_.get(),
+                                  ub_.get(),
+                                  (unsigned)i));
+      start.thread_params.resize(n_threads_per_start_, init_params_);
+      start.thread_workspaces.resize(n_threads_per_start_);
+      continue;
+    }
 
-  nlopt_set_min_objective(opt_, ComputeCostWrapper, this);
-  if (settings_.opt.max_runtime > 0.) {
-    nlopt_set_maxtime(opt_, settings_.opt.max_runtime);
+    start.opt = nlopt_create(settings_.opt.algorithm, dimension_);
+    if (settings_.opt.population > 0) {
+      nlopt_set_population(start.opt, settings_.opt.population);
+    }
+
+    start_data_[i] = {this, i};
+    nlopt_set_min_objective(start.opt, ComputeCostWrapper, &start_data_[i]);
+    if (settings_.opt.max_runtime > 0.) {
+      nlopt_set_maxtime(start.opt, settings_.opt.max_runtime);
+    }
+    nlopt_set_lower_bounds(start.opt, lb_.get());
+    nlopt_set_upper_bounds(start.opt, ub_.get());
+    nlopt_set_stopval(start.opt, 1e-15);
+    if (settings_.opt.max_runtime == 0.) {
+      nlopt_set_ftol_rel(start.opt, settings_.opt.tolerance);
+      nlopt_set_ftol_abs(start.opt, 1e-15);
+    }
   }
-  nlopt_set_lower_bounds(opt_, lb_.get());
-  nlopt_set_upper_bounds(opt_, ub_.get());
-  nlopt_set_stopval(opt_, 1e-15);
-  if (settings_.opt.max_runtime == 0.) {
-    nlopt_set_ftol_rel(opt_, settings_.opt.tolerance);
-    nlopt_set_ftol_abs(opt_, 1e-15);
+  if (settings_.opt.batched_population) {
+    Log() << "Optimizer: batched population search, "
+          << starts_.front()->population_opt->GetBatchSize()
+          << " evaluations per batch (algorithm setting ignored)"
+          << std::endl;
   }
-  if (settings_.opt.max_iters > 0) {
-    nlopt_set_maxeval(opt_, settings_.opt.max_iters);
+  if (n_starts > 1) {
+    Log() << "Optimizer: " << n_starts << " starts with "
+          << n_threads_per_start_ << " thread(s) each" << std::endl;
   }
 
   n_iters_ = 0;
-  g_min_cost_ = t_min_cost_ = std::numeric_limits<double>::max();
+  g_min_cost_ = std::numeric_limits<double>::max();
   is_running_ = true;
   is_resumable_ = true;
   start_time_ = std::chrono::high_resolution_clock::now();
-  optimize_future_ = std::async(std::launch::async, [&] {
-    double minf; /* minimum objective value, upon return */
-    nlopt_result result = nlopt_optimize(opt_, x_.get(), &minf);
-    is_running_ = false;
+  n_running_ = (int)starts_.size();
+  for (auto& start : starts_) {
+    Launch(*start);
+  }
+}
+
+void Optimizer::Launch(Start& start) {
+  start.future = std::async(std::launch::async, [this, &start] {
+#ifdef _OPENMP
+    omp_set_num_threads(n_threads_per_start_);
+#endif
+    auto population_cost = [this, &start](const double* x,
+                                          int thread) -> double {
+      return EvaluateCost(start,
+                          start.thread_params[thread],
+                          start.thread_workspaces[thread],
+                          nullptr,
+                          dimension_,
+                          x,
+                          nullptr);
+    };
+    // max_evals: 0 for unlimited
+    auto run = [this, &start, &population_cost](long long max_evals) {
+      double minf; /* minimum objective value, upon return */
+      if (start.population_opt != nullptr) {
+        PopulationOptimizer::StopCriteria stop;
+        stop.max_evals = max_evals;
+        stop.max_runtime = settings_.opt.max_runtime;
+        stop.stopval = 1e-15;
+        if (settings_.opt.max_runtime == 0.) {
+          stop.ftol_rel = settings_.opt.tolerance;
+          stop.ftol_abs = 1e-15;
+        }
+        return start.population_opt->Optimize(
+            population_cost, stop, start.x.get(), minf);
+      }
+      nlopt_set_maxeval(start.opt, (int)max_evals);
+      return nlopt_optimize(start.opt, start.x.get(), &minf);
+    };
+
+    nlopt_result result = NLOPT_SUCCESS;
+    bool run_double = true;
+    if (!start.float_phase_done &&
+        cost_function_.cost_enum == CostFunctionEnum::kGradientBased &&
+        settings_.cost.float_evals > 0) {
+      start.single_precision = true;
+      result = run((long long)settings_.cost.float_evals);
+      start.single_precision = false;
+      start.float_phase_done = true;
+      // Float costs are never compared with double ones: the incumbent and
+      // the population are evaluated again in double, which also sets the
+      // global best
+      if (start.population_opt != nullptr) {
+        start.population_opt->Reevaluate(population_cost);
+      } else {
+        ComputeCostInternal(start.index, dimension_, start.x.get(), nullptr);
+      }
+      run_double =
+          result != NLOPT_FORCED_STOP && result != NLOPT_MAXTIME_REACHED;
+    }
+    if (run_double) result = run(settings_.opt.max_iters);
+    if (--n_running_ == 0) is_running_ = false;
     return result;
   });
 }
 
+void Optimizer::Stop(Start& start) {
+  if (start.opt != nullptr) nlopt_force_stop(start.opt);
+  if (start.population_opt != nullptr) start.population_opt->ForceStop();
+}
+
 void Optimizer::Resume() {
-  if (opt_ == nullptr) return;
+  if (starts_.empty()) return;
   if (is_running_) return;
   if (!is_resumable_) return;
+  Wait();
+  int n_resumed = 0;
+  for (auto& start : starts_) {
+    if (!start->is_culled) n_resumed++;
+  }
+  if (n_resumed == 0) return;
   is_running_ = true;
-  optimize_future_ = std::async(std::launch::async, [&] {
-    double minf; /* minimum objective value, upon return */
-    nlopt_result result = nlopt_optimize(opt_, x_.get(), &minf);
-    is_running_ = false;
-    return result;
-  });
+  n_running_ = n_resumed;
+  for (auto& start : starts_) {
+    if (!start->is_culled) Launch(*start);
+  }
 }
 
 void Optimizer::Reset() {
@@ -159,14 +327,16 @@ void Optimizer::Reset() {
 }
 
 void Optimizer::Wait() {
-  if (optimize_future_.valid()) {
-    optimize_future_.get();
+  for (auto& start : starts_) {
+    if (start->future.valid()) {
+      start->future.get();
+    }
   }
 }
 
 void Optimizer::Cancel() {
-  if (opt_ != nullptr) {
-    nlopt_force_stop(opt_);
+  for (auto& start : starts_) {
+    Stop(*start);
   }
   Wait();
 }
@@ -176,35 +346,103 @@ const GripperParams& Optimizer::GetCurrentParams() {
   MyUnflatten(params_proto_, g_min_x_.get());
   return params_proto_;
 }
-double Optimizer::ComputeCostInternal(unsigned n,
+
+double Optimizer::ComputeCostInternal(size_t start_index,
+                                      unsigned n,
                                       const double* x,
                                       double* grad) {
-  MyUnflatten(params_, x);
+  Start& start = *starts_[start_index];
+  IncrementalCost* incremental_cost =
+      settings_.opt.incremental_cost ? &start.incremental_cost : nullptr;
+  return EvaluateCost(
+      start, start.params, start.workspace, incremental_cost, n, x, grad);
+}
+
+double Optimizer::EvaluateCost(Start& start,
+                               GripperParams& params,
+                               CostWorkspace& workspace,
+                               IncrementalCost* incremental_cost,
+                               unsigned n,
+                               const double* x,
+                               double* grad) {
+  MyUnflatten(params, x);
   GripperParams dCost_dParam;
-  double cost = cost_function_.cost_function(
-      params_, init_params_, settings_, mdr_, dCost_dParam, nullptr);
+  double cost;
+  // The incremental cost only starts after the single precision phase so
+  // that its cached blocks are all in double
+  if (cost_function_.cost_enum == CostFunctionEnum::kGradientBased &&
+      start.single_precision) {
+    cost = ComputeCostFloat(params,
+                            init_params_,
+                            settings_,
+                            *mdr_,
+                            workspace,
+                            dCost_dParam,
+                            nullptr);
+  } else if (cost_function_.cost_enum == CostFunctionEnum::kGradientBased &&
+             incremental_cost != nullptr) {
+    cost = incremental_cost->Evaluate(params, settings_, *mdr_, dCost_dParam);
+  } else if (cost_function_.cost_enum == CostFunctionEnum::kGradientBased) {
+    cost = ComputeCost(params,
+                       init_params_,
+                       settings_,
+                       *mdr_,
+                       workspace,
+                       dCost_dParam,
+                       nullptr);
+  } else if (cost_function_.cost_enum == CostFunctionEnum::kSP) {
+    cost = ComputeCost_SP(params,
+                          init_params_,
+                          settings_,
+                          *mdr_,
+                          workspace,
+                          dCost_dParam,
+                          nullptr);
+  } else {
+    cost = cost_function_.cost_function(
+        params, init_params_, settings_, *mdr_, dCost_dParam, nullptr);
+  }
   if (grad != nullptr) {
     if (cost_function_.has_grad) {
       MyFlattenGrad(dCost_dParam, grad);
-    } else if (n_iters_ == 0) {
+    } else if (start.n_evals == 0) {
       std::cerr << "Error: Using gradient-based optimizer on a non-gradient "
                    "cost function"
                 << std::endl;
     }
   }
-  n_iters_++;
-  if (cost < t_min_cost_) {
-    is_result_available_ = true;
-    t_min_cost_ = cost;
-    g_min_cost_ = cost;
-    {
-      std::lock_guard<std::mutex> guard(g_min_x_mutex_);
+  long long n_iters = ++n_iters_;
+  long long n_evals = ++start.n_evals;
+  // Only double costs are kept as the best ones
+  if (start.single_precision) return cost;
+  if (cost < start.min_cost) {
+    std::lock_guard<std::mutex> guard(g_min_x_mutex_);
+    if (cost < start.min_cost) start.min_cost = cost;
+    if (cost < g_min_cost_) {
+      is_result_available_ = true;
+      g_min_cost_ = cost;
       memcpy(g_min_x_.get(), x, n * sizeof(double));
+      std::cerr << "Iter: " << n_iters << ", Current Cost : " << cost;
+      if (starts_.size() > 1) {
+        std::cerr << " (start " << start.index << ")";
+      }
+      std::cerr << std::endl;
+    }
+  }
+
+  // Terminate starts that are far behind the global best
+  if (starts_.size() > 1 && n_evals % kCullInterval == 0) {
+    double min_cost = start.min_cost;
+    double g_min_cost = g_min_cost_;
+    if (min_cost > kCullRatio * g_min_cost + 1e-9) {
+      Log() << "Optimizer: terminating start " << start.index
+            << " (cost: " << min_cost << ", best: " << g_min_cost << ")"
+            << std::endl;
+      start.is_culled = true;
+      Stop(start);
     }
-    std::cerr << "Iter: " << n_iters_ << ", Current Cost : " << cost
-              << std::endl;
   }
   return cost;
 }
 }  // namespace core
-}  // namespace psg
\ No newline at end of file
+}  // namespace psg
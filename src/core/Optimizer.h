@@ -5,11 +5,14 @@
 #include <atomic>
 #include <chrono>
 #include <future>
+#include <memory>
 #include <mutex>
 #include <vector>
 
 #include "PassiveGripper.h"
 #include "CostFunctions.h"
+#include "IncrementalCost.h"
+#include "PopulationOptimizer.h"
 
 namespace psg {
 namespace core {
@@ -18,6 +21,17 @@ size_t MyFlattenSize(const GripperParams& meta);
 void MyUnflatten(GripperParams& meta, const double* x);
 void MyFlattenGrad(const GripperParams& meta, double* x);
 
+// Gradient of cost_function at params and its central difference
+// approximation with the given step, both in the order of MyFlattenGrad
+void CheckGradient(const CostFunction& cost_function,
+                   const GripperParams& params,
+                   const GripperParams& init_params,
+                   const GripperSettings& settings,
+                   const MeshDependentResource& mdr,
+                   double step,
+                   Eigen::VectorXd& out_analytic,
+                   Eigen::VectorXd& out_numeric);
+
 class Optimizer {
  public:
   ~Optimizer();
@@ -27,9 +41,9 @@ class Optimizer {
   void Resume();
   void Reset();
 
-  inline bool IsRunning() { return opt_ != nullptr && is_running_; };
+  inline bool IsRunning() { return !starts_.empty() && is_running_; };
   inline bool IsResultAvailable() {
-    return opt_ != nullptr && is_result_available_.load();
+    return !starts_.empty() && is_result_available_.load();
   }
   inline double GetCurrentCost() { return g_min_cost_; }
   inline std::chrono::time_point<std::chrono::high_resolution_clock>
@@ -38,34 +52,73 @@ class Optimizer {
   }
   const GripperParams& GetCurrentParams();
 
-
   // Internal use
-  double ComputeCostInternal(unsigned n, const double* x, double* grad);
+  double ComputeCostInternal(size_t start,
+                             unsigned n,
+                             const double* x,
+                             double* grad);
 
  private:
-  nlopt_opt opt_ = nullptr;
+  // An independent NLopt instance, or a batched population optimizer
+  struct Start {
+    size_t index;
+    nlopt_opt opt = nullptr;
+    std::unique_ptr<PopulationOptimizer> population_opt;
+    std::unique_ptr<double[]> x;
+    GripperParams params;
+    CostWorkspace workspace;
+    IncrementalCost incremental_cost;
+    // Scratch params and workspace of each thread evaluating a batch
+    std::vector<GripperParams> thread_params;
+    std::vector<CostWorkspace> thread_workspaces;
+    std::atomic<long long> n_evals = 0;
+    // Set while the first cost.float_evals evaluations run in single
+    // precision, only changed between optimizer runs
+    bool single_precision = false;
+    bool float_phase_done = false;
+    // Written under g_min_x_mutex_, read without it by the cull check
+    std::atomic<double> min_cost = std::numeric_limits<double>::max();
+    std::atomic_bool is_culled = false;
+    std::future<nlopt_result> future;
+  };
+
   int dimension_;
+  // OpenMP threads per start
+  int n_threads_per_start_;
 
-  GripperParams params_;
   GripperParams init_params_;
   GripperParams params_proto_;
-  MeshDependentResource mdr_;
+  std::shared_ptr<const MeshDependentResource> mdr_;
   GripperSettings settings_;
-  std::unique_ptr<double> x_;
-  std::unique_ptr<double> lb_;
-  std::unique_ptr<double> ub_;
+  std::unique_ptr<double[]> lb_;
+  std::unique_ptr<double[]> ub_;
 
-  std::future<nlopt_result> optimize_future_;
+  std::vector<std::unique_ptr<Start>> starts_;
+  std::atomic_int n_running_ = 0;
   std::atomic_bool is_running_ = false;
   std::atomic_bool is_resumable_ = false;
   std::atomic_bool is_result_available_ = false;
 
-  long long n_iters_;
+  std::atomic<long long> n_iters_;
   std::atomic<double> g_min_cost_;
-  double t_min_cost_;
-  std::unique_ptr<double> g_min_x_;
+  std::unique_ptr<double[]> g_min_x_;
   mutable std::mutex g_min_x_mutex_;
 
+  // Passed to NLopt as the objective data
+  std::vector<std::pair<Optimizer*, size_t>> start_data_;
+
+  void Launch(Start& start);
+  void Stop(Start& start);
+  // Thread-safe as long as params, workspace and incremental_cost are not
+  // shared. incremental_cost can be null.
+  double EvaluateCost(Start& start,
+                      GripperParams& params,
+                      CostWorkspace& workspace,
+                      IncrementalCost* incremental_cost,
+                      unsigned n,
+                      const double* x,
+                      double* grad);
+
   std::chrono::time_point<std::chrono::high_resolution_clock> start_time_;
 
   CostFunctionItem cost_function_;
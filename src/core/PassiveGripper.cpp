@@ -1,6 +1,9 @@
 #include "PassiveGripper.h"
 
 #include <igl/copyleft/cgal/mesh_boolean.h>
+#include <cstring>
+#include <fstream>
+#include <vector>
 
 #include <igl/marching_cubes.h>
 #include <igl/voxel_grid.h>
@@ -15,6 +18,12 @@ namespace core {
 
 // Mesh
 
+// The original mesh is used for the remesh, the intersection test and the
+// center of mass. Curvature is only needed on the remeshed one.
+static constexpr unsigned kOriginalMeshComponents =
+    MeshDependentResource::kTree | MeshDependentResource::kIntersector |
+    MeshDependentResource::kNormals;
+
 PassiveGripper::PassiveGripper() {
   params_.trajectory.push_back(kInitPose);
 }
@@ -44,7 +53,11 @@ static void InitMdrFloor(const Eigen::MatrixXd& V,
   igl::copyleft::cgal::mesh_boolean(
       V, F, cur_cube_V, cube_F, igl::MESH_BOOLEAN_TYPE_UNION, RV, RF);
 
-  out_mdr.init(RV, RF);
+  // Only used for connectivity and finger initialization
+  out_mdr.init(RV,
+               RF,
+               MeshDependentResource::kTree |
+                   MeshDependentResource::kIntersector);
 }
 
 void PassiveGripper::GenerateRemesh() {
@@ -57,13 +70,9 @@ void PassiveGripper::GenerateRemesh() {
   std::cerr << "Expanding mesh..." << std::endl;
   int s = ceil((p_max - p_min).maxCoeff() / kVoxelSize) + kPad * 2;
   igl::voxel_grid(Eigen::AlignedBox3d(p_min, p_max), s, kPad, GV, res);
-  Eigen::VectorXd S(GV.rows());
-#pragma omp parallel for
-  for (long long i = 0; i < GV.rows(); i++) {
-    double s_;
-    Eigen::RowVector3d c_;
-    S(i) = mdr_.ComputeSignedDistance(GV.row(i), c_, s_);
-  }
+  Eigen::VectorXd S;
+  Eigen::MatrixX3d C;
+  mdr_.ComputeSignedDistanceBatch(GV, S, C);
   Eigen::MatrixXd mc_V;
   Eigen::MatrixXi mc_F;
   igl::marching_cubes(S, GV, res(0), res(1), res(2), kExpandMesh, mc_V, mc_F);
@@ -74,29 +83,34 @@ void PassiveGripper::GenerateRemesh() {
     std::cerr << "Remesh failed! Defaulted to using original mesh" << std::endl;
   }
   std::cerr << "Remesh: V: " << RV.rows() << std::endl;
-  mdr_remeshed_.init(RV, RF);
-  mdr_remeshed_.GetSP();
-  InitMdrFloor(
-      mdr_remeshed_.V, mdr_remeshed_.F, settings_.contact.floor, mdr_contact_);
-}
-
-void PassiveGripper::SetMesh(const Eigen::MatrixXd& V,
-                             const Eigen::MatrixXi& F,
-                             const Eigen::MatrixXd& remesh_V,
-                             const Eigen::MatrixXi& remesh_F,
+  mdr_remeshed_ = std::make_shared<MeshDependentResource>();
+  mdr_remeshed_->init(RV, RF);
+  mdr_remeshed_->SetGeodesicCacheCapacity(settings_.cost.geodesic_cache_size);
+  InitMdrFloor(mdr_remeshed_->V,
+               mdr_remeshed_->F,
+               settings_.contact.floor,
+               mdr_contact_);
+}
+
+void PassiveGripper::SetMesh(const Eigen::Ref<const Eigen::MatrixXd>& V,
+                             const Eigen::Ref<const Eigen::MatrixXi>& F,
+                             const Eigen::Ref<const Eigen::MatrixXd>& remesh_V,
+                             const Eigen::Ref<const Eigen::MatrixXi>& remesh_F,
                              int remesh_version,
                              bool invalidate) {
-  mdr_.init(V, F);
+  mdr_.init(V, F, kOriginalMeshComponents);
 
   if (remesh_version != kRemeshVersion) {
     std::cerr << "Wrong remesh version. Expected: " << kRemeshVersion
               << " Got: " << remesh_version << ". Regenerating." << std::endl;
     GenerateRemesh();
   } else {
-    mdr_remeshed_.init(remesh_V, remesh_F);
-    mdr_remeshed_.GetSP();
-    InitMdrFloor(mdr_remeshed_.V,
-                 mdr_remeshed_.F,
+    mdr_remeshed_ = std::make_shared<MeshDependentResource>();
+    mdr_remeshed_->init(remesh_V, remesh_F);
+    mdr_remeshed_->SetGeodesicCacheCapacity(
+        settings_.cost.geodesic_cache_size);
+    InitMdrFloor(mdr_remeshed_->V,
+                 mdr_remeshed_->F,
                  settings_.contact.floor,
                  mdr_contact_);
   }
@@ -109,7 +123,7 @@ void PassiveGripper::SetMesh(const Eigen::MatrixXd& V,
 void PassiveGripper::SetMesh(const Eigen::MatrixXd& V,
                              const Eigen::MatrixXi& F,
                              bool invalidate) {
-  mdr_.init(V, F);
+  mdr_.init(V, F, kOriginalMeshComponents);
 
   GenerateRemesh();
 
@@ -228,6 +242,12 @@ void PassiveGripper::SetCostSettings(const CostSettings& settings) {
   Invalidate();
 }
 
+void PassiveGripper::SetQualitySettings(const QualitySettings& settings) {
+  settings_.quality = settings;
+  quality_settings_changed_ = true;
+  Invalidate();
+}
+
 void PassiveGripper::SetSettings(const GripperSettings& settings,
                                  bool invalidate) {
   settings_ = settings;
@@ -237,6 +257,7 @@ void PassiveGripper::SetSettings(const GripperSettings& settings,
   opt_settings_changed_ = true;
   topo_opt_settings_changed_ = true;
   cost_settings_changed_ = true;
+  quality_settings_changed_ = true;
   if (invalidate) Invalidate();
 }
 
@@ -265,12 +286,90 @@ void PassiveGripper::InitGripperBound() {
   Invalidate();
 }
 
+// Serialization
+
+void PassiveGripper::Write(std::ostream& f, int version, bool checksum) const {
+  if (version == 2) {
+    SERIALIZE(version);
+    SERIALIZE(mdr_.V);
+    SERIALIZE(mdr_.F);
+    SERIALIZE(params_);
+    SERIALIZE(settings_);
+    SERIALIZE(kRemeshVersion);
+    SERIALIZE(mdr_remeshed_->V);
+    SERIALIZE(mdr_remeshed_->F);
+  } else if (version == 3) {
+    serialization::ContainerWriter writer(f, version, checksum);
+    writer.AddMatrix(kChunkV, mdr_.V);
+    writer.AddMatrix(kChunkF, mdr_.F);
+    writer.AddObject(kChunkParams, params_);
+    writer.AddObject(kChunkSettings, settings_);
+    writer.AddObject(kChunkRemeshVersion, kRemeshVersion);
+    writer.AddMatrix(kChunkRemeshV, mdr_remeshed_->V);
+    writer.AddMatrix(kChunkRemeshF, mdr_remeshed_->F);
+    writer.Finish();
+  } else {
+    throw std::invalid_argument("Cannot write psg version " +
+                                std::to_string(version));
+  }
+}
+
+void PassiveGripper::Read(const serialization::ContainerReader& reader) {
+  GripperParams params;
+  GripperSettings settings;
+  int remesh_version;
+  reader.GetObject(kChunkParams, params);
+  reader.GetObject(kChunkSettings, settings);
+  reader.GetObject(kChunkRemeshVersion, remesh_version);
+  // The meshes are copied once, straight from the container
+  SetMesh(reader.GetMatrix<double>(kChunkV),
+          reader.GetMatrix<int>(kChunkF),
+          reader.GetMatrix<double>(kChunkRemeshV),
+          reader.GetMatrix<int>(kChunkRemeshF),
+          remesh_version);
+  SetSettings(settings);
+  SetParams(params);
+}
+
+void PassiveGripper::ReadContainer(std::istream& f) {
+  // The header starts with the version
+  f.seekg(-std::streamoff(sizeof(int32_t)), std::ios::cur);
+  std::vector<char> buf(sizeof(serialization::ContainerHeader));
+  if (!f.read(buf.data(), buf.size()) ||
+      !serialization::ContainerReader::IsContainer(buf.data(), buf.size())) {
+    throw std::runtime_error("Not a chunked container");
+  }
+  // The table of contents ends the container
+  serialization::ContainerHeader header;
+  std::memcpy(&header, buf.data(), sizeof(header));
+  if (header.toc_offset < sizeof(header)) {
+    throw std::runtime_error("Truncated table of contents");
+  }
+  buf.resize(header.toc_offset +
+             (size_t)header.n_chunks * sizeof(serialization::ChunkEntry));
+  if (!f.read(buf.data() + sizeof(header), buf.size() - sizeof(header))) {
+    throw std::runtime_error("Truncated container");
+  }
+  Read(serialization::ContainerReader(buf.data(), buf.size()));
+}
+
+void PassiveGripper::Load(const std::string& fn) {
+  serialization::MappedFile file(fn);
+  if (serialization::ContainerReader::IsContainer(file.GetData(),
+                                                  file.GetSize())) {
+    Read(serialization::ContainerReader(file.GetData(), file.GetSize()));
+  } else {
+    std::ifstream f(fn, std::ios::in | std::ios::binary);
+    Deserialize(f);
+  }
+}
+
 // State Invalidation
 
 // [] -> [Mesh]
 // [] -> [Settings]
 // [Mesh, ContactSettings] -> [Contact]
-// [Contact] -> [Quality]
+// [Contact, QualitySettings] -> [Quality]
 // [Contact, FingerSettings] -> [Finger]
 // [Finger, TrajectorySettings] -> [Trajectory]
 // [] -> [TopoOptSettings]
@@ -283,6 +382,7 @@ void PassiveGripper::Invalidate() {
   if (finger_settings_changed_) InvalidateFingerSettings();
   if (trajectory_settings_changed_) InvalidateTrajectorySettings();
   if (cost_settings_changed_) InvalidateCostSettings();
+  if (quality_settings_changed_) InvalidateQualitySettings();
   if (finger_changed_) InvalidateFinger();
   if (trajectory_changed_) InvalidateTrajectory();
   if (topo_opt_settings_changed_) InvalidateTopoOptSettings();
@@ -328,8 +428,8 @@ void PassiveGripper::InvalidateContactSettings() {
   // Update mdr_contact_;
   if (mdr_contact_floor_ != settings_.contact.floor) {
     mdr_contact_floor_ = settings_.contact.floor;
-    InitMdrFloor(mdr_remeshed_.V,
-                 mdr_remeshed_.F,
+    InitMdrFloor(mdr_remeshed_->V,
+                 mdr_remeshed_->F,
                  settings_.contact.floor,
                  mdr_contact_);
   }
@@ -347,9 +447,15 @@ void PassiveGripper::InvalidateTrajectorySettings() {
 
 void PassiveGripper::InvalidateCostSettings() {
   cost_settings_changed_ = false;
+  mdr_remeshed_->SetGeodesicCacheCapacity(settings_.cost.geodesic_cache_size);
   cost_changed_ = true;
 }
 
+void PassiveGripper::InvalidateQualitySettings() {
+  quality_settings_changed_ = false;
+  quality_changed_ = true;
+}
+
 void PassiveGripper::InvalidateContact() {
   contact_changed_ = false;
 
@@ -396,26 +502,23 @@ void PassiveGripper::InvalidateTopoOptSettings() {
 
 void PassiveGripper::InvalidateQuality() {
   quality_changed_ = false;
-  is_force_closure_ = CheckForceClosureQP(contact_cones_, mdr_.center_of_mass);
-  is_partial_closure_ = CheckPartialClosureQP(contact_cones_,
-                                              mdr_.center_of_mass,
-                                              -Eigen::Vector3d::UnitY(),
-                                              Eigen::Vector3d::Zero());
-  min_wrench_ = ComputeMinWrenchQP(contact_cones_, mdr_.center_of_mass);
-  partial_min_wrench_ = ComputePartialMinWrenchQP(contact_cones_,
-                                                  mdr_.center_of_mass,
-                                                  -Eigen::Vector3d::UnitY(),
-                                                  Eigen::Vector3d::Zero());
+  GraspAnalysis analysis(contact_cones_,
+                         mdr_.center_of_mass,
+                         -Eigen::Vector3d::UnitY(),
+                         Eigen::Vector3d::Zero(),
+                         settings_.quality);
+  is_force_closure_ = analysis.IsForceClosure();
+  is_partial_closure_ = analysis.IsPartialClosure();
+  min_wrench_ = analysis.GetMinWrench();
+  partial_min_wrench_ = analysis.GetPartialMinWrench();
 }
 
 void PassiveGripper::InvalidateCost() {
   cost_changed_ = false;
   cost_ = kCostFunctions[(int)settings_.cost.cost_function].cost_function(
-      params_, params_, settings_, mdr_remeshed_, dCost_dParam_, nullptr);
-  min_dist_ = MinDistance(params_, settings_, mdr_remeshed_);
-  // intersecting_ = Intersects(params_, settings_, mdr_); // TODO: Fails with
-  // duplicate trajectory
-  intersecting_ = true;
+      params_, params_, settings_, *mdr_remeshed_, dCost_dParam_, nullptr);
+  min_dist_ = MinDistance(params_, settings_, *mdr_remeshed_);
+  intersecting_ = Intersects(params_, settings_, mdr_);
   InvokeInvalidated(InvalidatedReason::kCost);
 }
 
@@ -2,6 +2,10 @@
 
 #include <Eigen/Core>
 #include <functional>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <string>
 #include <vector>
 
 #include "models/ContactPoint.h"
@@ -9,6 +13,7 @@
 #include "models/GripperSettings.h"
 #include "models/MeshDependentResource.h"
 #include "robots/Robots.h"
+#include "serialization/Container.h"
 #include "serialization/Serialization.h"
 
 namespace psg {
@@ -38,10 +43,10 @@ class PassiveGripper : public psg::core::serialization::Serializable {
   // Mesh
   static constexpr int kRemeshVersion = 1;
   void GenerateRemesh();
-  void SetMesh(const Eigen::MatrixXd& V,
-               const Eigen::MatrixXi& F,
-               const Eigen::MatrixXd& remesh_V,
-               const Eigen::MatrixXi& remesh_F,
+  void SetMesh(const Eigen::Ref<const Eigen::MatrixXd>& V,
+               const Eigen::Ref<const Eigen::MatrixXi>& F,
+               const Eigen::Ref<const Eigen::MatrixXd>& remesh_V,
+               const Eigen::Ref<const Eigen::MatrixXi>& remesh_F,
                int remesh_version,
                bool invalidate = true);
   void SetMesh(const Eigen::MatrixXd& V,
@@ -78,6 +83,7 @@ class PassiveGripper : public psg::core::serialization::Serializable {
   void SetOptSettings(const OptSettings& settings);
   void SetTopoOptSettings(const TopoOptSettings& settings);
   void SetCostSettings(const CostSettings& settings);
+  void SetQualitySettings(const QualitySettings& settings);
   void SetSettings(const GripperSettings& settings, bool invalidate = true);
 
   // Params
@@ -97,7 +103,10 @@ class PassiveGripper : public psg::core::serialization::Serializable {
   Eigen::Affine3d mesh_trans_;
 
   // remesh'd
-  MeshDependentResource mdr_remeshed_;
+  // Replaced rather than reinitialized when the mesh changes, so that
+  // optimizers can keep using the previous one
+  std::shared_ptr<MeshDependentResource> mdr_remeshed_ =
+      std::make_shared<MeshDependentResource>();
 
   // mdr with contact floor
   MeshDependentResource mdr_contact_;
@@ -123,6 +132,7 @@ class PassiveGripper : public psg::core::serialization::Serializable {
   bool opt_settings_changed_ = false;
   bool topo_opt_settings_changed_ = false;
   bool cost_settings_changed_ = false;
+  bool quality_settings_changed_ = false;
   bool contact_changed_ = false;
   bool finger_changed_ = false;
   bool trajectory_changed_ = false;
@@ -140,6 +150,7 @@ class PassiveGripper : public psg::core::serialization::Serializable {
   void InvalidateFingerSettings();
   void InvalidateTrajectorySettings();
   void InvalidateCostSettings();
+  void InvalidateQualitySettings();
   void InvalidateContact();
   void InvalidateFinger();
   void InvalidateTrajectory();
@@ -147,6 +158,10 @@ class PassiveGripper : public psg::core::serialization::Serializable {
   void InvalidateQuality();
   void InvalidateCost();
 
+  // Version 3 from a stream positioned after the version. Leaves the stream
+  // positioned after the container.
+  void ReadContainer(std::istream& f);
+
  public:
   DECLARE_GETTER(GetCenterOfMass, mdr_.center_of_mass)
   DECLARE_GETTER(GetMeshV, mdr_.V)
@@ -162,6 +177,7 @@ class PassiveGripper : public psg::core::serialization::Serializable {
   DECLARE_GETTER(GetOptSettings, settings_.opt)
   DECLARE_GETTER(GetTopoOptSettings, settings_.topo_opt)
   DECLARE_GETTER(GetCostSettings, settings_.cost)
+  DECLARE_GETTER(GetQualitySettings, settings_.quality)
   DECLARE_GETTER(GetIsForceClosure, is_force_closure_)
   DECLARE_GETTER(GetIsPartialClosure, is_partial_closure_)
   DECLARE_GETTER(GetMinWrench, min_wrench_)
@@ -174,19 +190,37 @@ class PassiveGripper : public psg::core::serialization::Serializable {
   DECLARE_GETTER(GetSettings, settings_)
   DECLARE_GETTER(GetMDR, mdr_)
   DECLARE_GETTER(GetFloorMDR, mdr_contact_)
-  DECLARE_GETTER(GetRemeshedMDR, mdr_remeshed_)
-
-  DECL_SERIALIZE() {
-    constexpr int version = 2;
-    SERIALIZE(version);
-    SERIALIZE(GetMDR().V);
-    SERIALIZE(GetMDR().F);
-    SERIALIZE(GetParams());
-    SERIALIZE(GetSettings());
-    SERIALIZE(kRemeshVersion);
-    SERIALIZE(GetRemeshedMDR().V);
-    SERIALIZE(GetRemeshedMDR().F);
+  inline const MeshDependentResource& GetRemeshedMDR() const {
+    return *mdr_remeshed_;
   }
+  // Immutable, valid until released even if the mesh changes
+  inline std::shared_ptr<const MeshDependentResource> GetSharedRemeshedMDR()
+      const {
+    return mdr_remeshed_;
+  }
+
+  // Serialization
+  // Version 3 is a chunked container (see serialization/Container.h) whose
+  // mesh blocks can be read in place
+  static constexpr int kSerializeVersion = 3;
+  // Chunks of version 3
+  static constexpr uint32_t kChunkV = serialization::MakeChunkTag("MSHV");
+  static constexpr uint32_t kChunkF = serialization::MakeChunkTag("MSHF");
+  static constexpr uint32_t kChunkParams = serialization::MakeChunkTag("PARM");
+  static constexpr uint32_t kChunkSettings =
+      serialization::MakeChunkTag("STNG");
+  static constexpr uint32_t kChunkRemeshVersion =
+      serialization::MakeChunkTag("RMVN");
+  static constexpr uint32_t kChunkRemeshV = serialization::MakeChunkTag("RMSV");
+  static constexpr uint32_t kChunkRemeshF = serialization::MakeChunkTag("RMSF");
+  // version: 2 or 3
+  // checksum: store chunk checksums, version 3 only
+  void Write(std::ostream& f, int version, bool checksum) const;
+  void Read(const serialization::ContainerReader& reader);
+  // Reads any version, memory mapping version 3 files
+  void Load(const std::string& fn);
+
+  DECL_SERIALIZE() { Write(f, kSerializeVersion, true); }
 
   DECL_DESERIALIZE() {
     int version;
@@ -217,6 +251,8 @@ class PassiveGripper : public psg::core::serialization::Serializable {
       SetMesh(V, F, RV, RF, remesh_version);
       SetSettings(settings);
       SetParams(params);
+    } else if (version == 3) {
+      ReadContainer(f);
     }
   }
 };
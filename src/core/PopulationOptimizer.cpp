@@ -0,0 +1,171 @@
+#include "PopulationOptimizer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <numeric>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace psg {
+namespace core {
+
+PopulationOptimizer::PopulationOptimizer(int dimension,
+                                         size_t population,
+                                         int batch_size,
+                                         const double* lb,
+                                         const double* ub,
+                                         unsigned seed)
+    : dimension_(dimension),
+      population_(population > 0 ? population : 10 * (dimension + 1)),
+      batch_size_(std::max(batch_size, 1)),
+      lb_(Eigen::Map<const Eigen::VectorXd>(lb, dimension)),
+      ub_(Eigen::Map<const Eigen::VectorXd>(ub, dimension)),
+      gen_(seed) {
+  // Reflection needs dimension + 1 distinct individuals
+  population_ = std::max<size_t>(population_, dimension + 2);
+}
+
+void PopulationOptimizer::Evaluate(const Objective& f,
+                                   const Eigen::MatrixXd& X,
+                                   double* out_f) {
+  const long long n = X.cols();
+#pragma omp parallel for num_threads(batch_size_) schedule(dynamic, 1)
+  for (long long i = 0; i < n; i++) {
+#ifdef _OPENMP
+    int thread = omp_get_thread_num();
+#else
+    int thread = 0;
+#endif
+    out_f[i] = f(X.col(i).data(), thread);
+  }
+}
+
+Eigen::VectorXd PopulationOptimizer::GenerateTrial(size_t best) {
+  std::uniform_int_distribution<size_t> pick(0, population_ - 1);
+  std::uniform_real_distribution<double> unit(0., 1.);
+
+  // Reflect the last of n + 1 random individuals (the first being the best)
+  // through the centroid of the others
+  std::vector<size_t> ids;
+  ids.reserve(dimension_ + 1);
+  ids.push_back(best);
+  while (ids.size() < (size_t)dimension_ + 1) {
+    size_t id = pick(gen_);
+    if (std::find(ids.begin(), ids.end(), id) == ids.end()) ids.push_back(id);
+  }
+  Eigen::VectorXd centroid = Eigen::VectorXd::Zero(dimension_);
+  for (size_t k = 0; k < ids.size() - 1; k++) {
+    centroid += X_.col(ids[k]);
+  }
+  centroid /= (double)(ids.size() - 1);
+  Eigen::VectorXd trial = 2. * centroid - X_.col(ids.back());
+  if ((trial.array() >= lb_.array()).all() &&
+      (trial.array() <= ub_.array()).all()) {
+    return trial;
+  }
+
+  // Local mutation around the best individual
+  size_t other = pick(gen_);
+  for (int j = 0; j < dimension_; j++) {
+    double w = unit(gen_);
+    trial(j) = (1. + w) * X_(j, best) - w * X_(j, other);
+  }
+  return trial.cwiseMax(lb_).cwiseMin(ub_);
+}
+
+nlopt_result PopulationOptimizer::Optimize(const Objective& f,
+                                           const StopCriteria& stop,
+                                           double* x,
+                                           double& out_min_f) {
+  force_stop_ = false;
+  auto start_time = std::chrono::high_resolution_clock::now();
+  long long n_evals = 0;
+  nlopt_result result = NLOPT_SUCCESS;
+
+  auto Elapsed = [&start_time]() -> double {
+    return std::chrono::duration<double>(
+               std::chrono::high_resolution_clock::now() - start_time)
+        .count();
+  };
+
+  if (!initialized_) {
+    // The initial guess and uniform samples within the bounds
+    std::uniform_real_distribution<double> unit(0., 1.);
+    X_.resize(dimension_, population_);
+    X_.col(0) = Eigen::Map<const Eigen::VectorXd>(x, dimension_);
+    for (size_t i = 1; i < population_; i++) {
+      for (int j = 0; j < dimension_; j++) {
+        X_(j, i) = lb_(j) + unit(gen_) * (ub_(j) - lb_(j));
+      }
+    }
+    f_.resize(population_);
+    Evaluate(f, X_, f_.data());
+    n_evals += population_;
+    initialized_ = true;
+  }
+
+  Eigen::MatrixXd trials(dimension_, batch_size_);
+  Eigen::VectorXd trials_f(batch_size_);
+  std::vector<int> order(batch_size_);
+  while (true) {
+    size_t best;
+    size_t worst;
+    f_.minCoeff(&best);
+    f_.maxCoeff(&worst);
+
+    if (force_stop_) {
+      result = NLOPT_FORCED_STOP;
+      break;
+    }
+    if (f_(best) <= stop.stopval) {
+      result = NLOPT_STOPVAL_REACHED;
+      break;
+    }
+    if (stop.max_evals > 0 && n_evals >= stop.max_evals) {
+      result = NLOPT_MAXEVAL_REACHED;
+      break;
+    }
+    if (stop.max_runtime > 0 && Elapsed() >= stop.max_runtime) {
+      result = NLOPT_MAXTIME_REACHED;
+      break;
+    }
+    if ((stop.ftol_rel > 0 || stop.ftol_abs > 0) &&
+        f_(worst) - f_(best) <=
+            stop.ftol_rel * std::abs(f_(best)) + stop.ftol_abs) {
+      result = NLOPT_FTOL_REACHED;
+      break;
+    }
+
+    for (int i = 0; i < batch_size_; i++) {
+      trials.col(i) = GenerateTrial(best);
+    }
+    Evaluate(f, trials, trials_f.data());
+    n_evals += batch_size_;
+
+    // Replace the worst individuals, best trials first
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&trials_f](int a, int b) {
+      return trials_f(a) < trials_f(b);
+    });
+    for (int i : order) {
+      f_.maxCoeff(&worst);
+      if (!(trials_f(i) < f_(worst))) break;
+      X_.col(worst) = trials.col(i);
+      f_(worst) = trials_f(i);
+    }
+  }
+
+  size_t best;
+  out_min_f = f_.minCoeff(&best);
+  Eigen::Map<Eigen::VectorXd>(x, dimension_) = X_.col(best);
+  return result;
+}
+
+void PopulationOptimizer::Reevaluate(const Objective& f) {
+  if (!initialized_) return;
+  Evaluate(f, X_, f_.data());
+}
+
+}  // namespace core
+}  // namespace psg
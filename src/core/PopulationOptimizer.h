@@ -0,0 +1,72 @@
+#pragma once
+
+#include <nlopt.h>
+#include <Eigen/Core>
+#include <atomic>
+#include <functional>
+#include <random>
+#include <vector>
+
+namespace psg {
+namespace core {
+
+// Controlled random search with local mutation (CRS2-LM) that generates a
+// whole batch of trial points per iteration and evaluates them concurrently,
+// one evaluation per thread. The population is kept between calls to
+// Optimize so that a stopped run can be resumed.
+class PopulationOptimizer {
+ public:
+  // thread: index of the calling thread in [0, batch_size)
+  typedef std::function<double(const double* x, int thread)> Objective;
+
+  struct StopCriteria {
+    long long max_evals = 0;  // 0: unlimited
+    double max_runtime = 0;   // seconds, 0: unlimited
+    double stopval = -std::numeric_limits<double>::infinity();
+    double ftol_rel = 0;
+    double ftol_abs = 0;
+  };
+
+  // population: 0 to use 10 * (dimension + 1) like NLopt
+  PopulationOptimizer(int dimension,
+                      size_t population,
+                      int batch_size,
+                      const double* lb,
+                      const double* ub,
+                      unsigned seed = 0);
+
+  // x: initial guess on the first call, best point upon return
+  nlopt_result Optimize(const Objective& f,
+                        const StopCriteria& stop,
+                        double* x,
+                        double& out_min_f);
+
+  // Evaluates the population again, e.g. after the objective changed
+  void Reevaluate(const Objective& f);
+
+  // Can be called from any thread, including from the objective
+  inline void ForceStop() { force_stop_ = true; }
+
+  inline int GetBatchSize() const { return batch_size_; }
+
+ private:
+  int dimension_;
+  size_t population_;
+  int batch_size_;
+  Eigen::VectorXd lb_;
+  Eigen::VectorXd ub_;
+  std::mt19937 gen_;
+  std::atomic_bool force_stop_ = false;
+
+  bool initialized_ = false;
+  // One individual per column
+  Eigen::MatrixXd X_;
+  Eigen::VectorXd f_;
+
+  // Evaluates every column of X concurrently
+  void Evaluate(const Objective& f, const Eigen::MatrixXd& X, double* out_f);
+  Eigen::VectorXd GenerateTrial(size_t best);
+};
+
+}  // namespace core
+}  // namespace psg
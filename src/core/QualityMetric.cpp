@@ -2,6 +2,10 @@
 
 #include <CGAL/QP_functions.h>
 #include <CGAL/QP_models.h>
+#include <Eigen/QR>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
 #include <utility>
 
 #include "GeometryUtils.h"
@@ -32,7 +36,8 @@ static Eigen::MatrixXd CreateGraspMatrix(
   return G;
 }
 
-static CGAL::Quotient<ET> MinNormVectorInFacet(const Eigen::MatrixXd& facet) {
+static CGAL::Quotient<ET> MinNormVectorInFacetExact(
+    const Eigen::MatrixXd& facet) {
   typedef CGAL::Quadratic_program<double> Program;
   typedef CGAL::Quadratic_program_solution<ET> Solution;
 
@@ -62,7 +67,7 @@ static CGAL::Quotient<ET> MinNormVectorInFacet(const Eigen::MatrixXd& facet) {
   return s.objective_value();
 }
 
-static CGAL::Quotient<ET> WrenchInPositiveSpan(
+static CGAL::Quotient<ET> WrenchInPositiveSpanExact(
     const Eigen::MatrixXd& wrenchBasis,
     const Eigen::VectorXd& targetWrench) {
   typedef CGAL::Quadratic_program<double> Program;
@@ -108,106 +113,478 @@ static CGAL::Quotient<ET> WrenchInPositiveSpan(
   return s.objective_value() * 2 + targetWrench.squaredNorm();
 }
 
-bool CheckForceClosureQP(const std::vector<ContactPoint>& contactCones,
-                         const Eigen::Vector3d& centerOfMass) {
-  Eigen::MatrixXd G = CreateGraspMatrix(contactCones, centerOfMass);
-  return MinNormVectorInFacet(G) < kWrenchNormThresh;
+// Double precision solvers of the same programs. The facet is augmented
+// with sqrt(kWrenchReg) * I so that the regularization becomes part of the
+// norm: |P x|^2 = x'(facet'facet + kWrenchReg I)x.
+static Eigen::MatrixXd AugmentWithReg(const Eigen::MatrixXd& facet) {
+  Eigen::MatrixXd P(facet.rows() + facet.cols(), facet.cols());
+  P.topRows(facet.rows()) = facet;
+  P.bottomRows(facet.cols()).setIdentity();
+  P.bottomRows(facet.cols()) *= std::sqrt(kWrenchReg);
+  return P;
 }
 
-bool CheckPartialClosureQP(const std::vector<ContactPoint>& contactCones,
-                           const Eigen::Vector3d& centerOfMass,
-                           const Eigen::Vector3d& extForce,
-                           const Eigen::Vector3d& extTorque) {
-  Eigen::MatrixXd G = CreateGraspMatrix(contactCones, centerOfMass);
-  Eigen::VectorXd targetWrench(6);
-  targetWrench.block<3, 1>(0, 0) = -extForce;
-  targetWrench.block<3, 1>(3, 0) = -extTorque;
-  return WrenchInPositiveSpan(G, targetWrench) < kWrenchNormThresh;
+// Weights of the point of minimum norm in the affine hull of the columns S
+// of P
+static Eigen::VectorXd AffineMinNorm(const Eigen::MatrixXd& P,
+                                     const std::vector<Eigen::Index>& S) {
+  Eigen::VectorXd alpha(S.size());
+  if (S.size() == 1) {
+    alpha(0) = 1;
+    return alpha;
+  }
+  // y = p_0 + D mu
+  Eigen::MatrixXd D(P.rows(), S.size() - 1);
+  for (size_t i = 1; i < S.size(); i++) {
+    D.col(i - 1) = P.col(S[i]) - P.col(S[0]);
+  }
+  Eigen::VectorXd mu = D.colPivHouseholderQr().solve(-P.col(S[0]));
+  alpha(0) = 1 - mu.sum();
+  alpha.tail(mu.size()) = mu;
+  return alpha;
 }
 
-double ComputeMinWrenchQP(const std::vector<ContactPoint>& contactCones,
-                          const Eigen::Vector3d& centerOfMass) {
-  Eigen::MatrixXd G = CreateGraspMatrix(contactCones, centerOfMass);
-  if (MinNormVectorInFacet(G) >= kWrenchNormThresh) {
+// Wolfe's algorithm for the point of minimum norm in the convex hull of the
+// facet. Returns its squared norm, like MinNormVectorInFacetExact.
+static double MinNormVectorInFacetFast(const Eigen::MatrixXd& facet) {
+  const Eigen::MatrixXd P = AugmentWithReg(facet);
+  const Eigen::VectorXd norms = P.colwise().squaredNorm();
+  const double tol = 1e-12 * norms.maxCoeff();
+  const int max_iterations = 10 * (int)P.cols() + 100;
+
+  // Corral, its weights and the current point
+  std::vector<Eigen::Index> S(1);
+  norms.minCoeff(&S[0]);
+  Eigen::VectorXd lambda = Eigen::VectorXd::Ones(1);
+  Eigen::VectorXd x = P.col(S[0]);
+
+  for (int it = 0; it < max_iterations; it++) {
+    Eigen::Index j;
+    (P.transpose() * x).minCoeff(&j);
+    if (x.squaredNorm() - x.dot(P.col(j)) <= tol) break;
+    // No progress left in double precision
+    if (std::find(S.begin(), S.end(), j) != S.end()) break;
+    S.push_back(j);
+    lambda.conservativeResize(S.size());
+    lambda(S.size() - 1) = 0;
+
+    while (true) {
+      Eigen::VectorXd alpha = AffineMinNorm(P, S);
+      if ((alpha.array() > 0).all()) {
+        lambda = alpha;
+        break;
+      }
+      // Move towards alpha until a weight reaches zero
+      double theta = 1;
+      size_t k = 0;
+      for (size_t i = 0; i < S.size(); i++) {
+        if (alpha(i) > 0) continue;
+        double d = lambda(i) - alpha(i);
+        double t = d > 0 ? lambda(i) / d : 0;
+        if (t < theta) {
+          theta = t;
+          k = i;
+        }
+      }
+      lambda = (1 - theta) * lambda + theta * alpha;
+      lambda(k) = 0;
+      // Drop the points with zero weight
+      size_t n = 0;
+      for (size_t i = 0; i < S.size(); i++) {
+        if (lambda(i) > 0) {
+          S[n] = S[i];
+          lambda(n) = lambda(i);
+          n++;
+        }
+      }
+      S.resize(n);
+      lambda.conservativeResize(n);
+    }
+
+    x.setZero();
+    for (size_t i = 0; i < S.size(); i++) x += lambda(i) * P.col(S[i]);
+  }
+  return x.squaredNorm();
+}
+
+// Lawson-Hanson non-negative least squares. Returns the squared residual,
+// like WrenchInPositiveSpanExact.
+static double WrenchInPositiveSpanFast(const Eigen::MatrixXd& wrenchBasis,
+                                       const Eigen::VectorXd& targetWrench) {
+  const Eigen::MatrixXd A = AugmentWithReg(wrenchBasis);
+  Eigen::VectorXd b = Eigen::VectorXd::Zero(A.rows());
+  b.head(targetWrench.size()) = targetWrench;
+  const Eigen::Index n = A.cols();
+  const double tol = 1e-12 * std::max(1., A.colwise().norm().maxCoeff());
+  const int max_iterations = 3 * (int)n + 100;
+
+  Eigen::VectorXd x = Eigen::VectorXd::Zero(n);
+  std::vector<bool> passive(n, false);
+  // Columns whose solution was not positive when added
+  std::vector<bool> excluded(n, false);
+
+  for (int it = 0; it < max_iterations; it++) {
+    Eigen::VectorXd w = A.transpose() * (b - A * x);
+    Eigen::Index j = -1;
+    for (Eigen::Index i = 0; i < n; i++) {
+      if (passive[i] || excluded[i] || w(i) <= tol) continue;
+      if (j == -1 || w(i) > w(j)) j = i;
+    }
+    if (j == -1) break;
+    passive[j] = true;
+
+    bool first = true;
+    while (true) {
+      std::vector<Eigen::Index> P;
+      for (Eigen::Index i = 0; i < n; i++) {
+        if (passive[i]) P.push_back(i);
+      }
+      if (P.empty()) {
+        x.setZero();
+        break;
+      }
+      Eigen::MatrixXd AP(A.rows(), P.size());
+      for (size_t i = 0; i < P.size(); i++) AP.col(i) = A.col(P[i]);
+      Eigen::VectorXd zP = AP.colPivHouseholderQr().solve(b);
+
+      Eigen::VectorXd z = Eigen::VectorXd::Zero(n);
+      bool positive = true;
+      for (size_t i = 0; i < P.size(); i++) {
+        z(P[i]) = zP(i);
+        positive &= zP(i) > 0;
+      }
+      if (positive) {
+        x = z;
+        break;
+      }
+      if (first && z(j) <= 0) {
+        // Rounding, the column does not decrease the residual
+        passive[j] = false;
+        excluded[j] = true;
+        break;
+      }
+      first = false;
+      // Move towards z until a coefficient reaches zero
+      double theta = 1;
+      Eigen::Index k = P[0];
+      for (Eigen::Index i : P) {
+        if (z(i) > 0) continue;
+        double t = x(i) / (x(i) - z(i));
+        if (t < theta) {
+          theta = t;
+          k = i;
+        }
+      }
+      x += theta * (z - x);
+      x(k) = 0;
+      for (Eigen::Index i : P) {
+        if (x(i) <= 0) {
+          x(i) = 0;
+          passive[i] = false;
+        }
+      }
+    }
+  }
+  return (A * x - b).squaredNorm();
+}
+
+// Cross-check
+static std::atomic<size_t> n_cross_checks(0);
+static std::atomic<size_t> n_cross_check_disagreements(0);
+static std::atomic<size_t> n_prune_checks(0);
+static std::atomic<size_t> n_prune_disagreements(0);
+
+bool QPValuesDisagree(double value, double reference) {
+  return (value < kWrenchNormThresh) != (reference < kWrenchNormThresh) ||
+         std::abs(value - reference) >
+             kQPCrossCheckTol *
+                 std::max(std::abs(reference), kWrenchNormThresh);
+}
+
+// Against the other solver
+static void CrossCheck(double value, double reference) {
+  n_cross_checks++;
+  if (QPValuesDisagree(value, reference)) n_cross_check_disagreements++;
+}
+
+// Against the full facet scan
+static void PruneCheck(double value, double reference) {
+  n_prune_checks++;
+  if (QPValuesDisagree(value, reference)) n_prune_disagreements++;
+}
+
+QPCrossCheckStats GetQPCrossCheckStats() {
+  QPCrossCheckStats stats;
+  stats.n_checks = n_cross_checks;
+  stats.n_disagreements = n_cross_check_disagreements;
+  stats.n_prune_checks = n_prune_checks;
+  stats.n_prune_disagreements = n_prune_disagreements;
+  return stats;
+}
+
+void ResetQPCrossCheckStats() {
+  n_cross_checks = 0;
+  n_cross_check_disagreements = 0;
+  n_prune_checks = 0;
+  n_prune_disagreements = 0;
+}
+
+static double MinNormVectorInFacet(const Eigen::MatrixXd& facet,
+                                   const QualitySettings& settings) {
+  bool fast = settings.qp_solver == QPSolverEnum::kFast;
+  double value = fast ? MinNormVectorInFacetFast(facet)
+                      : CGAL::to_double(MinNormVectorInFacetExact(facet));
+  if (settings.qp_cross_check) {
+    CrossCheck(value,
+               fast ? CGAL::to_double(MinNormVectorInFacetExact(facet))
+                    : MinNormVectorInFacetFast(facet));
+  }
+  return value;
+}
+
+static double WrenchInPositiveSpan(const Eigen::MatrixXd& wrenchBasis,
+                                   const Eigen::VectorXd& targetWrench,
+                                   const QualitySettings& settings) {
+  bool fast = settings.qp_solver == QPSolverEnum::kFast;
+  double value =
+      fast ? WrenchInPositiveSpanFast(wrenchBasis, targetWrench)
+           : CGAL::to_double(
+                 WrenchInPositiveSpanExact(wrenchBasis, targetWrench));
+  if (settings.qp_cross_check) {
+    CrossCheck(value,
+               fast ? CGAL::to_double(
+                          WrenchInPositiveSpanExact(wrenchBasis, targetWrench))
+                    : WrenchInPositiveSpanFast(wrenchBasis, targetWrench));
+  }
+  return value;
+}
+
+// GraspAnalysis
+
+GraspAnalysis::GraspAnalysis(const std::vector<ContactPoint>& contactCones,
+                             const Eigen::Vector3d& centerOfMass,
+                             const Eigen::Vector3d& extForce,
+                             const Eigen::Vector3d& extTorque,
+                             const QualitySettings& settings)
+    : G_(CreateGraspMatrix(contactCones, centerOfMass)),
+      target_wrench_(6),
+      settings_(settings) {
+  target_wrench_.block<3, 1>(0, 0) = -extForce;
+  target_wrench_.block<3, 1>(3, 0) = -extTorque;
+}
+
+bool GraspAnalysis::IsForceClosure() const {
+  if (!closure_valid_) {
+    closure_dist_ = MinNormVectorInFacet(G_, settings_);
+    closure_valid_ = true;
+  }
+  return closure_dist_ < kWrenchNormThresh;
+}
+
+bool GraspAnalysis::IsPartialClosure() const {
+  if (!partial_closure_valid_) {
+    partial_closure_dist_ = WrenchInPositiveSpan(G_, target_wrench_, settings_);
+    partial_closure_valid_ = true;
+  }
+  return partial_closure_dist_ < kWrenchNormThresh;
+}
+
+void GraspAnalysis::InitHull() const {
+  if (hull_valid_) return;
+  hull_valid_ = true;
+  // Hull of the wrenches and zero
+  Eigen::MatrixXd V(G_.cols() + 1, 6);
+  V.block(1, 0, G_.cols(), 6) = G_.transpose();
+  V.row(0).setZero();
+  std::vector<size_t> hullIndices;
+  hull_ok_ = ComputeConvexHull(V, hullIndices, hull_facets_, &hull_planes_);
+  zero_on_hull_ = std::find(hullIndices.begin(), hullIndices.end(), 0) !=
+                  hullIndices.end();
+}
+
+// Order in which to visit the facets. With prune, by increasing squared
+// distance from target to their hyperplane, written to out_bounds. It is a
+// lower bound of the squared distance to the facet, and thus of the value
+// of its program.
+static std::vector<size_t> GetFacetOrder(const Eigen::MatrixXd& planes,
+                                         const Eigen::VectorXd& target,
+                                         bool prune,
+                                         Eigen::VectorXd& out_bounds) {
+  std::vector<size_t> order(planes.rows());
+  for (size_t i = 0; i < order.size(); i++) order[i] = i;
+  if (!prune) return order;
+  out_bounds =
+      (planes.leftCols(6) * target + planes.col(6)).array().square().matrix();
+  // Margin for the rounding of the hyperplanes
+  out_bounds *= 1 - 1e-9;
+  std::sort(order.begin(), order.end(), [&out_bounds](size_t a, size_t b) {
+    return out_bounds(a) < out_bounds(b);
+  });
+  return order;
+}
+
+double GraspAnalysis::GetMinWrench() const {
+  if (!IsForceClosure()) {
     // Zero not in convex hull
     return 0;
   }
+  double minDist = ScanMinWrench(settings_.prune_facets);
+  if (settings_.prune_facets && settings_.qp_cross_check) {
+    PruneCheck(minDist, ScanMinWrench(false));
+  }
+  return minDist;
+}
 
+double GraspAnalysis::ScanMinWrench(bool prune) const {
   // Compute Convex Hull
-  std::vector<size_t> hullIndices;
-  std::vector<std::vector<size_t>> facets;
-  if (ComputeConvexHull(G.transpose(), hullIndices, facets)) {
-    CGAL::Quotient<ET> minDist;
-    bool valid = false;
-    // Compare against every facet
-    for (const auto& facet : facets) {
-      Eigen::MatrixXd F(6, facet.size());
-      for (size_t i = 0; i < facet.size(); i++) {
-        F.col(i) = G.col(facet[i]);
-      }
-      auto dist = MinNormVectorInFacet(F);
-      if (!valid || dist < minDist) {
-        minDist = dist;
-        valid = true;
-      }
+  // Adding zero only changes the hull if zero is a vertex of it. If the hull
+  // with zero cannot be computed, neither can the one without.
+  InitHull();
+  if (!hull_ok_) return 0;
+  std::vector<std::vector<size_t>> ownFacets;
+  Eigen::MatrixXd ownPlanes;
+  const std::vector<std::vector<size_t>>* facets = &hull_facets_;
+  const Eigen::MatrixXd* planes = &hull_planes_;
+  size_t offset = 1;
+  if (zero_on_hull_) {
+    std::vector<size_t> hullIndices;
+    if (!ComputeConvexHull(G_.transpose(), hullIndices, ownFacets, &ownPlanes))
+      return 0;
+    facets = &ownFacets;
+    planes = &ownPlanes;
+    offset = 0;
+  }
+
+  Eigen::VectorXd bounds;
+  std::vector<size_t> order =
+      GetFacetOrder(*planes, Eigen::VectorXd::Zero(6), prune, bounds);
+  double minDist = 0;
+  bool valid = false;
+  // Compare against every facet
+  for (size_t f : order) {
+    if (prune && valid && bounds(f) >= minDist) break;
+    const auto& facet = (*facets)[f];
+    Eigen::MatrixXd F(6, facet.size());
+    for (size_t i = 0; i < facet.size(); i++) {
+      F.col(i) = G_.col(facet[i] - offset);
+    }
+    double dist = MinNormVectorInFacet(F, settings_);
+    if (!valid || dist < minDist) {
+      minDist = dist;
+      valid = true;
     }
-    if (!valid) std::cout << "Error: empty facet" << std::endl;
-    return CGAL::to_double(minDist);
   }
-  return 0;
+  if (!valid) std::cout << "Error: empty facet" << std::endl;
+  return minDist;
 }
 
-double ComputePartialMinWrenchQP(const std::vector<ContactPoint>& contactCones,
-                                 const Eigen::Vector3d& centerOfMass,
-                                 const Eigen::Vector3d& extForce,
-                                 const Eigen::Vector3d& extTorque) {
-  Eigen::MatrixXd G = CreateGraspMatrix(contactCones, centerOfMass);
-  Eigen::VectorXd targetWrench(6);
-  targetWrench.block<3, 1>(0, 0) = -extForce;
-  targetWrench.block<3, 1>(3, 0) = -extTorque;
-  if (WrenchInPositiveSpan(G, targetWrench) >= kWrenchNormThresh) {
+double GraspAnalysis::GetPartialMinWrench() const {
+  if (!IsPartialClosure()) {
     // Not Partial Closure
     return 0.;
   }
+  double minDist = ScanPartialMinWrench(settings_.prune_facets);
+  if (settings_.prune_facets && settings_.qp_cross_check) {
+    PruneCheck(minDist, ScanPartialMinWrench(false));
+  }
+  return minDist;
+}
 
+double GraspAnalysis::ScanPartialMinWrench(bool prune) const {
   // Compute Convex Hull with Zero
-  Eigen::MatrixXd V(G.cols() + 1, 6);
-  V.block(1, 0, G.cols(), 6) = G.transpose();
-  V.row(0).setZero();
-  std::vector<size_t> hullIndices;
-  std::vector<std::vector<size_t>> facets;
-  if (ComputeConvexHull(V, hullIndices, facets)) {
-    CGAL::Quotient<ET> minDist;
-    bool valid = false;
-    // Check against every face with Zero
-    for (const auto& facet : facets) {
-      bool zeroInFacet = false;
-      for (size_t i : facet) {
-        if (i == 0) {
-          zeroInFacet = true;
-          break;
-        }
+  InitHull();
+  if (!hull_ok_) return 0.0;
+
+  // The hyperplanes of the facets with zero go through zero and contain the
+  // positive span of the facet
+  Eigen::VectorXd bounds;
+  std::vector<size_t> order =
+      GetFacetOrder(hull_planes_, target_wrench_, prune, bounds);
+  double minDist = 0;
+  bool valid = false;
+  // Check against every face with Zero
+  for (size_t f : order) {
+    if (prune && valid && bounds(f) >= minDist) break;
+    const auto& facet = hull_facets_[f];
+    bool zeroInFacet = false;
+    for (size_t i : facet) {
+      if (i == 0) {
+        zeroInFacet = true;
+        break;
       }
-      if (!zeroInFacet) continue;
+    }
+    if (!zeroInFacet) continue;
 
-      Eigen::MatrixXd F(6, facet.size() - 1);
-      size_t id = 0;
-      for (size_t i : facet) {
-        if (i == 0) continue;
-        F.col(id++) = G.col(i - 1);
-      }
-      auto dist = WrenchInPositiveSpan(F, targetWrench);
-      if (!valid || dist < minDist) {
-        minDist = dist;
-        valid = true;
-      }
+    Eigen::MatrixXd F(6, facet.size() - 1);
+    size_t id = 0;
+    for (size_t i : facet) {
+      if (i == 0) continue;
+      F.col(id++) = G_.col(i - 1);
+    }
+    double dist = WrenchInPositiveSpan(F, target_wrench_, settings_);
+    if (!valid || dist < minDist) {
+      minDist = dist;
+      valid = true;
     }
-    if (valid)
-      return CGAL::to_double(minDist);
-    else
-      return std::numeric_limits<double>::max();
   }
-  return 0.0;
+  if (valid)
+    return minDist;
+  else
+    return std::numeric_limits<double>::max();
+}
+
+bool CheckForceClosureQP(const std::vector<ContactPoint>& contactCones,
+                         const Eigen::Vector3d& centerOfMass,
+                         const QualitySettings& settings) {
+  return GraspAnalysis(contactCones,
+                       centerOfMass,
+                       Eigen::Vector3d::Zero(),
+                       Eigen::Vector3d::Zero(),
+                       settings)
+      .IsForceClosure();
+}
+
+bool CheckPartialClosureQP(const std::vector<ContactPoint>& contactCones,
+                           const Eigen::Vector3d& centerOfMass,
+                           const Eigen::Vector3d& extForce,
+                           const Eigen::Vector3d& extTorque,
+                           const QualitySettings& settings) {
+  return GraspAnalysis(
+             contactCones, centerOfMass, extForce, extTorque, settings)
+      .IsPartialClosure();
+}
+
+bool CheckForceOppositionQP(const std::vector<ContactPoint>& contactCones,
+                            const Eigen::Vector3d& extForce) {
+  // The force rows of the grasp matrix. The value of the program is at most
+  // that of the partial closure one, which has the torque rows as well.
+  Eigen::MatrixXd F(3, contactCones.size());
+  for (size_t i = 0; i < contactCones.size(); i++) {
+    F.col(i) = -contactCones[i].normal;
+  }
+  double dist = WrenchInPositiveSpanFast(F, -extForce);
+  return dist < kWrenchNormThresh * (1 + kQPCrossCheckTol);
+}
+
+double ComputeMinWrenchQP(const std::vector<ContactPoint>& contactCones,
+                          const Eigen::Vector3d& centerOfMass,
+                          const QualitySettings& settings) {
+  return GraspAnalysis(contactCones,
+                       centerOfMass,
+                       Eigen::Vector3d::Zero(),
+                       Eigen::Vector3d::Zero(),
+                       settings)
+      .GetMinWrench();
+}
+
+double ComputePartialMinWrenchQP(const std::vector<ContactPoint>& contactCones,
+                                 const Eigen::Vector3d& centerOfMass,
+                                 const Eigen::Vector3d& extForce,
+                                 const Eigen::Vector3d& extTorque,
+                                 const QualitySettings& settings) {
+  return GraspAnalysis(
+             contactCones, centerOfMass, extForce, extTorque, settings)
+      .GetPartialMinWrench();
 }
 
 using autodiff::real;
@@ -8,6 +8,7 @@
 #include "../Constants.h"
 #include "DiscreteDistanceField.h"
 #include "models/ContactPoint.h"
+#include "models/QualitySettings.h"
 
 namespace psg {
 namespace core {
@@ -17,10 +18,13 @@ using namespace models;
 // Source:
 // https://github.com/BerkeleyAutomation/dex-net/blob/master/src/dexnet/grasping/quality.py
 
+// The quadratic programs are solved with settings.qp_solver
+
 // Checks force closure by solving a quadratic program
 // (whether or not zero is in the convex hull)
 bool CheckForceClosureQP(const std::vector<ContactPoint>& contactCones,
-                         const Eigen::Vector3d& centerOfMass);
+                         const Eigen::Vector3d& centerOfMass,
+                         const QualitySettings& settings);
 
 // Evalutes partial closure: whether or not the forces and torques
 // can resist a specific wrench. Estimates resistance by solving a quadratic
@@ -28,17 +32,89 @@ bool CheckForceClosureQP(const std::vector<ContactPoint>& contactCones,
 bool CheckPartialClosureQP(const std::vector<ContactPoint>& contactCones,
                            const Eigen::Vector3d& centerOfMass,
                            const Eigen::Vector3d& extForce,
-                           const Eigen::Vector3d& extTorque);
+                           const Eigen::Vector3d& extTorque,
+                           const QualitySettings& settings);
 
 // Ferrari & Canny's L1 metric. Also known as the epsilon metric.
 double ComputeMinWrenchQP(const std::vector<ContactPoint>& contactCones,
-                          const Eigen::Vector3d& centerOfMass);
+                          const Eigen::Vector3d& centerOfMass,
+                          const QualitySettings& settings);
+
+// Necessary condition of CheckPartialClosureQP: whether the contact forces
+// alone, ignoring their torques, can resist extForce. A 3 dimensional
+// program, always solved with the fast solver with a margin on the
+// threshold, so that up to rounding it never rejects a grasp
+// CheckPartialClosureQP accepts.
+bool CheckForceOppositionQP(const std::vector<ContactPoint>& contactCones,
+                            const Eigen::Vector3d& extForce);
 
 //
 double ComputePartialMinWrenchQP(const std::vector<ContactPoint>& contactCones,
                                  const Eigen::Vector3d& centerOfMass,
                                  const Eigen::Vector3d& extForce,
-                                 const Eigen::Vector3d& extTorque);
+                                 const Eigen::Vector3d& extTorque,
+                                 const QualitySettings& settings);
+
+// The metrics above for one grasp. The grasp matrix, the closure programs
+// and the convex hull are computed on first use and shared between the
+// metrics. Not thread-safe.
+class GraspAnalysis {
+ public:
+  // extForce, extTorque: wrench resisted by the partial closure
+  GraspAnalysis(const std::vector<ContactPoint>& contactCones,
+                const Eigen::Vector3d& centerOfMass,
+                const Eigen::Vector3d& extForce,
+                const Eigen::Vector3d& extTorque,
+                const QualitySettings& settings);
+
+  bool IsForceClosure() const;
+  bool IsPartialClosure() const;
+  double GetMinWrench() const;
+  double GetPartialMinWrench() const;
+
+ private:
+  Eigen::MatrixXd G_;
+  Eigen::VectorXd target_wrench_;
+  QualitySettings settings_;
+
+  // Squared distance from zero to the convex hull of the wrenches
+  mutable bool closure_valid_ = false;
+  mutable double closure_dist_;
+  // Squared distance from the target wrench to their positive span
+  mutable bool partial_closure_valid_ = false;
+  mutable double partial_closure_dist_;
+
+  // Convex hull of zero, at index 0, and the wrenches
+  mutable bool hull_valid_ = false;
+  mutable bool hull_ok_ = false;
+  mutable bool zero_on_hull_ = false;
+  mutable std::vector<std::vector<size_t>> hull_facets_;
+  mutable Eigen::MatrixXd hull_planes_;
+  void InitHull() const;
+
+  // prune: see QualitySettings::prune_facets
+  double ScanMinWrench(bool prune) const;
+  double ScanPartialMinWrench(bool prune) const;
+};
+
+// Checks done with settings.qp_cross_check since the last reset.
+// Thread-safe.
+struct QPCrossCheckStats {
+  // Quadratic programs solved with both solvers, and how many of them
+  // disagreed
+  size_t n_checks = 0;
+  size_t n_disagreements = 0;
+  // Pruned facet scans (settings.prune_facets) repeated in full, and how
+  // many of them disagreed
+  size_t n_prune_checks = 0;
+  size_t n_prune_disagreements = 0;
+};
+QPCrossCheckStats GetQPCrossCheckStats();
+void ResetQPCrossCheckStats();
+// Whether a min wrench value disagrees with a reference value: they fall on
+// different sides of kWrenchNormThresh, or differ by more than
+// kQPCrossCheckTol relative to the reference
+bool QPValuesDisagree(double value, double reference);
 
 // Solve for a translational and rotational velocity of the gripper, so that
 // the velocity of all finger tips align with the direction of the contact
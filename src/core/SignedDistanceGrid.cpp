@@ -0,0 +1,234 @@
+#include "SignedDistanceGrid.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+namespace psg {
+namespace core {
+
+// v[x * 4 + y * 2 + z] is the value at corner (x, y, z)
+template <typename Scalar>
+static Scalar Trilinear(const Scalar v[8],
+                        const Eigen::Matrix<Scalar, 3, 1>& f,
+                        Eigen::Matrix<Scalar, 3, 1>& out_ds_df) {
+  const Scalar one = 1;
+  Scalar s = 0;
+  out_ds_df.setZero();
+  for (int c = 0; c < 8; c++) {
+    int x = (c >> 2) & 1;
+    int y = (c >> 1) & 1;
+    int z = c & 1;
+    Scalar wx = x ? f(0) : one - f(0);
+    Scalar wy = y ? f(1) : one - f(1);
+    Scalar wz = z ? f(2) : one - f(2);
+    s += v[c] * wx * wy * wz;
+    out_ds_df(0) += v[c] * (x ? one : -one) * wy * wz;
+    out_ds_df(1) += v[c] * wx * (y ? one : -one) * wz;
+    out_ds_df(2) += v[c] * wx * wy * (z ? one : -one);
+  }
+  return s;
+}
+
+void SignedDistanceGrid::Build(const Eigen::Vector3d& minimum,
+                               const Eigen::Vector3d& maximum,
+                               double resolution,
+                               double band,
+                               const SDFFunc& sdf,
+                               size_t n_error_samples) {
+  built_ = false;
+  resolution_ = resolution;
+  band_ = band;
+  brick_length_ = resolution * kBrickSize;
+
+  // Pad the domain so that the whole band around the mesh is covered
+  Eigen::Vector3d pad = Eigen::Vector3d::Constant(band + brick_length_);
+  lower_bound_ = minimum - pad;
+  Eigen::Vector3d extent = maximum + pad - lower_bound_;
+  for (int i = 0; i < 3; i++) {
+    n_bricks_(i) = std::max(1, (int)std::ceil(extent(i) / brick_length_));
+  }
+
+  // Coarse grid
+  const long long n_coarse = (long long)(n_bricks_(0) + 1) *
+                             (n_bricks_(1) + 1) * (n_bricks_(2) + 1);
+  coarse_values_.resize(n_coarse);
+#pragma omp parallel for
+  for (long long i = 0; i < n_coarse; i++) {
+    long long z = i % (n_bricks_(2) + 1);
+    long long y = (i / (n_bricks_(2) + 1)) % (n_bricks_(1) + 1);
+    long long x = i / ((n_bricks_(2) + 1) * (n_bricks_(1) + 1));
+    coarse_values_[i] =
+        (float)sdf(lower_bound_ + Eigen::Vector3d(x, y, z) * brick_length_);
+  }
+
+  // Activate bricks that may intersect the band. Every point of a brick is
+  // within half of its diagonal from one of its corners and the SDF is
+  // 1-Lipschitz.
+  const double half_diag = brick_length_ * std::sqrt(3.) / 2.;
+  brick_index_.assign((size_t)n_bricks_.prod(), -1);
+  std::vector<Eigen::Vector3i> active;
+  for (int x = 0; x < n_bricks_(0); x++) {
+    for (int y = 0; y < n_bricks_(1); y++) {
+      for (int z = 0; z < n_bricks_(2); z++) {
+        double min_s = std::numeric_limits<double>::max();
+        for (int c = 0; c < 8; c++) {
+          min_s = std::min<double>(
+              min_s,
+              std::abs(coarse_values_[CoarseId(
+                  x + ((c >> 2) & 1), y + ((c >> 1) & 1), z + (c & 1))]));
+        }
+        if (min_s < band + half_diag) {
+          brick_index_[BrickId(x, y, z)] = (int)active.size();
+          active.push_back(Eigen::Vector3i(x, y, z));
+        }
+      }
+    }
+  }
+  n_active_bricks_ = active.size();
+
+  // Fine nodes
+  const long long n_fine = (long long)n_active_bricks_ * kBrickNodes;
+  brick_values_.resize(n_fine);
+#pragma omp parallel for
+  for (long long i = 0; i < n_fine; i++) {
+    const Eigen::Vector3i& brick = active[i / kBrickNodes];
+    long long local = i % kBrickNodes;
+    long long z = local % (kBrickSize + 1);
+    long long y = (local / (kBrickSize + 1)) % (kBrickSize + 1);
+    long long x = local / ((kBrickSize + 1) * (kBrickSize + 1));
+    Eigen::Vector3d p = lower_bound_ + brick.cast<double>() * brick_length_ +
+                        Eigen::Vector3d(x, y, z) * resolution_;
+    brick_values_[i] = (float)sdf(p);
+  }
+  built_ = true;
+
+  // Error against the exact query. Half of the samples are taken uniformly
+  // in the domain and half inside the active bricks.
+  error_stats_ = ErrorStats();
+  if (n_error_samples == 0) return;
+  std::mt19937 gen(0);
+  std::uniform_real_distribution<double> dis(0., 1.);
+  std::vector<Eigen::Vector3d> samples(n_error_samples);
+  Eigen::Vector3d domain = n_bricks_.cast<double>() * brick_length_;
+  for (size_t i = 0; i < n_error_samples; i++) {
+    Eigen::Vector3d r(dis(gen), dis(gen), dis(gen));
+    if (i % 2 == 0 || n_active_bricks_ == 0) {
+      samples[i] = lower_bound_ + r.cwiseProduct(domain);
+    } else {
+      const Eigen::Vector3i& brick =
+          active[std::min<size_t>(dis(gen) * n_active_bricks_,
+                                  n_active_bricks_ - 1)];
+      samples[i] = lower_bound_ + (brick.cast<double>() + r) * brick_length_;
+    }
+  }
+  std::vector<double> exact(n_error_samples);
+  std::vector<double> error(n_error_samples);
+#pragma omp parallel for
+  for (long long i = 0; i < (long long)n_error_samples; i++) {
+    double s = 0;
+    exact[i] = sdf(samples[i]);
+    Query(samples[i], s);
+    error[i] = std::abs(s - exact[i]);
+  }
+  double sum = 0;
+  double band_sum = 0;
+  for (size_t i = 0; i < n_error_samples; i++) {
+    sum += error[i];
+    error_stats_.max_error = std::max(error_stats_.max_error, error[i]);
+    if (std::abs(exact[i]) < band) {
+      band_sum += error[i];
+      error_stats_.n_band_samples++;
+      error_stats_.max_band_error =
+          std::max(error_stats_.max_band_error, error[i]);
+    }
+  }
+  error_stats_.n_samples = n_error_samples;
+  error_stats_.mean_error = sum / n_error_samples;
+  if (error_stats_.n_band_samples > 0) {
+    error_stats_.mean_band_error = band_sum / error_stats_.n_band_samples;
+  }
+}
+
+template <typename Scalar>
+bool SignedDistanceGrid::Lookup(const Eigen::Matrix<Scalar, 3, 1>& p,
+                                Scalar out_v[8],
+                                Eigen::Matrix<Scalar, 3, 1>& out_f,
+                                Scalar& out_h) const {
+  if (!built_) return false;
+  Eigen::Matrix<Scalar, 3, 1> q =
+      (p - lower_bound_.cast<Scalar>()) / (Scalar)resolution_;
+  Eigen::Vector3i cell;
+  for (int i = 0; i < 3; i++) {
+    int n_cells = n_bricks_(i) * kBrickSize;
+    if (!(q(i) >= 0 && q(i) <= n_cells)) return false;
+    cell(i) = std::min((int)q(i), n_cells - 1);
+  }
+  Eigen::Vector3i brick = cell / kBrickSize;
+  int id = brick_index_[BrickId(brick(0), brick(1), brick(2))];
+  if (id >= 0) {
+    Eigen::Vector3i local = cell - brick * kBrickSize;
+    const float* values = brick_values_.data() + (size_t)id * kBrickNodes;
+    for (int c = 0; c < 8; c++) {
+      out_v[c] = values[BrickNodeId(local(0) + ((c >> 2) & 1),
+                                    local(1) + ((c >> 1) & 1),
+                                    local(2) + (c & 1))];
+    }
+    out_f = q - cell.cast<Scalar>();
+    out_h = (Scalar)resolution_;
+  } else {
+    for (int c = 0; c < 8; c++) {
+      out_v[c] = coarse_values_[CoarseId(brick(0) + ((c >> 2) & 1),
+                                         brick(1) + ((c >> 1) & 1),
+                                         brick(2) + (c & 1))];
+    }
+    out_f = q / (Scalar)kBrickSize - brick.cast<Scalar>();
+    out_h = (Scalar)brick_length_;
+  }
+  return true;
+}
+
+bool SignedDistanceGrid::Query(const Eigen::Vector3d& p,
+                               double& out_s,
+                               Eigen::RowVector3d& out_ds_dp) const {
+  double v[8];
+  Eigen::Vector3d f;
+  double h;
+  if (!Lookup(p, v, f, h)) return false;
+  Eigen::Vector3d ds_df;
+  out_s = Trilinear(v, f, ds_df);
+  out_ds_dp = ds_df.transpose() / h;
+  return true;
+}
+
+bool SignedDistanceGrid::Query(const Eigen::Vector3d& p, double& out_s) const {
+  double v[8];
+  Eigen::Vector3d f;
+  double h;
+  if (!Lookup(p, v, f, h)) return false;
+  Eigen::Vector3d ds_df;
+  out_s = Trilinear(v, f, ds_df);
+  return true;
+}
+
+bool SignedDistanceGrid::Query(const Eigen::Vector3f& p,
+                               float& out_s,
+                               Eigen::RowVector3f& out_ds_dp) const {
+  float v[8];
+  Eigen::Vector3f f;
+  float h;
+  if (!Lookup(p, v, f, h)) return false;
+  Eigen::Vector3f ds_df;
+  out_s = Trilinear(v, f, ds_df);
+  out_ds_dp = ds_df.transpose() / h;
+  return true;
+}
+
+size_t SignedDistanceGrid::GetMemoryUsage() const {
+  return brick_index_.size() * sizeof(int) +
+         brick_values_.size() * sizeof(float) +
+         coarse_values_.size() * sizeof(float);
+}
+
+}  // namespace core
+}  // namespace psg
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <functional>
+#include <vector>
+
+namespace psg {
+namespace core {
+
+// Narrow-band sparse signed distance grid.
+//
+// The domain is split into bricks of kBrickSize^3 cells. Bricks that may
+// contain a point within `band` of the surface store their nodes at full
+// resolution, all other bricks are covered by a coarse dense grid with one
+// node per brick corner. Both levels are trilinearly interpolated, so the
+// returned gradient is the exact derivative of the returned value.
+class SignedDistanceGrid {
+ public:
+  typedef std::function<double(const Eigen::Vector3d&)> SDFFunc;
+
+  static constexpr int kBrickSize = 8;
+  static constexpr int kBrickNodes =
+      (kBrickSize + 1) * (kBrickSize + 1) * (kBrickSize + 1);
+
+  // Absolute error of the grid against the exact query, sampled at build
+  // time
+  struct ErrorStats {
+    size_t n_samples = 0;
+    double max_error = 0;
+    double mean_error = 0;
+    // Only samples with |s| < band
+    size_t n_band_samples = 0;
+    double max_band_error = 0;
+    double mean_band_error = 0;
+  };
+
+  // sdf: exact signed distance used to fill the nodes
+  void Build(const Eigen::Vector3d& minimum,
+             const Eigen::Vector3d& maximum,
+             double resolution,
+             double band,
+             const SDFFunc& sdf,
+             size_t n_error_samples = 8192);
+
+  // Returns false if p lies outside of the grid, in which case the caller
+  // should fall back to the exact query.
+  bool Query(const Eigen::Vector3d& p,
+             double& out_s,
+             Eigen::RowVector3d& out_ds_dp) const;
+  bool Query(const Eigen::Vector3d& p, double& out_s) const;
+  // Single precision query, the nodes being stored as float anyway
+  bool Query(const Eigen::Vector3f& p,
+             float& out_s,
+             Eigen::RowVector3f& out_ds_dp) const;
+
+  size_t GetMemoryUsage() const;
+
+  inline bool IsBuilt() const { return built_; }
+  inline double GetResolution() const { return resolution_; }
+  inline double GetBand() const { return band_; }
+  inline size_t GetNumActiveBricks() const { return n_active_bricks_; }
+  inline size_t GetNumBricks() const { return brick_index_.size(); }
+  inline const ErrorStats& GetErrorStats() const { return error_stats_; }
+
+ private:
+  bool built_ = false;
+  double resolution_ = 0;
+  double band_ = 0;
+  double brick_length_ = 0;
+  Eigen::Vector3d lower_bound_;
+  Eigen::Vector3i n_bricks_;
+  size_t n_active_bricks_ = 0;
+
+  // -1 if the brick is not stored
+  std::vector<int> brick_index_;
+  // kBrickNodes per active brick
+  std::vector<float> brick_values_;
+  // (n_bricks_ + 1) nodes per axis
+  std::vector<float> coarse_values_;
+
+  ErrorStats error_stats_;
+
+  inline size_t BrickId(int x, int y, int z) const {
+    return ((size_t)x * n_bricks_(1) + y) * n_bricks_(2) + z;
+  }
+  inline size_t CoarseId(int x, int y, int z) const {
+    return ((size_t)x * (n_bricks_(1) + 1) + y) * (n_bricks_(2) + 1) + z;
+  }
+  static inline size_t BrickNodeId(int x, int y, int z) {
+    return ((size_t)x * (kBrickSize + 1) + y) * (kBrickSize + 1) + z;
+  }
+
+  // Fills the 8 corner values of the cell containing p.
+  // out_f: local coordinate of p inside the cell
+  // out_h: cell size
+  template <typename Scalar>
+  bool Lookup(const Eigen::Matrix<Scalar, 3, 1>& p,
+              Scalar out_v[8],
+              Eigen::Matrix<Scalar, 3, 1>& out_f,
+              Scalar& out_h) const;
+};
+
+}  // namespace core
+}  // namespace psg
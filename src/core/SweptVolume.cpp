@@ -368,7 +368,7 @@ static std::vector<Eigen::Matrix4d> GetTransformations(
   static const size_t subdivision = 8;
   size_t n_steps = (psg.GetTrajectory().size() - 1) * subdivision + 1;
   size_t n_dof = psg.GetTrajectory().front().size();
-  std::vector<Eigen::Matrix4d> transformations(n_steps);
+  std::vector<Pose> poses(n_steps);
   for (size_t i = 0; i < n_steps; i++) {
     size_t a = i / subdivision;
     size_t b = i % subdivision;
@@ -379,12 +379,16 @@ static std::vector<Eigen::Matrix4d> GetTransformations(
 
     double t = (double)b / subdivision;
 
-    Pose l_pose;
-    l_pose = psg.GetTrajectory()[a] * (1 - t) + psg.GetTrajectory()[a + 1] * t;
-    Eigen::Affine3d finger_trans_inv =
-        robots::Forward(psg.GetTrajectory().front()).inverse();
-    transformations[i] =
-        (finger_trans_inv * robots::Forward(l_pose)).inverse().matrix();
+    poses[i] =
+        psg.GetTrajectory()[a] * (1 - t) + psg.GetTrajectory()[a + 1] * t;
+  }
+  std::vector<Eigen::Affine3d> trans;
+  robots::ForwardBatch(poses, trans);
+  Eigen::Affine3d finger_trans_inv =
+      robots::Forward(psg.GetTrajectory().front()).inverse();
+  std::vector<Eigen::Matrix4d> transformations(n_steps);
+  for (size_t i = 0; i < n_steps; i++) {
+    transformations[i] = (finger_trans_inv * trans[i]).inverse().matrix();
   }
   return transformations;
 }
@@ -10,6 +10,9 @@ struct ContactPointFilter {
   double hole = 0.006;
   double curvature_radius = 0;
   double angle = kPi;  // 180 deg
+  // Minimum distance between the contact points of a candidate. Closer
+  // contacts would be made by the same part of a finger. 0 disables the check.
+  double min_distance = 0;
 };
 
 }  // namespace models
@@ -13,9 +13,24 @@ struct CostSettings : psg::core::serialization::Serializable {
   double ang_velocity = kDegToRad * 60.;
   CostFunctionEnum cost_function = CostFunctionEnum::kSP;
   double regularization = 1e-6;
+  // Use the sparse SDF grid instead of the exact signed distance
+  bool sdf_grid = false;
+  double sdf_grid_res = 0.001;
+  double sdf_grid_band = 0.005;
+  // Number of shortest path rows kept in memory
+  size_t geodesic_cache_size = 256;
+  // Evaluate the gradient-based cost in flat parallel passes with a
+  // deterministic reduction
+  bool flat_parallel = false;
+  // Skip the MinDistance queries that provably cannot lower the minimum
+  bool hierarchical_min_dist = false;
+  // Evaluations of each optimization start done with the distance queries
+  // in single precision before switching to double. Gradient-based cost
+  // only.
+  size_t float_evals = 0;
 
   DECL_SERIALIZE() {
-    constexpr int version = 4;
+    constexpr int version = 9;
     SERIALIZE(version);
     SERIALIZE(floor);
     SERIALIZE(n_trajectory_steps);
@@ -23,6 +38,13 @@ struct CostSettings : psg::core::serialization::Serializable {
     SERIALIZE(ang_velocity);
     SERIALIZE(cost_function);
     SERIALIZE(regularization);
+    SERIALIZE(sdf_grid);
+    SERIALIZE(sdf_grid_res);
+    SERIALIZE(sdf_grid_band);
+    SERIALIZE(geodesic_cache_size);
+    SERIALIZE(flat_parallel);
+    SERIALIZE(hierarchical_min_dist);
+    SERIALIZE(float_evals);
   }
 
   DECL_DESERIALIZE() {
@@ -50,6 +72,66 @@ struct CostSettings : psg::core::serialization::Serializable {
       DESERIALIZE(ang_velocity);
       DESERIALIZE(cost_function);
       DESERIALIZE(regularization);
+    } else if (version == 5) {
+      DESERIALIZE(floor);
+      DESERIALIZE(n_trajectory_steps);
+      DESERIALIZE(n_finger_steps);
+      DESERIALIZE(ang_velocity);
+      DESERIALIZE(cost_function);
+      DESERIALIZE(regularization);
+      DESERIALIZE(sdf_grid);
+      DESERIALIZE(sdf_grid_res);
+      DESERIALIZE(sdf_grid_band);
+    } else if (version == 6) {
+      DESERIALIZE(floor);
+      DESERIALIZE(n_trajectory_steps);
+      DESERIALIZE(n_finger_steps);
+      DESERIALIZE(ang_velocity);
+      DESERIALIZE(cost_function);
+      DESERIALIZE(regularization);
+      DESERIALIZE(sdf_grid);
+      DESERIALIZE(sdf_grid_res);
+      DESERIALIZE(sdf_grid_band);
+      DESERIALIZE(geodesic_cache_size);
+    } else if (version == 7) {
+      DESERIALIZE(floor);
+      DESERIALIZE(n_trajectory_steps);
+      DESERIALIZE(n_finger_steps);
+      DESERIALIZE(ang_velocity);
+      DESERIALIZE(cost_function);
+      DESERIALIZE(regularization);
+      DESERIALIZE(sdf_grid);
+      DESERIALIZE(sdf_grid_res);
+      DESERIALIZE(sdf_grid_band);
+      DESERIALIZE(geodesic_cache_size);
+      DESERIALIZE(flat_parallel);
+    } else if (version == 8) {
+      DESERIALIZE(floor);
+      DESERIALIZE(n_trajectory_steps);
+      DESERIALIZE(n_finger_steps);
+      DESERIALIZE(ang_velocity);
+      DESERIALIZE(cost_function);
+      DESERIALIZE(regularization);
+      DESERIALIZE(sdf_grid);
+      DESERIALIZE(sdf_grid_res);
+      DESERIALIZE(sdf_grid_band);
+      DESERIALIZE(geodesic_cache_size);
+      DESERIALIZE(flat_parallel);
+      DESERIALIZE(hierarchical_min_dist);
+    } else if (version == 9) {
+      DESERIALIZE(floor);
+      DESERIALIZE(n_trajectory_steps);
+      DESERIALIZE(n_finger_steps);
+      DESERIALIZE(ang_velocity);
+      DESERIALIZE(cost_function);
+      DESERIALIZE(regularization);
+      DESERIALIZE(sdf_grid);
+      DESERIALIZE(sdf_grid_res);
+      DESERIALIZE(sdf_grid_band);
+      DESERIALIZE(geodesic_cache_size);
+      DESERIALIZE(flat_parallel);
+      DESERIALIZE(hierarchical_min_dist);
+      DESERIALIZE(float_evals);
     }
   }
 };
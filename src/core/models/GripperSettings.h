@@ -7,6 +7,7 @@
 #include "CostSettings.h"
 #include "FingerSettings.h"
 #include "OptSettings.h"
+#include "QualitySettings.h"
 #include "TopoOptSettings.h"
 #include "TrajectorySettings.h"
 
@@ -21,9 +22,10 @@ struct GripperSettings : psg::core::serialization::Serializable {
   OptSettings opt;
   TopoOptSettings topo_opt;
   CostSettings cost;
+  QualitySettings quality;
 
   DECL_SERIALIZE() {
-    constexpr int version = 1;
+    constexpr int version = 2;
     SERIALIZE(version);
     SERIALIZE(contact);
     SERIALIZE(finger);
@@ -31,6 +33,7 @@ struct GripperSettings : psg::core::serialization::Serializable {
     SERIALIZE(opt);
     SERIALIZE(topo_opt);
     SERIALIZE(cost);
+    SERIALIZE(quality);
   }
 
   DECL_DESERIALIZE() {
@@ -43,6 +46,14 @@ struct GripperSettings : psg::core::serialization::Serializable {
       DESERIALIZE(opt);
       DESERIALIZE(topo_opt);
       DESERIALIZE(cost);
+    } else if (version == 2) {
+      DESERIALIZE(contact);
+      DESERIALIZE(finger);
+      DESERIALIZE(trajectory);
+      DESERIALIZE(opt);
+      DESERIALIZE(topo_opt);
+      DESERIALIZE(cost);
+      DESERIALIZE(quality);
     }
   }
 };
@@ -7,27 +7,66 @@
 #include <igl/per_face_normals.h>
 #include <igl/per_vertex_normals.h>
 #include <igl/principal_curvature.h>
+#include <igl/pseudonormal_test.h>
 #include <igl/signed_distance.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <iomanip>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include "../../utils.h"
 #include "../GeometryUtils.h"
+#include "../serialization/Container.h"
 
 namespace psg {
 namespace core {
 namespace models {
-void MeshDependentResource::init(const Eigen::MatrixXd& V_,
-                                 const Eigen::MatrixXi& F_) {
-  if (initialized) {
-    tree.deinit();
-    intersector.deinit();
+
+static std::string& CacheDirectory() {
+  static std::string directory;
+  return directory;
+}
+
+void MeshDependentResource::SetCacheDirectory(const std::string& directory) {
+  CacheDirectory() = directory;
+}
+
+// FNV-1a of the shapes and bytes of V and F
+static uint64_t HashMesh(const Eigen::MatrixXd& V, const Eigen::MatrixXi& F) {
+  long long shape[4] = {V.rows(), V.cols(), F.rows(), F.cols()};
+  uint64_t hash = serialization::ComputeChecksum(
+      reinterpret_cast<const char*>(shape), sizeof(shape));
+  hash = serialization::ComputeChecksum(
+      reinterpret_cast<const char*>(V.data()), V.size() * sizeof(double), hash);
+  return serialization::ComputeChecksum(
+      reinterpret_cast<const char*>(F.data()), F.size() * sizeof(int), hash);
+}
+
+void MeshDependentResource::init(const Eigen::Ref<const Eigen::MatrixXd>& V_,
+                                 const Eigen::Ref<const Eigen::MatrixXi>& F_,
+                                 unsigned components) {
+  {
+    std::lock_guard<std::mutex> lock(components_mutex_);
+    if (components_ & kTree) tree_.deinit();
+    if (components_ & kIntersector) intersector_.deinit();
+    components_ = 0;
   }
   V = V_;
   F = F_;
-  tree.init(V_, F_);
-  intersector.init(V.cast<float>(), F, true);
-  igl::per_face_normals(V_, F_, FN);
-  igl::per_vertex_normals(
-      V_, F_, igl::PER_VERTEX_NORMALS_WEIGHTING_TYPE_ANGLE, FN, VN);
-  igl::per_edge_normals(
-      V_, F_, igl::PER_EDGE_NORMALS_WEIGHTING_TYPE_UNIFORM, FN, EN, E, EMAP);
+
+  cache_fn_.clear();
+  if (!CacheDirectory().empty()) {
+    std::ostringstream ss;
+    ss << std::hex << std::setw(16) << std::setfill('0') << HashMesh(V, F);
+    cache_fn_ =
+        (std::filesystem::path(CacheDirectory()) / (ss.str() + ".mdrc"))
+            .string();
+  }
+  init_components(components);
 
   minimum = V.colwise().minCoeff();
   maximum = V.colwise().maxCoeff();
@@ -35,18 +74,76 @@ void MeshDependentResource::init(const Eigen::MatrixXd& V_,
 
   center_of_mass = CenterOfMass(V, F);
 
-  igl::principal_curvature(V, F, PD1, PD2, PV1, PV2);
-
-  SP_valid_ = false;
+  geodesic_ = std::make_shared<GeodesicCache>(V, F);
+  sdf_grids_.clear();
+  sdf_grid_.store(nullptr, std::memory_order_release);
+  float_tree_.reset();
+  float_tree_ptr_.store(nullptr, std::memory_order_release);
   // curvature_valid_ = false;
 }
 
+void MeshDependentResource::init_components(unsigned components) const {
+  std::lock_guard<std::mutex> lock(components_mutex_);
+  unsigned missing = components & ~components_;
+  if (missing == 0) return;
+
+  unsigned cache_components = 0;
+  if ((missing & kCachedComponents) && !cache_fn_.empty()) {
+    unsigned loaded =
+        LoadCache(cache_fn_, missing & kCachedComponents, cache_components);
+    components_ |= loaded;
+    missing &= ~loaded;
+  }
+  if (missing & kTree) {
+    tree_.init(V, F);
+  }
+  if (missing & kNormals) {
+    igl::per_face_normals(V, F, FN_);
+    igl::per_vertex_normals(
+        V, F, igl::PER_VERTEX_NORMALS_WEIGHTING_TYPE_ANGLE, FN_, VN_);
+    igl::per_edge_normals(V,
+                          F,
+                          igl::PER_EDGE_NORMALS_WEIGHTING_TYPE_UNIFORM,
+                          FN_,
+                          EN_,
+                          E_,
+                          EMAP_);
+  }
+  if (missing & kCurvature) {
+    igl::principal_curvature(V, F, PD1_, PD2_, PV1_, PV2_);
+  }
+  if (missing & kIntersector) {
+    intersector_.init(V.cast<float>(), F, true);
+  }
+  components_.fetch_or(missing, std::memory_order_release);
+
+  // Rewritten whenever a cached component is built rather than loaded.
+  // Components only found in the file are loaded first so that they are
+  // kept.
+  if ((missing & kCachedComponents) && !cache_fn_.empty()) {
+    unsigned extra = cache_components & kCachedComponents & ~components_;
+    if (extra != 0) {
+      unsigned unused;
+      components_.fetch_or(LoadCache(cache_fn_, extra, unused),
+                           std::memory_order_release);
+    }
+    SaveCache(cache_fn_, components_ & kCachedComponents);
+  }
+}
+
 void MeshDependentResource::init(const MeshDependentResource& other) {
-  init(other.V, other.F);
-  if (other.SP_valid_) {
-    SP_valid_ = other.SP_valid_;
-    SP_ = other.SP_;
-    SP_par_ = other.SP_par_;
+  init(other.V, other.F, other.components_.load());
+  geodesic_ = other.geodesic_;
+  {
+    std::lock_guard<std::mutex> lock(other.sdf_grid_mutex_);
+    sdf_grids_ = other.sdf_grids_;
+    sdf_grid_.store(other.sdf_grid_.load(std::memory_order_acquire),
+                    std::memory_order_release);
+  }
+  {
+    std::lock_guard<std::mutex> lock(other.float_tree_mutex_);
+    float_tree_ = other.float_tree_;
+    float_tree_ptr_.store(float_tree_.get(), std::memory_order_release);
   }
   /*
   if (other.curvature_valid_) {
@@ -56,51 +153,192 @@ void MeshDependentResource::init(const MeshDependentResource& other) {
   */
 }
 
-void MeshDependentResource::init_sp() const {
-  if (SP_valid_) return;
-  std::lock_guard<std::mutex> lock(SP_mutex_);
-  if (SP_valid_) return;
-
-  size_t nV = V.rows();
-  size_t nF = F.rows();
-  std::vector<std::vector<std::pair<int, double>>> edges(nV);
-  SP_.resize(nV, nV);
-  SP_par_.resize(nV, nV);
-  SP_.setConstant(std::numeric_limits<double>::max() / 2.);
-  SP_par_.setConstant(-1);
-  for (size_t i = 0; i < nF; i++) {
-    for (size_t k = 0; k < 3; k++) {
-      size_t jj = (k + 1) % 3;
-      int u = F(i, k);
-      int v = F(i, jj);
-      edges[u].push_back({v, (V.row(u) - V.row(v)).norm()});
+// Layout: version, V, F, component mask, then the sections of the
+// components in the mask, in the order normals, curvature, tree
+unsigned MeshDependentResource::LoadCache(
+    const std::string& fn,
+    unsigned components,
+    unsigned& out_cache_components) const {
+  out_cache_components = 0;
+  // Mapped, so the matrices are copied straight from the page cache
+  std::unique_ptr<serialization::MappedFile> file;
+  try {
+    file = std::make_unique<serialization::MappedFile>(fn);
+  } catch (const std::invalid_argument&) {
+    return 0;
+  }
+  serialization::MemoryStreamBuffer buf(file->GetData(), file->GetSize());
+  std::istream f(&buf);
+
+  auto start_time = std::chrono::high_resolution_clock::now();
+  Eigen::MatrixXd FN, VN, EN, PD1, PD2;
+  Eigen::MatrixXi E, EMAP;
+  Eigen::VectorXd PV1, PV2;
+  Eigen::MatrixXd bb_mins;
+  Eigen::MatrixXd bb_maxs;
+  Eigen::VectorXi elements;
+  unsigned cache_components = 0;
+  try {
+    int version;
+    DESERIALIZE(version);
+    if (!f.good() || version != kCacheVersion) return 0;
+    // Guards against hash collisions
+    Eigen::MatrixXd V_;
+    Eigen::MatrixXi F_;
+    DESERIALIZE(V_);
+    DESERIALIZE(F_);
+    if (!f.good() || V_.rows() != V.rows() || V_.cols() != V.cols() ||
+        F_.rows() != F.rows() || F_.cols() != F.cols() || V_ != V ||
+        F_ != F)
+      return 0;
+    DESERIALIZE(cache_components);
+    if (cache_components & kNormals) {
+      DESERIALIZE(FN);
+      DESERIALIZE(VN);
+      DESERIALIZE(EN);
+      DESERIALIZE(E);
+      DESERIALIZE(EMAP);
     }
+    if (cache_components & kCurvature) {
+      DESERIALIZE(PD1);
+      DESERIALIZE(PD2);
+      DESERIALIZE(PV1);
+      DESERIALIZE(PV2);
+    }
+    if (cache_components & kTree) {
+      DESERIALIZE(bb_mins);
+      DESERIALIZE(bb_maxs);
+      DESERIALIZE(elements);
+    }
+  } catch (const std::exception&) {
+    f.setstate(std::ios::failbit);
   }
+  if (!f.good()) {
+    Error() << "Ignoring corrupted mesh cache " << fn << std::endl;
+    return 0;
+  }
+  out_cache_components = cache_components;
 
-  struct VertexInfo {
-    int id;
-    double dist;
-    bool operator<(const VertexInfo& r) const { return dist > r.dist; }
-  };
-#pragma omp parallel for
-  for (int src = 0; src < nV; src++) {
-    std::priority_queue<VertexInfo> q;
-    q.push(VertexInfo{src, 0});
-    SP_(src, src) = 0;
-    while (!q.empty()) {
-      VertexInfo u = q.top();
-      q.pop();
-      double curDis;
-      for (const auto& v : edges[u.id]) {
-        if ((curDis = u.dist + v.second) < SP_(v.first, src)) {
-          SP_(v.first, src) = curDis;
-          SP_par_(v.first, src) = u.id;
-          q.push(VertexInfo{v.first, curDis});
-        }
-      }
+  unsigned loaded = components & cache_components & kCachedComponents;
+  if (loaded & kNormals) {
+    FN_ = std::move(FN);
+    VN_ = std::move(VN);
+    EN_ = std::move(EN);
+    E_ = std::move(E);
+    EMAP_ = std::move(EMAP);
+  }
+  if (loaded & kCurvature) {
+    PD1_ = std::move(PD1);
+    PD2_ = std::move(PD2);
+    PV1_ = std::move(PV1);
+    PV2_ = std::move(PV2);
+  }
+  if (loaded & kTree) {
+    tree_.init(V, F, bb_mins, bb_maxs, elements);
+  }
+
+  auto stop_time = std::chrono::high_resolution_clock::now();
+  long long duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+                           stop_time - start_time)
+                           .count();
+  Log() << "Mesh cache " << fn << " loaded in " << duration << " ms"
+        << std::endl;
+  return loaded;
+}
+
+void MeshDependentResource::SaveCache(const std::string& fn,
+                                      unsigned components) const {
+  Eigen::MatrixXd bb_mins;
+  Eigen::MatrixXd bb_maxs;
+  Eigen::VectorXi elements;
+  if (components & kTree) tree_.serialize(bb_mins, bb_maxs, elements);
+
+  // Written under a unique name, then renamed so that concurrent processes
+  // never read a partial file
+  std::string tmp_fn = fn + "." + std::to_string(std::random_device()()) +
+                       ".tmp";
+  {
+    std::ofstream f(tmp_fn, std::ios::out | std::ios::binary);
+    if (!f.is_open()) {
+      Error() << "Cannot write mesh cache " << fn << std::endl;
+      return;
+    }
+    int version = kCacheVersion;
+    SERIALIZE(version);
+    SERIALIZE(V);
+    SERIALIZE(F);
+    SERIALIZE(components);
+    if (components & kNormals) {
+      SERIALIZE(FN_);
+      SERIALIZE(VN_);
+      SERIALIZE(EN_);
+      SERIALIZE(E_);
+      SERIALIZE(EMAP_);
+    }
+    if (components & kCurvature) {
+      SERIALIZE(PD1_);
+      SERIALIZE(PD2_);
+      SERIALIZE(PV1_);
+      SERIALIZE(PV2_);
+    }
+    if (components & kTree) {
+      SERIALIZE(bb_mins);
+      SERIALIZE(bb_maxs);
+      SERIALIZE(elements);
+    }
+  }
+  std::error_code ec;
+  std::filesystem::rename(tmp_fn, fn, ec);
+  if (ec) {
+    std::filesystem::remove(tmp_fn, ec);
+    return;
+  }
+  Log() << "Mesh cache written to " << fn << std::endl;
+}
+
+const SignedDistanceGrid& MeshDependentResource::init_sdf_grid(
+    double resolution,
+    double band) const {
+  const SignedDistanceGrid* last = sdf_grid_.load(std::memory_order_acquire);
+  if (last != nullptr && last->GetResolution() == resolution &&
+      last->GetBand() == band)
+    return *last;
+  std::lock_guard<std::mutex> lock(sdf_grid_mutex_);
+  for (const auto& grid : sdf_grids_) {
+    if (grid->GetResolution() == resolution && grid->GetBand() == band) {
+      sdf_grid_.store(grid.get(), std::memory_order_release);
+      return *grid;
     }
   }
-  SP_valid_ = true;
+
+  auto start_time = std::chrono::high_resolution_clock::now();
+  auto grid = std::make_shared<SignedDistanceGrid>();
+  grid->Build(minimum,
+              maximum,
+              resolution,
+              band,
+              [this](const Eigen::Vector3d& p) -> double {
+                Eigen::RowVector3d c;
+                double s;
+                return ComputeSignedDistance(p, c, s);
+              });
+  auto stop_time = std::chrono::high_resolution_clock::now();
+  long long duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+                           stop_time - start_time)
+                           .count();
+  const auto& stats = grid->GetErrorStats();
+  Log() << "SDF grid built in " << duration << " ms: " << resolution
+        << " m resolution, " << grid->GetNumActiveBricks() << "/"
+        << grid->GetNumBricks() << " bricks, "
+        << grid->GetMemoryUsage() / (1024 * 1024) << " MB" << std::endl;
+  Log() << "SDF grid error (" << stats.n_samples
+        << " samples): max = " << stats.max_error
+        << ", mean = " << stats.mean_error
+        << ", in band max = " << stats.max_band_error
+        << ", in band mean = " << stats.mean_band_error << std::endl;
+  sdf_grids_.push_back(grid);
+  sdf_grid_.store(grid.get(), std::memory_order_release);
+  return *grid;
 }
 
 /*
@@ -136,30 +374,353 @@ double MeshDependentResource::ComputeSignedDistance(
     const Eigen::Vector3d& position,
     Eigen::RowVector3d& c,
     double& s) const {
+  Require(kTree | kNormals);
   double sqrd;
   int i;
   Eigen::RowVector3d n;
-  igl::signed_distance_pseudonormal(
-      tree, V, F, FN, VN, EN, EMAP, position.transpose(), s, sqrd, i, c, n);
+  igl::signed_distance_pseudonormal(tree_,
+                                    V,
+                                    F,
+                                    FN_,
+                                    VN_,
+                                    EN_,
+                                    EMAP_,
+                                    position.transpose(),
+                                    s,
+                                    sqrd,
+                                    i,
+                                    c,
+                                    n);
   return s * sqrt(sqrd);
 }
+
+// Batched signed distance
+// Queries are processed in packets of one 256-bit register: 4 lanes in
+// double precision, 8 in single precision.
+template <typename Scalar>
+using Lanes = Eigen::Array<Scalar, 32 / sizeof(Scalar), 1>;
+template <typename Scalar>
+using RowVector3 = Eigen::Matrix<Scalar, 1, 3>;
+
+template <typename Scalar>
+static inline Lanes<Scalar> BoxSquaredDistance(
+    const Eigen::AlignedBox<Scalar, 3>& box,
+    const Lanes<Scalar> p[3]) {
+  const Scalar zero = 0;
+  Lanes<Scalar> result = Lanes<Scalar>::Zero();
+  for (int k = 0; k < 3; k++) {
+    Lanes<Scalar> d =
+        (box.min()(k) - p[k]).max(zero) + (p[k] - box.max()(k)).max(zero);
+    result += d * d;
+  }
+  return result;
+}
+
+// Closest point on triangle abc for every lane, without branches.
+// See Real-Time Collision Detection 5.1.5
+template <typename Scalar>
+static inline void ClosestPointOnTriangle(const RowVector3<Scalar>& a,
+                                          const RowVector3<Scalar>& b,
+                                          const RowVector3<Scalar>& c,
+                                          const Lanes<Scalar> p[3],
+                                          Lanes<Scalar> out_c[3],
+                                          Lanes<Scalar>& out_sqrd) {
+  typedef Lanes<Scalar> L;
+  const Scalar zero = 0;
+  const Scalar one = 1;
+  RowVector3<Scalar> ab = b - a;
+  RowVector3<Scalar> ac = c - a;
+  L ap[3], bp[3], cp[3];
+  for (int k = 0; k < 3; k++) {
+    ap[k] = p[k] - a(k);
+    bp[k] = p[k] - b(k);
+    cp[k] = p[k] - c(k);
+  }
+  auto Dot = [](const RowVector3<Scalar>& u, const L q[3]) -> L {
+    return u(0) * q[0] + u(1) * q[1] + u(2) * q[2];
+  };
+  L d1 = Dot(ab, ap);
+  L d2 = Dot(ac, ap);
+  L d3 = Dot(ab, bp);
+  L d4 = Dot(ac, bp);
+  L d5 = Dot(ab, cp);
+  L d6 = Dot(ac, cp);
+  L va = d3 * d6 - d5 * d4;
+  L vb = d5 * d2 - d1 * d6;
+  L vc = d1 * d4 - d3 * d2;
+
+  // Interior, then override regions in reverse order of precedence.
+  // Divisions by zero only happen in lanes that are overridden.
+  L denom = one / (va + vb + vc);
+  L v = vb * denom;
+  L w = vc * denom;
+  L e43 = d4 - d3;
+  L e56 = d5 - d6;
+  auto in_bc = (va <= zero) && (e43 >= zero) && (e56 >= zero);
+  L w_bc = e43 / (e43 + e56);
+  v = in_bc.select(one - w_bc, v);
+  w = in_bc.select(w_bc, w);
+  auto in_ac = (vb <= zero) && (d2 >= zero) && (d6 <= zero);
+  v = in_ac.select(zero, v);
+  w = in_ac.select(d2 / (d2 - d6), w);
+  auto in_c = (d6 >= zero) && (d5 <= d6);
+  v = in_c.select(zero, v);
+  w = in_c.select(one, w);
+  auto in_ab = (vc <= zero) && (d1 >= zero) && (d3 <= zero);
+  v = in_ab.select(d1 / (d1 - d3), v);
+  w = in_ab.select(zero, w);
+  auto in_b = (d3 >= zero) && (d4 <= d3);
+  v = in_b.select(one, v);
+  w = in_b.select(zero, w);
+  auto in_a = (d1 <= zero) && (d2 <= zero);
+  v = in_a.select(zero, v);
+  w = in_a.select(zero, w);
+
+  out_sqrd = L::Zero();
+  for (int k = 0; k < 3; k++) {
+    out_c[k] = a(k) + v * ab(k) + w * ac(k);
+    L d = p[k] - out_c[k];
+    out_sqrd += d * d;
+  }
+}
+
+// Spread the lower 10 bits of x to every third bit
+static inline uint32_t MortonSpread(uint32_t x) {
+  x &= 0x3ff;
+  x = (x | (x << 16)) & 0x030000ff;
+  x = (x | (x << 8)) & 0x0300f00f;
+  x = (x | (x << 4)) & 0x030c30c3;
+  x = (x | (x << 2)) & 0x09249249;
+  return x;
+}
+
+// ComputeSignedDistanceBatch in Scalar precision
+//  V: vertices in Scalar precision
+//  root: igl::AABB or FloatTree::Node built on V
+template <typename Scalar, typename DerivedV, typename Node>
+static void SignedDistanceBatch(
+    const MeshDependentResource& mdr,
+    const DerivedV& V,
+    const Node* root,
+    const Eigen::Matrix<Scalar, Eigen::Dynamic, 3>& P,
+    Eigen::Matrix<Scalar, Eigen::Dynamic, 1>& out_S,
+    Eigen::Matrix<Scalar, Eigen::Dynamic, 3>& out_C) {
+  typedef Lanes<Scalar> L;
+  constexpr int kPacketSize = L::RowsAtCompileTime;
+  const Eigen::MatrixXi& F = mdr.F;
+  const Eigen::MatrixXd& FN = mdr.GetFN();
+  const Eigen::MatrixXd& VN = mdr.GetVN();
+  const Eigen::MatrixXd& EN = mdr.GetEN();
+  const Eigen::MatrixXi& EMAP = mdr.GetEMAP();
+  const long long n = P.rows();
+  out_S.resize(n);
+  out_C.resize(n, 3);
+  if (n == 0) return;
+
+  // Sort queries along a Morton curve so that consecutive packets share
+  // most of their traversal
+  std::vector<long long> order(n);
+  {
+    RowVector3<Scalar> p_min = P.colwise().minCoeff();
+    RowVector3<Scalar> p_range =
+        (P.colwise().maxCoeff() - p_min).cwiseMax((Scalar)1e-12);
+    std::vector<uint32_t> code(n);
+#pragma omp parallel for
+    for (long long i = 0; i < n; i++) {
+      RowVector3<Scalar> q =
+          ((P.row(i) - p_min).array() / p_range.array() * (Scalar)1023.)
+              .matrix();
+      code[i] = (MortonSpread((uint32_t)q(0)) << 2) |
+                (MortonSpread((uint32_t)q(1)) << 1) |
+                MortonSpread((uint32_t)q(2));
+      order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&code](long long a, long long b) {
+      return code[a] < code[b];
+    });
+  }
+
+  const long long n_packets = (n + kPacketSize - 1) / kPacketSize;
+#pragma omp parallel
+  {
+    std::vector<const Node*> stack;
+    stack.reserve(64);
+    int last_fid = -1;
+
+#pragma omp for schedule(dynamic, 16)
+    for (long long pk = 0; pk < n_packets; pk++) {
+      long long ids[kPacketSize];
+      L p[3];
+      for (int l = 0; l < kPacketSize; l++) {
+        // Pad the last packet with its last query
+        ids[l] = order[std::min(pk * kPacketSize + l, n - 1)];
+        for (int k = 0; k < 3; k++) p[k](l) = P(ids[l], k);
+      }
+
+      L best_sqrd = L::Constant(std::numeric_limits<Scalar>::max());
+      Eigen::Array<int, kPacketSize, 1> best_fid;
+      L best_c[3];
+      best_fid.setConstant(-1);
+      auto Visit = [&](int fid) {
+        L c[3];
+        L sqrd;
+        ClosestPointOnTriangle<Scalar>(
+            V.row(F(fid, 0)), V.row(F(fid, 1)), V.row(F(fid, 2)), p, c, sqrd);
+        // Ties go to the lowest facet index, so that the result depends
+        // neither on the visit order nor on the warm start, and thus not on
+        // the thread schedule
+        auto better = (sqrd < best_sqrd) ||
+                      (sqrd == best_sqrd && best_fid > fid);
+        best_sqrd = better.select(sqrd, best_sqrd);
+        best_fid = better.select(fid, best_fid);
+        for (int k = 0; k < 3; k++) best_c[k] = better.select(c[k], best_c[k]);
+      };
+
+      // Seed with the closest facet of the previous packet
+      if (last_fid >= 0) Visit(last_fid);
+
+      stack.clear();
+      stack.push_back(root);
+      while (!stack.empty()) {
+        const Node* node = stack.back();
+        stack.pop_back();
+        // Boxes at the best distance may still hold a tie of lower index
+        if ((BoxSquaredDistance(node->m_box, p) > best_sqrd).all()) continue;
+        if (node->is_leaf()) {
+          Visit(node->m_primitive);
+          continue;
+        }
+        // Push the farther child first so that the closer one is visited
+        // first
+        Scalar d_left = BoxSquaredDistance(node->m_left->m_box, p).sum();
+        Scalar d_right = BoxSquaredDistance(node->m_right->m_box, p).sum();
+        if (d_left < d_right) {
+          stack.push_back(node->m_right);
+          stack.push_back(node->m_left);
+        } else {
+          stack.push_back(node->m_left);
+          stack.push_back(node->m_right);
+        }
+      }
+      last_fid = best_fid(0);
+
+      // Sign
+      for (int l = 0; l < kPacketSize; l++) {
+        if (pk * kPacketSize + l >= n) break;
+        Eigen::RowVector3d q(p[0](l), p[1](l), p[2](l));
+        Eigen::RowVector3d c(best_c[0](l), best_c[1](l), best_c[2](l));
+        Eigen::RowVector3d normal;
+        double s;
+        igl::pseudonormal_test(mdr.V,
+                               F,
+                               FN,
+                               VN,
+                               EN,
+                               EMAP,
+                               q,
+                               best_fid(l),
+                               c,
+                               s,
+                               normal);
+        out_S(ids[l]) = (Scalar)s * sqrt(best_sqrd(l));
+        out_C.row(ids[l]) = c.cast<Scalar>();
+      }
+    }
+  }
+}
+
+void MeshDependentResource::ComputeSignedDistanceBatch(
+    const Eigen::MatrixX3d& P,
+    Eigen::VectorXd& out_S,
+    Eigen::MatrixX3d& out_C) const {
+  SignedDistanceBatch<double>(*this, V, &GetTree(), P, out_S, out_C);
+}
+
+void MeshDependentResource::ComputeSignedDistanceBatch(
+    const Eigen::MatrixX3f& P,
+    Eigen::VectorXf& out_S,
+    Eigen::MatrixX3f& out_C) const {
+  const FloatTree& float_tree = init_float_tree();
+  SignedDistanceBatch<float>(
+      *this, float_tree.V, float_tree.nodes.data(), P, out_S, out_C);
+}
+
+const MeshDependentResource::FloatTree& MeshDependentResource::init_float_tree()
+    const {
+  const FloatTree* built = float_tree_ptr_.load(std::memory_order_acquire);
+  if (built != nullptr) return *built;
+  std::lock_guard<std::mutex> lock(float_tree_mutex_);
+  if (float_tree_ != nullptr) return *float_tree_;
+
+  typedef igl::AABB<Eigen::MatrixXd, 3> Tree;
+  const Tree& tree = GetTree();
+  auto float_tree = std::make_shared<FloatTree>();
+  float_tree->V = V.cast<float>();
+
+  // Reserve first so that the child pointers stay valid
+  size_t n_nodes = 0;
+  std::vector<const Tree*> stack{&tree};
+  while (!stack.empty()) {
+    const Tree* node = stack.back();
+    stack.pop_back();
+    n_nodes++;
+    if (node->m_left != nullptr) stack.push_back(node->m_left);
+    if (node->m_right != nullptr) stack.push_back(node->m_right);
+  }
+  std::vector<FloatTree::Node>& nodes = float_tree->nodes;
+  nodes.reserve(n_nodes);
+
+  // Boxes are rounded outwards so that they still bound the triangles
+  auto AddNode = [&nodes](const Tree* node) -> size_t {
+    FloatTree::Node result;
+    for (int k = 0; k < 3; k++) {
+      result.m_box.min()(k) = std::nextafter(
+          (float)node->m_box.min()(k), -std::numeric_limits<float>::max());
+      result.m_box.max()(k) = std::nextafter(
+          (float)node->m_box.max()(k), std::numeric_limits<float>::max());
+    }
+    result.m_primitive = node->m_primitive;
+    nodes.push_back(result);
+    return nodes.size() - 1;
+  };
+  std::vector<std::pair<const Tree*, size_t>> pending{{&tree, AddNode(&tree)}};
+  while (!pending.empty()) {
+    auto [node, id] = pending.back();
+    pending.pop_back();
+    if (node->m_left != nullptr) {
+      size_t left = AddNode(node->m_left);
+      nodes[id].m_left = &nodes[left];
+      pending.push_back({node->m_left, left});
+    }
+    if (node->m_right != nullptr) {
+      size_t right = AddNode(node->m_right);
+      nodes[id].m_right = &nodes[right];
+      pending.push_back({node->m_right, right});
+    }
+  }
+
+  float_tree_ = float_tree;
+  float_tree_ptr_.store(float_tree.get(), std::memory_order_release);
+  return *float_tree;
+}
+
 void MeshDependentResource::ComputeClosestPoint(const Eigen::Vector3d& position,
                                                 Eigen::RowVector3d& out_c,
                                                 int& out_fid) const {
-  tree.squared_distance(V, F, position.transpose(), out_fid, out_c);
+  GetTree().squared_distance(V, F, position.transpose(), out_fid, out_c);
 }
 size_t MeshDependentResource::ComputeClosestFacet(
     const Eigen::Vector3d& position) const {
   Eigen::RowVector3d c;
   int fid;
-  tree.squared_distance(V, F, position.transpose(), fid, c);
+  GetTree().squared_distance(V, F, position.transpose(), fid, c);
   return fid;
 }
 size_t MeshDependentResource::ComputeClosestVertex(
     const Eigen::Vector3d& position) const {
   Eigen::RowVector3d c;
   int fid;
-  tree.squared_distance(V, F, position.transpose(), fid, c);
+  GetTree().squared_distance(V, F, position.transpose(), fid, c);
   double dist = std::numeric_limits<double>::max();
   size_t vid = -1;
   for (size_t i = 0; i < 3; i++) {
@@ -177,7 +738,6 @@ double MeshDependentResource::ComputeRequiredDistance(
     const Eigen::Vector3d& A,
     const Eigen::Vector3d& B,
     Debugger* const debugger) const {
-  init_sp();
   Eigen::RowVector3d dir = B - A;
   double norm = dir.norm();
   if (norm < 1e-12 || isnan(norm)) return 0;
@@ -185,7 +745,8 @@ double MeshDependentResource::ComputeRequiredDistance(
   // std::cout << dir << std::endl;
   std::vector<igl::Hit> hits;
   int numRays;
-  intersector.intersectRay(A.cast<float>(), dir.cast<float>(), hits, numRays);
+  GetIntersector().intersectRay(
+      A.cast<float>(), dir.cast<float>(), hits, numRays);
   bool isIn = hits.size() % 2 == 1;
   size_t lastVid = -1;
   double lastT = 0;
@@ -208,13 +769,14 @@ double MeshDependentResource::ComputeRequiredDistance(
     }
     bestDis = sqrt(bestDis);
     if (isIn) {
-      totalDis += SP_(lastVid, vid) + bestDis + hit.t - lastT;
+      totalDis +=
+          geodesic_->GetDistance(lastVid, vid) + bestDis + hit.t - lastT;
       if (debugger) {
         debugger->AddEdge(A.transpose() + dir * lastT, P, colors::kRed);
-        int cur = lastVid;
-        while (SP_par_(cur, vid) != -1) {
-          debugger->AddEdge(V.row(cur), V.row(SP_par_(cur, vid)), colors::kRed);
-          cur = SP_par_(cur, vid);
+        std::vector<int> path;
+        geodesic_->GetPath(lastVid, vid, path);
+        for (size_t i = 1; i < path.size(); i++) {
+          debugger->AddEdge(V.row(path[i - 1]), V.row(path[i]), colors::kRed);
         }
         debugger->AddEdge(P, V.row(vid), colors::kRed);
         debugger->AddEdge(
@@ -228,14 +790,14 @@ double MeshDependentResource::ComputeRequiredDistance(
   if (isIn) {
     // B is in
     size_t vid = ComputeClosestVertex(B);
-    totalDis +=
-        SP_(lastVid, vid) + (V.row(vid) - B.transpose()).norm() + norm - lastT;
+    totalDis += geodesic_->GetDistance(lastVid, vid) +
+                (V.row(vid) - B.transpose()).norm() + norm - lastT;
     if (debugger) {
       debugger->AddEdge(A.transpose() + dir * lastT, B, colors::kRed);
-      int cur = lastVid;
-      while (SP_par_(cur, vid) != -1) {
-        debugger->AddEdge(V.row(cur), V.row(SP_par_(cur, vid)), colors::kRed);
-        cur = SP_par_(cur, vid);
+      std::vector<int> path;
+      geodesic_->GetPath(lastVid, vid, path);
+      for (size_t i = 1; i < path.size(); i++) {
+        debugger->AddEdge(V.row(path[i - 1]), V.row(path[i]), colors::kRed);
       }
       debugger->AddEdge(B, V.row(vid), colors::kRed);
       debugger->AddEdge(
@@ -255,18 +817,19 @@ static bool TreeIntersectsImpl(const igl::AABB<Eigen::MatrixXd, 3>* tree,
 }
 
 bool MeshDependentResource::Intersects(const Eigen::AlignedBox3d box) const {
-  return TreeIntersectsImpl(&tree, box);
+  return TreeIntersectsImpl(&GetTree(), box);
 }
 
-// Getters
-const Eigen::MatrixXd& MeshDependentResource::GetSP() const {
-  init_sp();
-  return SP_;
+void MeshDependentResource::SetGeodesicCacheCapacity(size_t capacity) {
+  geodesic_->SetCapacity(capacity);
 }
 
-const Eigen::MatrixXi& MeshDependentResource::GetSPPar() const {
-  init_sp();
-  return SP_par_;
+// Getters
+
+const SignedDistanceGrid& MeshDependentResource::GetSDFGrid(
+    double resolution,
+    double band) const {
+  return init_sdf_grid(resolution, band);
 }
 
 /*
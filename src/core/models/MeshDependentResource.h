@@ -3,9 +3,16 @@
 #include <igl/AABB.h>
 #include <igl/embree/EmbreeIntersector.h>
 #include <Eigen/Core>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
 
 #include "../../Constants.h"
 #include "../Debugger.h"
+#include "../GeodesicCache.h"
+#include "../SignedDistanceGrid.h"
 #include "../serialization/Serialization.h"
 
 namespace psg {
@@ -14,32 +21,83 @@ namespace models {
 
 class MeshDependentResource : psg::core::serialization::Serializable {
  public:
+  // Components built by init. The others are built on first use.
+  enum Component : unsigned {
+    kTree = 1 << 0,
+    kIntersector = 1 << 1,
+    // FN, VN, EN, E and EMAP
+    kNormals = 1 << 2,
+    // PD1, PD2, PV1 and PV2
+    kCurvature = 1 << 3,
+    kAllComponents = kTree | kIntersector | kNormals | kCurvature
+  };
+
   Eigen::MatrixXd V;
   Eigen::MatrixXi F;
-  Eigen::MatrixXd FN;
-  Eigen::MatrixXd VN;
-  Eigen::MatrixXd EN;
-  Eigen::MatrixXi E;
-  Eigen::MatrixXi EMAP;
   Eigen::Vector3d center_of_mass;
   Eigen::Vector3d minimum;
   Eigen::Vector3d maximum;
   Eigen::Vector3d size;
-  igl::AABB<Eigen::MatrixXd, 3> tree;
-  igl::embree::EmbreeIntersector intersector;
-  
-  // curvature
-  Eigen::MatrixXd PD1, PD2;
-  Eigen::VectorXd PV1, PV2;
 
  private:
-  // All-pair shortest path
+  mutable igl::AABB<Eigen::MatrixXd, 3> tree_;
+  mutable igl::embree::EmbreeIntersector intersector_;
+  mutable Eigen::MatrixXd FN_;
+  mutable Eigen::MatrixXd VN_;
+  mutable Eigen::MatrixXd EN_;
+  mutable Eigen::MatrixXi E_;
+  mutable Eigen::MatrixXi EMAP_;
+  // curvature
+  mutable Eigen::MatrixXd PD1_, PD2_;
+  mutable Eigen::VectorXd PV1_, PV2_;
+
+  // Bitmask of the components built so far
+  mutable std::atomic<unsigned> components_ = 0;
+  mutable std::mutex components_mutex_;
+  void init_components(unsigned components) const;
+  inline void Require(unsigned components) const {
+    if ((components_.load(std::memory_order_acquire) & components) !=
+        components)
+      init_components(components);
+  }
+
+  // Shortest path along edges, computed per source on demand
   // A proxy for geodesic distance
-  mutable bool SP_valid_ = false;
-  mutable Eigen::MatrixXd SP_;
-  mutable Eigen::MatrixXi SP_par_;
-  mutable std::mutex SP_mutex_;
-  void init_sp() const;
+  // Shared between copies of the same mesh
+  std::shared_ptr<GeodesicCache> geodesic_;
+
+  // Sparse signed distance grids, one per resolution and band
+  // Never replaced until the next init, so that references returned by
+  // GetSDFGrid stay valid when the settings change during an optimization
+  // Shared between copies since they are immutable once built
+  mutable std::vector<std::shared_ptr<const SignedDistanceGrid>> sdf_grids_;
+  // Last grid returned, checked without the lock
+  mutable std::atomic<const SignedDistanceGrid*> sdf_grid_ = nullptr;
+  mutable std::mutex sdf_grid_mutex_;
+  const SignedDistanceGrid& init_sdf_grid(double resolution,
+                                          double band) const;
+
+  // Single precision copy of V and of the AABB tree, with the same node
+  // layout as igl::AABB
+  struct FloatTree {
+    struct Node {
+      Eigen::AlignedBox3f m_box;
+      const Node* m_left = nullptr;
+      const Node* m_right = nullptr;
+      int m_primitive = -1;
+      inline bool is_leaf() const { return m_primitive != -1; }
+    };
+    Eigen::Matrix<float, Eigen::Dynamic, 3> V;
+    // Root first
+    std::vector<Node> nodes;
+  };
+  // Built on first use
+  // Shared between copies since it is immutable once built
+  mutable std::shared_ptr<const FloatTree> float_tree_;
+  // float_tree_.get() once built, checked without the lock
+  mutable std::atomic<const FloatTree*> float_tree_ptr_ = nullptr;
+  mutable std::mutex float_tree_mutex_;
+  const FloatTree& init_float_tree() const;
 
   // Curvature
   /*
@@ -49,10 +107,31 @@ class MeshDependentResource : psg::core::serialization::Serializable {
   void init_curvature() const;
   */
 
-  bool initialized = false;
+  // Cache of the AABB tree, the normals and the curvature, see
+  // SetCacheDirectory
+  static constexpr int kCacheVersion = 2;
+  static constexpr unsigned kCachedComponents = kTree | kNormals | kCurvature;
+  // Empty if the cache is disabled
+  std::string cache_fn_;
+  // Loads the components present in the file, returns them
+  // out_cache_components: components present in the file
+  unsigned LoadCache(const std::string& fn,
+                     unsigned components,
+                     unsigned& out_cache_components) const;
+  void SaveCache(const std::string& fn, unsigned components) const;
 
  public:
-  void init(const Eigen::MatrixXd& V, const Eigen::MatrixXi& F);
+  // Meshes initialized afterwards read their AABB tree, normals and
+  // curvature from <directory>/<hash of V and F>.mdrc when present in it,
+  // and rewrite it whenever one of them is built. Empty to disable, which
+  // is the default.
+  static void SetCacheDirectory(const std::string& directory);
+
+  // V and F are copied, they may be views of a mapped file
+  // components: Component flags
+  void init(const Eigen::Ref<const Eigen::MatrixXd>& V,
+            const Eigen::Ref<const Eigen::MatrixXi>& F,
+            unsigned components = kAllComponents);
   void init(const MeshDependentResource& other);
 
   // out_c: closest point
@@ -61,6 +140,19 @@ class MeshDependentResource : psg::core::serialization::Serializable {
                                Eigen::RowVector3d& out_c,
                                double& out_s) const;
 
+  // Batched ComputeSignedDistance, one query per row of P
+  // out_S: signed distance
+  // out_C: closest point
+  void ComputeSignedDistanceBatch(const Eigen::MatrixX3d& P,
+                                  Eigen::VectorXd& out_S,
+                                  Eigen::MatrixX3d& out_C) const;
+
+  // Single precision ComputeSignedDistanceBatch on the float tree, with
+  // twice as many queries per packet. The sign is still tested in double.
+  void ComputeSignedDistanceBatch(const Eigen::MatrixX3f& P,
+                                  Eigen::VectorXf& out_S,
+                                  Eigen::MatrixX3f& out_C) const;
+
   void ComputeClosestPoint(const Eigen::Vector3d& position,
                            Eigen::RowVector3d& out_c,
                            int& out_fid) const;
@@ -77,9 +169,59 @@ class MeshDependentResource : psg::core::serialization::Serializable {
 
   bool Intersects(const Eigen::AlignedBox3d box) const;
 
+  // Maximum number of shortest path rows kept in memory
+  void SetGeodesicCacheCapacity(size_t capacity);
+
   // Getters
-  const Eigen::MatrixXd& GetSP() const;
-  const Eigen::MatrixXi& GetSPPar() const;
+  // Thread-safe, components are built on first use
+  inline const igl::AABB<Eigen::MatrixXd, 3>& GetTree() const {
+    Require(kTree);
+    return tree_;
+  }
+  inline const igl::embree::EmbreeIntersector& GetIntersector() const {
+    Require(kIntersector);
+    return intersector_;
+  }
+  inline const Eigen::MatrixXd& GetFN() const {
+    Require(kNormals);
+    return FN_;
+  }
+  inline const Eigen::MatrixXd& GetVN() const {
+    Require(kNormals);
+    return VN_;
+  }
+  inline const Eigen::MatrixXd& GetEN() const {
+    Require(kNormals);
+    return EN_;
+  }
+  inline const Eigen::MatrixXi& GetE() const {
+    Require(kNormals);
+    return E_;
+  }
+  inline const Eigen::MatrixXi& GetEMAP() const {
+    Require(kNormals);
+    return EMAP_;
+  }
+  inline const Eigen::MatrixXd& GetPD1() const {
+    Require(kCurvature);
+    return PD1_;
+  }
+  inline const Eigen::MatrixXd& GetPD2() const {
+    Require(kCurvature);
+    return PD2_;
+  }
+  inline const Eigen::VectorXd& GetPV1() const {
+    Require(kCurvature);
+    return PV1_;
+  }
+  inline const Eigen::VectorXd& GetPV2() const {
+    Require(kCurvature);
+    return PV2_;
+  }
+  inline const GeodesicCache& GetGeodesic() const { return *geodesic_; }
+  // Built on first use for each resolution and band
+  // Thread-safe, valid until the next init
+  const SignedDistanceGrid& GetSDFGrid(double resolution, double band) const;
   // const Eigen::VectorXd& GetCurvature() const;
 
   DECL_SERIALIZE() {
@@ -23,9 +23,19 @@ struct OptSettings : psg::core::serialization::Serializable {
   double tolerance = 0;
   nlopt_algorithm algorithm = NLOPT_LD_MMA;
   size_t population = 0;
+  // Number of independent optimizations run in parallel
+  size_t n_starts = 1;
+  // Perturbation of the extra starts, relative to the wiggle range
+  double start_perturbation = 0.5;
+  // Evaluate whole batches of a population search concurrently instead of
+  // using the NLopt algorithm
+  bool batched_population = false;
+  // Only recompute the parts of the gradient-based cost affected by the
+  // parameters that changed since the previous evaluation
+  bool incremental_cost = false;
 
   DECL_SERIALIZE() {
-    constexpr int version = 3;
+    constexpr int version = 7;
     SERIALIZE(version);
     SERIALIZE(max_runtime);
     SERIALIZE(max_iters);
@@ -34,6 +44,10 @@ struct OptSettings : psg::core::serialization::Serializable {
     SERIALIZE(tolerance);
     SERIALIZE(algorithm);
     SERIALIZE(population);
+    SERIALIZE(n_starts);
+    SERIALIZE(start_perturbation);
+    SERIALIZE(batched_population);
+    SERIALIZE(incremental_cost);
   }
 
   DECL_DESERIALIZE() {
@@ -74,7 +88,39 @@ struct OptSettings : psg::core::serialization::Serializable {
       DESERIALIZE(population);
       int unused;
       DESERIALIZE(unused);
-    
+    } else if (version == 5) {
+      DESERIALIZE(max_runtime);
+      DESERIALIZE(max_iters);
+      DESERIALIZE(finger_wiggle);
+      DESERIALIZE(trajectory_wiggle);
+      DESERIALIZE(tolerance);
+      DESERIALIZE(algorithm);
+      DESERIALIZE(population);
+      DESERIALIZE(n_starts);
+      DESERIALIZE(start_perturbation);
+    } else if (version == 6) {
+      DESERIALIZE(max_runtime);
+      DESERIALIZE(max_iters);
+      DESERIALIZE(finger_wiggle);
+      DESERIALIZE(trajectory_wiggle);
+      DESERIALIZE(tolerance);
+      DESERIALIZE(algorithm);
+      DESERIALIZE(population);
+      DESERIALIZE(n_starts);
+      DESERIALIZE(start_perturbation);
+      DESERIALIZE(batched_population);
+    } else if (version == 7) {
+      DESERIALIZE(max_runtime);
+      DESERIALIZE(max_iters);
+      DESERIALIZE(finger_wiggle);
+      DESERIALIZE(trajectory_wiggle);
+      DESERIALIZE(tolerance);
+      DESERIALIZE(algorithm);
+      DESERIALIZE(population);
+      DESERIALIZE(n_starts);
+      DESERIALIZE(start_perturbation);
+      DESERIALIZE(batched_population);
+      DESERIALIZE(incremental_cost);
     }
   }
 };
@@ -87,7 +133,11 @@ inline std::ostream& operator<<(std::ostream& f, const OptSettings& c) {
     << "  trajectory_wiggle: " << c.trajectory_wiggle.transpose() << "\n"
     << "  tolerance: " << c.tolerance << "\n"
     << "  algorithm: " << psg::labels::kAlgorithms[c.algorithm] << "\n"
-    << "  population: " << c.population << std::endl;
+    << "  population: " << c.population << "\n"
+    << "  n_starts: " << c.n_starts << "\n"
+    << "  start_perturbation: " << c.start_perturbation << "\n"
+    << "  batched_population: " << c.batched_population << "\n"
+    << "  incremental_cost: " << c.incremental_cost << std::endl;
   return f;
 }
 
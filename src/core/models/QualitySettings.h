@@ -0,0 +1,44 @@
+#pragma once
+
+#include "../serialization/Serialization.h"
+
+namespace psg {
+namespace core {
+namespace models {
+
+struct QualitySettings : psg::core::serialization::Serializable {
+  // Solver of the quadratic programs of the quality metrics
+  QPSolverEnum qp_solver = QPSolverEnum::kExact;
+  // Also solve with the other solver and count the disagreements, see
+  // GetQPCrossCheckStats
+  bool qp_cross_check = false;
+  // Visit the hull facets of the min wrench metrics nearest first, and skip
+  // those whose hyperplane is farther than the minimum found so far.
+  // Checked against the full scan with qp_cross_check.
+  bool prune_facets = false;
+
+  DECL_SERIALIZE() {
+    constexpr int version = 2;
+    SERIALIZE(version);
+    SERIALIZE(qp_solver);
+    SERIALIZE(qp_cross_check);
+    SERIALIZE(prune_facets);
+  }
+
+  DECL_DESERIALIZE() {
+    int version;
+    DESERIALIZE(version);
+    if (version == 1) {
+      DESERIALIZE(qp_solver);
+      DESERIALIZE(qp_cross_check);
+    } else if (version == 2) {
+      DESERIALIZE(qp_solver);
+      DESERIALIZE(qp_cross_check);
+      DESERIALIZE(prune_facets);
+    }
+  }
+};
+
+}  // namespace models
+}  // namespace core
+}  // namespace psg
@@ -60,10 +60,12 @@ void SettingsOverrider::Apply(psg::core::PassiveGripper& psg) const {
   TopoOptSettings topo_opt_settings = psg.GetTopoOptSettings();
   ContactSettings contact_settings = psg.GetContactSettings();
   CostSettings cost_settings = psg.GetCostSettings();
+  QualitySettings quality_settings = psg.GetQualitySettings();
   bool opt_changed = false;
   bool topo_opt_changed = false;
   bool cost_settings_changed = false;
   bool contact_settings_changed = false;
+  bool quality_settings_changed = false;
 
   auto Contains = [this](const std::string& key, std::string& out_val) -> bool {
     auto it = mp.find(key);
@@ -85,6 +87,22 @@ void SettingsOverrider::Apply(psg::core::PassiveGripper& psg) const {
     opt_settings.population = std::stoull(value);
     opt_changed = true;
   }
+  if (Contains("n_starts", value)) {
+    opt_settings.n_starts = std::stoull(value);
+    opt_changed = true;
+  }
+  if (Contains("start_perturbation", value)) {
+    opt_settings.start_perturbation = std::stod(value);
+    opt_changed = true;
+  }
+  if (Contains("batched_population", value)) {
+    opt_settings.batched_population = std::stoi(value);
+    opt_changed = true;
+  }
+  if (Contains("incremental_cost", value)) {
+    opt_settings.incremental_cost = std::stoi(value);
+    opt_changed = true;
+  }
   if (Contains("max_runtime", value)) {
     opt_settings.max_runtime = std::stod(value);
     opt_changed = true;
@@ -121,6 +139,34 @@ void SettingsOverrider::Apply(psg::core::PassiveGripper& psg) const {
     cost_settings.floor = std::stod(value);
     cost_settings_changed = true;
   }
+  if (Contains("cost.sdf_grid", value)) {
+    cost_settings.sdf_grid = std::stoi(value);
+    cost_settings_changed = true;
+  }
+  if (Contains("cost.sdf_grid_res", value)) {
+    cost_settings.sdf_grid_res = std::stod(value);
+    cost_settings_changed = true;
+  }
+  if (Contains("cost.sdf_grid_band", value)) {
+    cost_settings.sdf_grid_band = std::stod(value);
+    cost_settings_changed = true;
+  }
+  if (Contains("cost.flat_parallel", value)) {
+    cost_settings.flat_parallel = std::stoi(value);
+    cost_settings_changed = true;
+  }
+  if (Contains("cost.hierarchical_min_dist", value)) {
+    cost_settings.hierarchical_min_dist = std::stoi(value);
+    cost_settings_changed = true;
+  }
+  if (Contains("cost.float_evals", value)) {
+    cost_settings.float_evals = std::stoull(value);
+    cost_settings_changed = true;
+  }
+  if (Contains("cost.geodesic_cache_size", value)) {
+    cost_settings.geodesic_cache_size = std::stoull(value);
+    cost_settings_changed = true;
+  }
   if (Contains("contact.floor", value)) {
     contact_settings.floor = std::stod(value);
     contact_settings_changed = true;
@@ -129,11 +175,24 @@ void SettingsOverrider::Apply(psg::core::PassiveGripper& psg) const {
     contact_settings.max_angle = kDegToRad * std::stod(value);
     contact_settings_changed = true;
   }
+  if (Contains("quality.qp_solver", value)) {
+    quality_settings.qp_solver = (QPSolverEnum)std::stoi(value);
+    quality_settings_changed = true;
+  }
+  if (Contains("quality.qp_cross_check", value)) {
+    quality_settings.qp_cross_check = std::stoi(value);
+    quality_settings_changed = true;
+  }
+  if (Contains("quality.prune_facets", value)) {
+    quality_settings.prune_facets = std::stoi(value);
+    quality_settings_changed = true;
+  }
 
   if (opt_changed) psg.SetOptSettings(opt_settings);
   if (topo_opt_changed) psg.SetTopoOptSettings(topo_opt_settings);
   if (contact_settings_changed) psg.SetContactSettings(contact_settings);
   if (cost_settings_changed) psg.SetCostSettings(cost_settings);
+  if (quality_settings_changed) psg.SetQualitySettings(quality_settings);
 
   psg.reinit_fingers = tmp_reinit_fingers;
   psg.reinit_trajectory = tmp_reinit_trajectory;
@@ -13,6 +13,168 @@ static const Eigen::Affine3d globalTrans =
         .finished();
 static const Eigen::Affine3d globalTransInv = globalTrans.inverse();
 
+// Joint frames with each coefficient being either a double or kFKLanes
+// doubles, one per pose. globalTrans is left out and applied by ToAffine.
+template <typename T>
+struct _DHFrames {
+  // frame 0 is the base, frame i + 1 is after joint i
+  T R[kNumDOFs + 1][3][3];
+  T t[kNumDOFs + 1][3];
+};
+
+typedef Eigen::Array<double, kFKLanes, 1> _Lanes;
+
+template <typename T>
+static T Splat(double x);
+template <>
+double Splat<double>(double x) {
+  return x;
+}
+template <>
+_Lanes Splat<_Lanes>(double x) {
+  return _Lanes::Constant(x);
+}
+
+static inline double Lane(double x, size_t) {
+  return x;
+}
+static inline double Lane(const _Lanes& x, size_t lane) {
+  return x(lane);
+}
+
+static inline void CosSin(double x, double& out_c, double& out_s) {
+  out_c = std::cos(x);
+  out_s = std::sin(x);
+}
+
+// Vectorized cos and sin, accurate to a few ulp for joint angles
+// (Cody-Waite reduction to [-pi/4, pi/4] and the Cephes polynomials)
+static inline void CosSin(const _Lanes& x, _Lanes& out_c, _Lanes& out_s) {
+  constexpr double kPio2_1 = 1.57079625129699707031E0;
+  constexpr double kPio2_2 = 7.54978941586159635335E-8;
+  constexpr double kPio2_3 = 5.39030285815811905290E-15;
+  // Adding and subtracting 1.5 * 2^52 rounds to the nearest integer without
+  // relying on SSE4.1
+  constexpr double kRound = 6755399441055744.;
+  _Lanes k = (x * (2. / EIGEN_PI) + kRound) - kRound;
+  _Lanes r = ((x - k * kPio2_1) - k * kPio2_2) - k * kPio2_3;
+  _Lanes z = r * r;
+  // Horner steps as separate statements keep the expressions small enough
+  // to be inlined
+  _Lanes s = 1.58962301576546568060E-10 * z - 2.50507477628578072866E-8;
+  s = s * z + 2.75573136213857245213E-6;
+  s = s * z - 1.98412698295895385996E-4;
+  s = s * z + 8.33333333332211858878E-3;
+  s = s * z - 1.66666666666666307295E-1;
+  s = s * z * r + r;
+  _Lanes c = -1.13585365213876817300E-11 * z + 2.08757008419747316778E-9;
+  c = c * z - 2.75573141792967388112E-7;
+  c = c * z + 2.48015872888517045348E-5;
+  c = c * z - 1.38888888888730564116E-3;
+  c = c * z + 4.16666666666665929218E-2;
+  c = c * z * z - 0.5 * z + 1.;
+  // Quadrant k mod 4 and its two bits. (k - 1.5) / 4 and (q - 0.5) / 2 are
+  // never halfway between integers, so rounding them gives the floor.
+  _Lanes q = k - 4. * (((k - 1.5) * 0.25 + kRound) - kRound);
+  _Lanes hi = ((q - 0.5) * 0.5 + kRound) - kRound;
+  _Lanes swap = q - 2. * hi;
+  _Lanes sinSign = 1. - 2. * hi;
+  _Lanes cosSign = 1. - 2. * (swap + hi - 2. * swap * hi);
+  out_s = sinSign * (swap * c + (1. - swap) * s);
+  out_c = cosSign * (swap * s + (1. - swap) * c);
+}
+
+static const struct _Alpha {
+  double c[kNumDOFs];
+  double s[kNumDOFs];
+  _Alpha() {
+    for (size_t i = 0; i < kNumDOFs; i++) {
+      c[i] = std::cos(kRobotAlpha[i]);
+      s[i] = std::sin(kRobotAlpha[i]);
+    }
+  }
+} kAlpha;
+
+// Chains the DH transforms
+//   Rz(theta_i) * Translation(a_i, 0, d_i) * Rx(alpha_i)
+template <typename T>
+static void ComputeJointFrames(const T* theta, _DHFrames<T>& out_frames) {
+  T c;
+  T s;
+  for (int r = 0; r < 3; r++) {
+    for (int k = 0; k < 3; k++) {
+      out_frames.R[0][r][k] = Splat<T>(r == k ? 1. : 0.);
+    }
+    out_frames.t[0][r] = Splat<T>(0.);
+  }
+  // The base frame is the identity, so frame 1 is the first DH transform
+  {
+    CosSin(theta[0], c, s);
+    auto& R = out_frames.R[1];
+    auto& t = out_frames.t[1];
+    R[0][0] = c;
+    R[0][1] = -s * kAlpha.c[0];
+    R[0][2] = s * kAlpha.s[0];
+    R[1][0] = s;
+    R[1][1] = c * kAlpha.c[0];
+    R[1][2] = -c * kAlpha.s[0];
+    R[2][0] = Splat<T>(0.);
+    R[2][1] = Splat<T>(kAlpha.s[0]);
+    R[2][2] = Splat<T>(kAlpha.c[0]);
+    t[0] = c * kRobotA[0];
+    t[1] = s * kRobotA[0];
+    t[2] = Splat<T>(kRobotD[0]);
+  }
+  for (size_t i = 1; i < kNumDOFs; i++) {
+    CosSin(theta[i], c, s);
+    const double ca = kAlpha.c[i];
+    const double sa = kAlpha.s[i];
+    const auto& R = out_frames.R[i];
+    const auto& t = out_frames.t[i];
+    auto& nR = out_frames.R[i + 1];
+    auto& nt = out_frames.t[i + 1];
+    for (int r = 0; r < 3; r++) {
+      nR[r][0] = R[r][0] * c + R[r][1] * s;
+      T x = R[r][1] * c - R[r][0] * s;
+      nR[r][1] = x * ca + R[r][2] * sa;
+      nR[r][2] = R[r][2] * ca - x * sa;
+      nt[r] = nR[r][0] * kRobotA[i] + R[r][2] * kRobotD[i] + t[r];
+    }
+  }
+}
+
+// globalTrans * frame of the given lane
+template <typename T>
+static Eigen::Affine3d ToAffine(const _DHFrames<T>& frames,
+                                size_t frame,
+                                size_t lane) {
+  const auto& R = frames.R[frame];
+  const auto& t = frames.t[frame];
+  Eigen::Affine3d result;
+  result.matrix().row(3) << 0, 0, 0, 1;
+  // globalTrans maps (x, y, z) to (x, z, -y)
+  for (int k = 0; k < 3; k++) {
+    result.linear()(0, k) = Lane(R[0][k], lane);
+    result.linear()(1, k) = Lane(R[2][k], lane);
+    result.linear()(2, k) = -Lane(R[1][k], lane);
+  }
+  result.translation() << Lane(t[0], lane), Lane(t[2], lane),
+      -Lane(t[1], lane);
+  return result;
+}
+
+// frames: kNumDOFs + 1 joint frames, see _DHFrames
+static void SetJacobian(const Eigen::Affine3d* frames,
+                        JacobianEvaluator& out_J) {
+  for (size_t i = 0; i < kNumDOFs; i++) {
+    out_J.Z.col(i) = frames[i].linear().col(2);
+    out_J.d.col(i) = frames[i].translation();
+    out_J.Zxd.col(i) = out_J.Z.col(i).cross(out_J.d.col(i));
+  }
+  out_J.R = frames[kNumDOFs].linear();
+  out_J.t = frames[kNumDOFs].translation();
+}
+
 static void ForwardImpl(const Pose& jointConfig,
                         Eigen::Matrix3d& out_rot,
                         Eigen::Vector3d& out_trans) {
@@ -40,6 +202,57 @@ Eigen::Affine3d Forward(const Pose& jointConfig) {
   return globalTrans * a;
 }
 
+// Joint frames of poses [begin, begin + kFKLanes), the last pose being
+// repeated past the end
+static void ComputeJointFramesLanes(const std::vector<Pose>& jointConfigs,
+                                    size_t begin,
+                                    _DHFrames<_Lanes>& out_frames) {
+  _Lanes theta[kNumDOFs];
+  for (size_t lane = 0; lane < kFKLanes; lane++) {
+    const Pose& pose =
+        jointConfigs[std::min(begin + lane, jointConfigs.size() - 1)];
+    for (size_t i = 0; i < kNumDOFs; i++) {
+      theta[i](lane) = pose(i);
+    }
+  }
+  ComputeJointFrames(theta, out_frames);
+}
+
+void ForwardBatch(const std::vector<Pose>& jointConfigs,
+                  std::vector<Eigen::Affine3d>& out_trans) {
+  const size_t n = jointConfigs.size();
+  out_trans.resize(n);
+  _DHFrames<_Lanes> frames;
+  for (size_t begin = 0; begin < n; begin += kFKLanes) {
+    ComputeJointFramesLanes(jointConfigs, begin, frames);
+    for (size_t lane = 0; lane < kFKLanes && begin + lane < n; lane++) {
+      out_trans[begin + lane] = ToAffine(frames, kNumDOFs, lane);
+    }
+  }
+}
+
+void ForwardKinematicsBatch(const std::vector<Pose>& jointConfigs,
+                            std::vector<Kinematics>& out_kinematics) {
+  const size_t n = jointConfigs.size();
+  out_kinematics.resize(n);
+  _DHFrames<_Lanes> frames;
+  Eigen::Affine3d affine[kNumDOFs + 1];
+  for (size_t begin = 0; begin < n; begin += kFKLanes) {
+    ComputeJointFramesLanes(jointConfigs, begin, frames);
+    for (size_t lane = 0; lane < kFKLanes && begin + lane < n; lane++) {
+      for (size_t i = 0; i <= kNumDOFs; i++) {
+        affine[i] = ToAffine(frames, i, lane);
+      }
+      Kinematics& out = out_kinematics[begin + lane];
+      out.effector = affine[kNumDOFs];
+      for (size_t i = 0; i < kNumDOFs; i++) {
+        out.joints[i] = affine[i + 1];
+      }
+      SetJacobian(affine, out.jacobian);
+    }
+  }
+}
+
 static bool InverseImpl(const Eigen::Matrix3d& rot,
                         const Eigen::Vector3d& trans,
                         std::vector<Pose>& out_jointConfigs) {
@@ -109,56 +322,48 @@ bool BestInverse(Eigen::Affine3d trans,
   return false;
 }
 
-static Eigen::Affine3d JointTransform(double theta,
-                                      double a,
-                                      double d,
-                                      double alpha) {
-  Eigen::Affine3d result;
-  result = Eigen::AngleAxisd(theta, Eigen::Vector3d::UnitZ()) *
-           Eigen::Translation3d(a, 0, d) *
-           Eigen::AngleAxisd(alpha, Eigen::Vector3d::UnitX());
-  return result;
-}
-
 void ForwardIntermediate(const Pose& jointConfig,
                          std::vector<Eigen::Affine3d>& out_trans) {
+  _DHFrames<double> frames;
+  ComputeJointFrames(jointConfig.data(), frames);
   out_trans.resize(kNumDOFs);
-  out_trans[0] =
-      JointTransform(jointConfig[0], kRobotA[0], kRobotD[0], kRobotAlpha[0]);
-  for (size_t i = 1; i < kNumDOFs; i++) {
-    out_trans[i] =
-        out_trans[i - 1] *
-        JointTransform(jointConfig[i], kRobotA[i], kRobotD[i], kRobotAlpha[i]);
-  }
   for (size_t i = 0; i < kNumDOFs; i++) {
-    out_trans[i] = globalTrans * out_trans[i];
+    out_trans[i] = ToAffine(frames, i + 1, 0);
   }
 }
 
-JacobianFunc ComputeJacobian(const Pose& jointConfig) {
-  std::vector<Eigen::Affine3d> H(kNumDOFs + 1);
-  std::vector<Eigen::Vector3d> Z(kNumDOFs);
-  std::vector<Eigen::Vector3d> d(kNumDOFs);
-
-  H[0].setIdentity();
-  for (size_t i = 0; i < kNumDOFs; i++) {
-    Z[i] = H[i].matrix().block<3, 1>(0, 2).transpose();
-    d[i] = H[i].translation();
-    H[i + 1] =
-        H[i] *
-        JointTransform(jointConfig(i), kRobotA[i], kRobotD[i], kRobotAlpha[i]);
+JacobianEvaluator::JacobianEvaluator(const Pose& jointConfig) {
+  _DHFrames<double> frames;
+  ComputeJointFrames(jointConfig.data(), frames);
+  Eigen::Affine3d affine[kNumDOFs + 1];
+  for (size_t i = 0; i <= kNumDOFs; i++) {
+    affine[i] = ToAffine(frames, i, 0);
   }
+  SetJacobian(affine, *this);
+}
 
-  Eigen::Affine3d Hlast = H.back();
+void JacobianEvaluator::Evaluate(
+    const Eigen::MatrixX3d& P,
+    const Eigen::MatrixX3d& W,
+    Eigen::Matrix<double, Eigen::Dynamic, kNumDOFs>& out_WJ) const {
+  // w . (z x (p - d)) = (p x w) . z - w . (z x d)
+  Eigen::MatrixX3d P_glob = P * R.transpose();
+  P_glob.rowwise() += t.transpose();
+  Eigen::MatrixX3d PxW(P.rows(), 3);
+  PxW.col(0) = P_glob.col(1).cwiseProduct(W.col(2)) -
+               P_glob.col(2).cwiseProduct(W.col(1));
+  PxW.col(1) = P_glob.col(2).cwiseProduct(W.col(0)) -
+               P_glob.col(0).cwiseProduct(W.col(2));
+  PxW.col(2) = P_glob.col(0).cwiseProduct(W.col(1)) -
+               P_glob.col(1).cwiseProduct(W.col(0));
+  out_WJ.resize(P.rows(), kNumDOFs);
+  out_WJ.noalias() = PxW * Z;
+  out_WJ.noalias() -= W * Zxd;
+}
 
-  return [Z, d, Hlast](const Eigen::Vector3d& pos) {
-    Jacobian J;
-    Eigen::Vector3d pos_glob = Hlast * pos;
-    for (size_t i = 0; i < kNumDOFs; i++) {
-      J.block<3, 1>(0, i) = globalTrans * Z[i].cross(pos_glob - d[i]);
-    }
-    return J;
-  };
+JacobianFunc ComputeJacobian(const Pose& jointConfig) {
+  JacobianEvaluator J(jointConfig);
+  return [J](const Eigen::Vector3d& pos) { return J(pos); };
 }
 
 }  // namespace robots
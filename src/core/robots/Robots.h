@@ -13,6 +13,13 @@ namespace robots {
 
 Eigen::Affine3d Forward(const Pose& jointConfig);
 
+// Number of poses evaluated together by the batched kinematics
+constexpr size_t kFKLanes = 4;
+
+// Forward of every pose, from the DH parameters kFKLanes poses at a time
+void ForwardBatch(const std::vector<Pose>& jointConfigs,
+                  std::vector<Eigen::Affine3d>& out_trans);
+
 bool Inverse(Eigen::Affine3d trans, std::vector<Pose>& out_jointConfigs);
 
 bool BestInverse(Eigen::Affine3d trans,
@@ -23,10 +30,60 @@ bool BestInverse(Eigen::Affine3d trans,
 void ForwardIntermediate(const Pose& jointConfig,
                          std::vector<Eigen::Affine3d>& out_trans);
 
+// Jacobian of a point fixed in effector space at a given joint config
+struct JacobianEvaluator {
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  // Joint axes, joint origins and axis x origin, one column per joint
+  Eigen::Matrix<double, 3, kNumDOFs> Z;
+  Eigen::Matrix<double, 3, kNumDOFs> d;
+  Eigen::Matrix<double, 3, kNumDOFs> Zxd;
+  // Effector to global
+  Eigen::Matrix3d R;
+  Eigen::Vector3d t;
+
+  JacobianEvaluator() = default;
+  explicit JacobianEvaluator(const Pose& jointConfig);
+
+  //  pos: position in effector space
+  //  returns: Jacobian [dpos/dtheta_0 | ... | dpos/dtheta_5]
+  inline Jacobian operator()(const Eigen::Vector3d& pos) const {
+    Eigen::Vector3d pos_glob = R * pos + t;
+    Jacobian J;
+    for (size_t i = 0; i < kNumDOFs; i++) {
+      J.col(i) = Z.col(i).cross(pos_glob - d.col(i));
+    }
+    return J;
+  }
+
+  // Batched W(k) * J(P(k)), one point per row of P
+  //  P: positions in effector space
+  //  W: row vectors to multiply the Jacobians with, e.g. dEval/dpos
+  void Evaluate(const Eigen::MatrixX3d& P,
+                const Eigen::MatrixX3d& W,
+                Eigen::Matrix<double, Eigen::Dynamic, kNumDOFs>& out_WJ) const;
+};
+
+// Everything derived from the joint frames of one pose
+struct Kinematics {
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  // Same as Forward
+  Eigen::Affine3d effector;
+  // Same as ForwardIntermediate
+  Eigen::Affine3d joints[kNumDOFs];
+  JacobianEvaluator jacobian;
+};
+
+// Forward, ForwardIntermediate and JacobianEvaluator of every pose sharing
+// the same sin/cos evaluations, kFKLanes poses at a time
+void ForwardKinematicsBatch(const std::vector<Pose>& jointConfigs,
+                            std::vector<Kinematics>& out_kinematics);
 
 // Returns a function that returns Jacobian
 //  pos: position in effector space
 //  out_J: Jacobian [dpos/dtheta_0 | ... | dpos/dtheta_5]
+// Prefer JacobianEvaluator, which avoids the type erasure
 JacobianFunc ComputeJacobian(const Pose& jointConfig);
 
 }  // namespace robots
@@ -0,0 +1,254 @@
+#include "Container.h"
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace psg {
+namespace core {
+namespace serialization {
+
+uint64_t ComputeChecksum(const char* data, size_t size) {
+  // FNV-1a offset basis
+  return ComputeChecksum(data, size, 14695981039346656037ull);
+}
+
+uint64_t ComputeChecksum(const char* data, size_t size, uint64_t seed) {
+  uint64_t hash = seed;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= (unsigned char)data[i];
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+std::string ChunkTagToString(uint32_t tag) {
+  std::string s(4, ' ');
+  for (size_t i = 0; i < 4; i++) {
+    s[i] = (char)((tag >> (8 * i)) & 0xff);
+  }
+  return s;
+}
+
+// ContainerWriter
+
+ContainerWriter::ContainerWriter(std::ostream& f,
+                                 int32_t version,
+                                 bool checksum)
+    : f_(f), start_(f.tellp()) {
+  header_.version = version;
+  header_.magic = kContainerMagic;
+  header_.flags = checksum ? kContainerChecksumFlag : 0;
+  header_.n_chunks = 0;
+  header_.toc_offset = 0;
+  f_.write(reinterpret_cast<const char*>(&header_), sizeof(header_));
+}
+
+void ContainerWriter::Pad(size_t alignment) {
+  static const char zeros[kContainerAlignment] = {};
+  size_t pos = (size_t)(f_.tellp() - start_);
+  size_t padding = (alignment - pos % alignment) % alignment;
+  f_.write(zeros, padding);
+}
+
+void ContainerWriter::AddChunk(uint32_t tag,
+                               ChunkType type,
+                               int64_t rows,
+                               int64_t cols,
+                               const char* data,
+                               size_t size) {
+  Pad(kContainerAlignment);
+  ChunkEntry entry;
+  entry.tag = tag;
+  entry.type = type;
+  entry.rows = rows;
+  entry.cols = cols;
+  entry.offset = (uint64_t)(f_.tellp() - start_);
+  entry.size = size;
+  entry.checksum = (header_.flags & kContainerChecksumFlag)
+                       ? ComputeChecksum(data, size)
+                       : 0;
+  f_.write(data, size);
+  entries_.push_back(entry);
+}
+
+void ContainerWriter::Finish() {
+  Pad(alignof(ChunkEntry));
+  header_.n_chunks = (uint32_t)entries_.size();
+  header_.toc_offset = (uint64_t)(f_.tellp() - start_);
+  f_.write(reinterpret_cast<const char*>(entries_.data()),
+           entries_.size() * sizeof(ChunkEntry));
+  std::streampos end = f_.tellp();
+  f_.seekp(start_);
+  f_.write(reinterpret_cast<const char*>(&header_), sizeof(header_));
+  f_.seekp(end);
+}
+
+// ContainerReader
+
+bool ContainerReader::IsContainer(const char* data, size_t size) {
+  if (size < sizeof(ContainerHeader)) return false;
+  ContainerHeader header;
+  std::memcpy(&header, data, sizeof(header));
+  return header.magic == kContainerMagic;
+}
+
+ContainerReader::ContainerReader(const char* data,
+                                 size_t size,
+                                 bool verify_checksum)
+    : data_(data), size_(size) {
+  if (!IsContainer(data, size)) {
+    throw std::runtime_error("Not a chunked container");
+  }
+  std::memcpy(&header_, data, sizeof(header_));
+  if (header_.toc_offset > size_ ||
+      header_.n_chunks > (size_ - header_.toc_offset) / sizeof(ChunkEntry)) {
+    throw std::runtime_error("Truncated table of contents");
+  }
+  entries_.resize(header_.n_chunks);
+  std::memcpy(entries_.data(),
+              data_ + header_.toc_offset,
+              entries_.size() * sizeof(ChunkEntry));
+
+  for (const ChunkEntry& entry : entries_) {
+    std::string name = ChunkTagToString(entry.tag);
+    if (entry.offset > size_ || entry.size > size_ - entry.offset) {
+      throw std::runtime_error("Truncated chunk " + name);
+    }
+    if (entry.offset % kContainerAlignment != 0) {
+      throw std::runtime_error("Misaligned chunk " + name);
+    }
+    size_t scalar_size = 0;
+    switch (entry.type) {
+      case ChunkType::kObject:
+        scalar_size = 1;
+        break;
+      case ChunkType::kDouble:
+        scalar_size = sizeof(double);
+        break;
+      case ChunkType::kInt:
+        scalar_size = sizeof(int32_t);
+        break;
+      case ChunkType::kFloat:
+        scalar_size = sizeof(float);
+        break;
+      default:
+        throw std::runtime_error("Unknown type of chunk " + name);
+    }
+    if (entry.rows < 0 || entry.cols < 0 ||
+        (uint64_t)entry.rows * (uint64_t)entry.cols * scalar_size !=
+            entry.size) {
+      throw std::runtime_error("Inconsistent size of chunk " + name);
+    }
+    if (verify_checksum && (header_.flags & kContainerChecksumFlag) &&
+        ComputeChecksum(data_ + entry.offset, entry.size) != entry.checksum) {
+      throw std::runtime_error("Checksum mismatch in chunk " + name);
+    }
+  }
+}
+
+bool ContainerReader::Has(uint32_t tag) const {
+  return std::any_of(entries_.begin(),
+                     entries_.end(),
+                     [tag](const ChunkEntry& e) { return e.tag == tag; });
+}
+
+const ChunkEntry& ContainerReader::Find(uint32_t tag, ChunkType type) const {
+  for (const ChunkEntry& entry : entries_) {
+    if (entry.tag != tag) continue;
+    if (entry.type != type) {
+      throw std::runtime_error("Unexpected type of chunk " +
+                               ChunkTagToString(tag));
+    }
+    return entry;
+  }
+  throw std::runtime_error("Missing chunk " + ChunkTagToString(tag));
+}
+
+// MappedFile
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string& fn) {
+  HANDLE file = CreateFileA(fn.c_str(),
+                            GENERIC_READ,
+                            FILE_SHARE_READ,
+                            NULL,
+                            OPEN_EXISTING,
+                            FILE_ATTRIBUTE_NORMAL,
+                            NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    throw std::invalid_argument("Cannot open file " + fn);
+  }
+  file_ = file;
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size)) {
+    CloseHandle(file);
+    throw std::invalid_argument("Cannot read size of file " + fn);
+  }
+  size_ = (size_t)size.QuadPart;
+  // Empty files cannot be mapped
+  if (size_ == 0) return;
+  HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (mapping == NULL) {
+    CloseHandle(file);
+    throw std::invalid_argument("Cannot map file " + fn);
+  }
+  mapping_ = mapping;
+  data_ = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if (data_ == nullptr) {
+    CloseHandle(mapping);
+    CloseHandle(file);
+    throw std::invalid_argument("Cannot map file " + fn);
+  }
+}
+
+MappedFile::~MappedFile() {
+  if (data_ != nullptr) UnmapViewOfFile(data_);
+  if (mapping_ != nullptr) CloseHandle(mapping_);
+  if (file_ != nullptr) CloseHandle(file_);
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& fn) {
+  fd_ = open(fn.c_str(), O_RDONLY);
+  if (fd_ < 0) {
+    throw std::invalid_argument("Cannot open file " + fn);
+  }
+  struct stat st;
+  if (fstat(fd_, &st) != 0) {
+    close(fd_);
+    throw std::invalid_argument("Cannot read size of file " + fn);
+  }
+  size_ = (size_t)st.st_size;
+  // Empty files cannot be mapped
+  if (size_ == 0) return;
+  void* data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+  if (data == MAP_FAILED) {
+    close(fd_);
+    throw std::invalid_argument("Cannot map file " + fn);
+  }
+  data_ = (const char*)data;
+}
+
+MappedFile::~MappedFile() {
+  if (data_ != nullptr) munmap(const_cast<char*>(data_), size_);
+  if (fd_ >= 0) close(fd_);
+}
+
+#endif
+
+}  // namespace serialization
+}  // namespace core
+}  // namespace psg
@@ -0,0 +1,216 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "Serialization.h"
+
+namespace psg {
+namespace core {
+namespace serialization {
+
+// Chunked binary container
+//
+// Layout:
+//   ContainerHeader, padded to kContainerAlignment bytes
+//   Chunks, each starting at a multiple of kContainerAlignment
+//   Table of contents: one ChunkEntry per chunk, at header.toc_offset
+//
+// Matrix chunks hold the raw coefficients in column-major order so that they
+// can be viewed in place with Eigen::Map. Object chunks hold the output of
+// Serialize. Offsets are relative to the start of the header. Like the rest
+// of the serialization, values are stored in host byte order.
+
+constexpr size_t kContainerAlignment = 64;
+constexpr uint32_t kContainerChecksumFlag = 1;
+
+constexpr uint32_t MakeChunkTag(const char (&name)[5]) {
+  return (uint32_t)(unsigned char)name[0] |
+         (uint32_t)(unsigned char)name[1] << 8 |
+         (uint32_t)(unsigned char)name[2] << 16 |
+         (uint32_t)(unsigned char)name[3] << 24;
+}
+
+constexpr uint32_t kContainerMagic = MakeChunkTag("PSGC");
+
+enum class ChunkType : uint32_t { kObject, kDouble, kInt, kFloat };
+
+struct ContainerHeader {
+  // Format version of the owner. Comes first so that readers of the older,
+  // unchunked formats can dispatch on it.
+  int32_t version;
+  uint32_t magic;
+  uint32_t flags;
+  uint32_t n_chunks;
+  uint64_t toc_offset;
+};
+static_assert(sizeof(ContainerHeader) == 24, "Unexpected padding");
+
+struct ChunkEntry {
+  uint32_t tag;
+  ChunkType type;
+  // Matrix dimensions, size in bytes and 1 for object chunks
+  int64_t rows;
+  int64_t cols;
+  uint64_t offset;
+  uint64_t size;
+  // FNV-1a of the chunk if kContainerChecksumFlag is set, 0 otherwise
+  uint64_t checksum;
+};
+static_assert(sizeof(ChunkEntry) == 48, "Unexpected padding");
+
+// FNV-1a
+uint64_t ComputeChecksum(const char* data, size_t size);
+// Continues from seed, the checksum of the preceding bytes. Chained calls
+// give the checksum of the concatenated buffers.
+uint64_t ComputeChecksum(const char* data, size_t size, uint64_t seed);
+
+std::string ChunkTagToString(uint32_t tag);
+
+template <typename Scalar>
+constexpr ChunkType GetChunkType() {
+  static_assert(std::is_same_v<Scalar, double> || std::is_same_v<Scalar, int> ||
+                    std::is_same_v<Scalar, float>,
+                "Unsupported matrix scalar");
+  if constexpr (std::is_same_v<Scalar, double>) {
+    return ChunkType::kDouble;
+  } else if constexpr (std::is_same_v<Scalar, int>) {
+    static_assert(sizeof(int) == 4, "Chunks store 32 bit integers");
+    return ChunkType::kInt;
+  } else {
+    return ChunkType::kFloat;
+  }
+}
+
+// Read-only view of a byte range as a stream buffer
+class MemoryStreamBuffer : public std::streambuf {
+ public:
+  MemoryStreamBuffer(const char* data, size_t size) {
+    // std::streambuf only takes mutable pointers but never writes through
+    // the get area
+    char* p = const_cast<char*>(data);
+    setg(p, p, p + size);
+  }
+};
+
+// Writes a container to a seekable stream
+class ContainerWriter {
+ public:
+  ContainerWriter(std::ostream& f, int32_t version, bool checksum);
+
+  template <typename T>
+  void AddObject(uint32_t tag, const T& obj) {
+    std::ostringstream s(std::ios::out | std::ios::binary);
+    Serialize(obj, s);
+    const std::string buf = s.str();
+    AddChunk(tag, ChunkType::kObject, buf.size(), 1, buf.data(), buf.size());
+  }
+
+  template <typename Scalar>
+  void AddMatrix(
+      uint32_t tag,
+      const Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>& m) {
+    AddChunk(tag,
+             GetChunkType<Scalar>(),
+             m.rows(),
+             m.cols(),
+             reinterpret_cast<const char*>(m.data()),
+             m.size() * sizeof(Scalar));
+  }
+
+  // Writes the table of contents and completes the header
+  void Finish();
+
+ private:
+  void AddChunk(uint32_t tag,
+                ChunkType type,
+                int64_t rows,
+                int64_t cols,
+                const char* data,
+                size_t size);
+  void Pad(size_t alignment);
+
+  std::ostream& f_;
+  std::streampos start_;
+  ContainerHeader header_;
+  std::vector<ChunkEntry> entries_;
+};
+
+// Reads a container in place. data must outlive the reader and any matrix
+// returned by GetMatrix. Throws std::runtime_error on malformed data.
+class ContainerReader {
+ public:
+  ContainerReader(const char* data, size_t size, bool verify_checksum = true);
+
+  static bool IsContainer(const char* data, size_t size);
+
+  template <typename T>
+  void GetObject(uint32_t tag, T& out_obj) const {
+    const ChunkEntry& entry = Find(tag, ChunkType::kObject);
+    MemoryStreamBuffer buf(data_ + entry.offset, entry.size);
+    std::istream s(&buf);
+    Deserialize(out_obj, s);
+    if (!s) {
+      throw std::runtime_error("Truncated chunk " + ChunkTagToString(tag));
+    }
+  }
+
+  template <typename Scalar>
+  Eigen::Map<const Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>>
+  GetMatrix(uint32_t tag) const {
+    const ChunkEntry& entry = Find(tag, GetChunkType<Scalar>());
+    return Eigen::Map<
+        const Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>>(
+        reinterpret_cast<const Scalar*>(data_ + entry.offset),
+        entry.rows,
+        entry.cols);
+  }
+
+  bool Has(uint32_t tag) const;
+
+  inline const ContainerHeader& GetHeader() const { return header_; }
+  inline const std::vector<ChunkEntry>& GetEntries() const { return entries_; }
+
+ private:
+  const ChunkEntry& Find(uint32_t tag, ChunkType type) const;
+
+  const char* data_;
+  size_t size_;
+  ContainerHeader header_;
+  std::vector<ChunkEntry> entries_;
+};
+
+// Read-only memory mapping of a whole file
+class MappedFile {
+ public:
+  // Throws std::invalid_argument if the file cannot be opened or mapped
+  explicit MappedFile(const std::string& fn);
+  ~MappedFile();
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  inline const char* GetData() const { return data_; }
+  inline size_t GetSize() const { return size_; }
+
+ private:
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+#ifdef _WIN32
+  void* file_ = nullptr;
+  void* mapping_ = nullptr;
+#else
+  int fd_ = -1;
+#endif
+};
+
+}  // namespace serialization
+}  // namespace core
+}  // namespace psg
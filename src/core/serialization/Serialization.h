@@ -4,6 +4,8 @@
 #include <Eigen/Sparse>
 #include <fstream>
 #include <iostream>
+#include <istream>
+#include <ostream>
 #include <map>
 #include <string>
 #include <type_traits>
@@ -14,73 +16,73 @@ namespace core {
 namespace serialization {
 
 struct Serializable {
-  virtual void Serialize(std::ofstream& f) const = 0;
-  virtual void Deserialize(std::ifstream& f) = 0;
+  virtual void Serialize(std::ostream& f) const = 0;
+  virtual void Deserialize(std::istream& f) = 0;
 };
 
 // Serializable
 template <typename T,
           std::enable_if_t<std::is_base_of_v<Serializable, T>, bool> = true>
-inline void Serialize(const T& obj, std::ofstream& f);
+inline void Serialize(const T& obj, std::ostream& f);
 template <typename T,
           std::enable_if_t<std::is_base_of_v<Serializable, T>, bool> = true>
-inline void Deserialize(T& obj, std::ifstream& f);
+inline void Deserialize(T& obj, std::istream& f);
 
 // Arithmetic types
 template <
     typename T,
     std::enable_if_t<std::is_arithmetic<T>::value || std::is_enum<T>::value,
                      bool> = true>
-inline void Serialize(const T& obj, std::ofstream& f);
+inline void Serialize(const T& obj, std::ostream& f);
 template <
     typename T,
     std::enable_if_t<std::is_arithmetic<T>::value || std::is_enum<T>::value,
                      bool> = true>
-inline void Deserialize(T& obj, std::ifstream& f);
+inline void Deserialize(T& obj, std::istream& f);
 
 // std::string
-inline void Serialize(const std::string& obj, std::ofstream& f);
-inline void Deserialize(std::string& obj, std::ifstream& f);
+inline void Serialize(const std::string& obj, std::ostream& f);
+inline void Deserialize(std::string& obj, std::istream& f);
 
 // std::vector
 template <typename T1, typename T2>
-inline void Serialize(const std::vector<T1, T2>& obj, std::ofstream& f);
+inline void Serialize(const std::vector<T1, T2>& obj, std::ostream& f);
 template <typename T1, typename T2>
-inline void Deserialize(std::vector<T1, T2>& obj, std::ifstream& f);
+inline void Deserialize(std::vector<T1, T2>& obj, std::istream& f);
 
 // std::map
 template <typename T1, typename T2>
-inline void Serialize(const std::map<T1, T2>& obj, std::ofstream& f);
+inline void Serialize(const std::map<T1, T2>& obj, std::ostream& f);
 template <typename T1, typename T2>
-inline void Deserialize(std::map<T1, T2>& obj, std::ifstream& f);
+inline void Deserialize(std::map<T1, T2>& obj, std::istream& f);
 
 // Eigen::Array
 template <typename T, int R, int C, int P, int MR, int MC>
 inline void Serialize(const Eigen::Array<T, R, C, P, MR, MC>& obj,
-                      std::ofstream& f);
+                      std::ostream& f);
 template <typename T, int R, int C, int P, int MR, int MC>
 inline void Deserialize(Eigen::Array<T, R, C, P, MR, MC>& obj,
-                        std::ifstream& f);
+                        std::istream& f);
 
 // Eigen::Matrix
 template <typename T, int R, int C, int P, int MR, int MC>
 inline void Serialize(const Eigen::Matrix<T, R, C, P, MR, MC>& obj,
-                      std::ofstream& f);
+                      std::ostream& f);
 template <typename T, int R, int C, int P, int MR, int MC>
 inline void Deserialize(Eigen::Matrix<T, R, C, P, MR, MC>& obj,
-                        std::ifstream& f);
+                        std::istream& f);
 
 //============== IMPLEMENTATION =================
 
 // Serializable
 template <typename T,
           std::enable_if_t<std::is_base_of_v<Serializable, T>, bool> = true>
-  void Serialize(const T& obj, std::ofstream& f) {
+  void Serialize(const T& obj, std::ostream& f) {
   static_cast<const Serializable*>(&obj)->Serialize(f);
 }
 template <typename T,
           std::enable_if_t<std::is_base_of_v<Serializable, T>, bool> = true>
-  void Deserialize(T& obj, std::ifstream& f) {
+  void Deserialize(T& obj, std::istream& f) {
   static_cast<Serializable*>(&obj)->Deserialize(f);
 }
 
@@ -89,7 +91,7 @@ template <
     typename T,
     std::enable_if_t<std::is_arithmetic<T>::value || std::is_enum<T>::value,
                      bool> = true>
-void Serialize(const T& obj, std::ofstream& f) {
+void Serialize(const T& obj, std::ostream& f) {
   f.write(reinterpret_cast<const char*>(&obj), sizeof(obj));
 }
 
@@ -97,29 +99,26 @@ template <
     typename T,
     std::enable_if_t<std::is_arithmetic<T>::value || std::is_enum<T>::value,
                      bool> = true>
-void Deserialize(T& obj, std::ifstream& f) {
+void Deserialize(T& obj, std::istream& f) {
   f.read((char*)&obj, sizeof(obj));
 }
 
 // std::string
-void Serialize(const std::string& obj, std::ofstream& f) {
+void Serialize(const std::string& obj, std::ostream& f) {
   Serialize(obj.size(), f);
   f.write(obj.c_str(), obj.size());
 }
 
-void Deserialize(std::string& obj, std::ifstream& f) {
+void Deserialize(std::string& obj, std::istream& f) {
   size_t size = 0;
   Deserialize(size, f);
-  char* buf = new char[size + 1];
-  f.read(buf, size);
-  buf[size] = 0;
-  obj = buf;
-  delete buf;
+  obj.resize(size);
+  f.read(obj.data(), size);
 }
 
 // std::vector
 template <typename T1, typename T2>
-void Serialize(const std::vector<T1, T2>& obj, std::ofstream& f) {
+void Serialize(const std::vector<T1, T2>& obj, std::ostream& f) {
   Serialize(obj.size(), f);
   for (size_t i = 0; i < obj.size(); i++) {
     Serialize(obj[i], f);
@@ -127,7 +126,7 @@ void Serialize(const std::vector<T1, T2>& obj, std::ofstream& f) {
 }
 
 template <typename T1, typename T2>
-void Deserialize(std::vector<T1, T2>& obj, std::ifstream& f) {
+void Deserialize(std::vector<T1, T2>& obj, std::istream& f) {
   size_t size;
   Deserialize(size, f);
   obj.resize(size);
@@ -138,7 +137,7 @@ void Deserialize(std::vector<T1, T2>& obj, std::ifstream& f) {
 
 // std::map
 template <typename T1, typename T2>
-void Serialize(const std::map<T1, T2>& obj, std::ofstream& f) {
+void Serialize(const std::map<T1, T2>& obj, std::ostream& f) {
   Serialize(obj.size());
   for (const auto& kv : obj) {
     Serialize(kv.first, f);
@@ -147,7 +146,7 @@ void Serialize(const std::map<T1, T2>& obj, std::ofstream& f) {
 }
 
 template <typename T1, typename T2>
-void Deserialize(std::map<T1, T2>& obj, std::ifstream& f) {
+void Deserialize(std::map<T1, T2>& obj, std::istream& f) {
   size_t size;
   Deserialize(size, f);
   obj.clear();
@@ -163,46 +162,64 @@ void Deserialize(std::map<T1, T2>& obj, std::ifstream& f) {
 // Eigen::Array
 
 template <typename T, int R, int C, int P, int MR, int MC>
-void Serialize(const Eigen::Array<T, R, C, P, MR, MC>& obj, std::ofstream& f) {
+void Serialize(const Eigen::Array<T, R, C, P, MR, MC>& obj, std::ostream& f) {
   Serialize(obj.rows(), f);
   Serialize(obj.cols(), f);
-  for (long long i = 0; i < obj.size(); i++) {
-    Serialize(obj(i), f);
+  if constexpr (std::is_arithmetic<T>::value) {
+    // Coefficients are stored in storage order, same as obj(i)
+    f.write(reinterpret_cast<const char*>(obj.data()), obj.size() * sizeof(T));
+  } else {
+    for (long long i = 0; i < obj.size(); i++) {
+      Serialize(obj(i), f);
+    }
   }
 }
 
 template <typename T, int R, int C, int P, int MR, int MC>
-void Deserialize(Eigen::Array<T, R, C, P, MR, MC>& obj, std::ifstream& f) {
+void Deserialize(Eigen::Array<T, R, C, P, MR, MC>& obj, std::istream& f) {
   long long rows;
   long long cols;
   Deserialize(rows, f);
   Deserialize(cols, f);
   obj.resize(rows, cols);
-  for (long long i = 0; i < obj.size(); i++) {
-    Deserialize(obj(i), f);
+  if constexpr (std::is_arithmetic<T>::value) {
+    f.read(reinterpret_cast<char*>(obj.data()), obj.size() * sizeof(T));
+  } else {
+    for (long long i = 0; i < obj.size(); i++) {
+      Deserialize(obj(i), f);
+    }
   }
 }
 
 // Eigen::Matrix
 
 template <typename T, int R, int C, int P, int MR, int MC>
-void Serialize(const Eigen::Matrix<T, R, C, P, MR, MC>& obj, std::ofstream& f) {
+void Serialize(const Eigen::Matrix<T, R, C, P, MR, MC>& obj, std::ostream& f) {
   Serialize(obj.rows(), f);
   Serialize(obj.cols(), f);
-  for (long long i = 0; i < obj.size(); i++) {
-    Serialize(obj(i), f);
+  if constexpr (std::is_arithmetic<T>::value) {
+    // Coefficients are stored in storage order, same as obj(i)
+    f.write(reinterpret_cast<const char*>(obj.data()), obj.size() * sizeof(T));
+  } else {
+    for (long long i = 0; i < obj.size(); i++) {
+      Serialize(obj(i), f);
+    }
   }
 }
 
 template <typename T, int R, int C, int P, int MR, int MC>
-void Deserialize(Eigen::Matrix<T, R, C, P, MR, MC>& obj, std::ifstream& f) {
+void Deserialize(Eigen::Matrix<T, R, C, P, MR, MC>& obj, std::istream& f) {
   long long rows;
   long long cols;
   Deserialize(rows, f);
   Deserialize(cols, f);
   obj.resize(rows, cols);
-  for (long long i = 0; i < obj.size(); i++) {
-    Deserialize(obj(i), f);
+  if constexpr (std::is_arithmetic<T>::value) {
+    f.read(reinterpret_cast<char*>(obj.data()), obj.size() * sizeof(T));
+  } else {
+    for (long long i = 0; i < obj.size(); i++) {
+      Deserialize(obj(i), f);
+    }
   }
 }
 
@@ -212,6 +229,6 @@ void Deserialize(Eigen::Matrix<T, R, C, P, MR, MC>& obj, std::ifstream& f) {
 
 #define SERIALIZE(obj) psg::core::serialization::Serialize(obj, f)
 #define DESERIALIZE(obj) psg::core::serialization::Deserialize(obj, f)
-#define DECL_SERIALIZE() inline void Serialize(std::ofstream& f) const override
-#define DECL_DESERIALIZE() inline void Deserialize(std::ifstream& f) override
+#define DECL_SERIALIZE() inline void Serialize(std::ostream& f) const override
+#define DECL_DESERIALIZE() inline void Deserialize(std::istream& f) override
 
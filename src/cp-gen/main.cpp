@@ -1,14 +1,17 @@
 #include <omp.h>
 #include <chrono>
 #include <cstring>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "../Constants.h"
 #include "../core/Initialization.h"
 #include "../core/PassiveGripper.h"
+#include "../core/QualityMetric.h"
 #include "../core/robots/Robots.h"
 #include "../core/serialization/Serialization.h"
 #include "../utils.h"
@@ -17,8 +20,37 @@ int main(int argc, char** argv) {
   Log() << "Num threads: " << omp_get_max_threads() << std::endl;
   if (argc < 3) {
     Error() << "input .psg file and output .cpx file required" << std::endl;
+    Error() << "Usage: " << argv[0]
+            << " psg cpx [--seed seed] [--qp exact|fast] [--prune-facets]"
+               " [--qp-cross-check] [--min-distance d]"
+            << std::endl;
     return 1;
   }
+  // The output only depends on the seed, not on the number of threads
+  unsigned int seed = 0;
+  std::string qp_solver;
+  bool qp_cross_check = false;
+  bool prune_facets = false;
+  double min_distance = 0;
+  for (int i = 3; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--seed" && i + 1 < argc) {
+      seed = (unsigned int)std::stoul(argv[i + 1]);
+      i++;
+    } else if (arg == "--qp" && i + 1 < argc) {
+      qp_solver = argv[i + 1];
+      i++;
+    } else if (arg == "--min-distance" && i + 1 < argc) {
+      min_distance = std::stod(argv[i + 1]);
+      i++;
+    } else if (arg == "--prune-facets") {
+      prune_facets = true;
+    } else if (arg == "--qp-cross-check") {
+      qp_cross_check = true;
+    } else {
+      Error() << "Unknown option " << arg << std::endl;
+    }
+  }
   std::string psg_fn = argv[1];
   std::ifstream psg_f(psg_fn, std::ios::in | std::ios::binary);
   if (!psg_f.is_open()) {
@@ -26,21 +58,76 @@ int main(int argc, char** argv) {
     return 1;
   }
 
+  // Mesh acceleration structures are cached next to the psg
+  psg::core::models::MeshDependentResource::SetCacheDirectory(
+      std::filesystem::absolute(psg_fn).parent_path().string());
   psg::core::PassiveGripper psg;
   psg.Deserialize(psg_f);
 
+  psg::core::models::QualitySettings quality_settings =
+      psg.GetQualitySettings();
+  if (qp_solver == "exact") {
+    quality_settings.qp_solver = psg::QPSolverEnum::kExact;
+  } else if (qp_solver == "fast") {
+    quality_settings.qp_solver = psg::QPSolverEnum::kFast;
+  } else if (!qp_solver.empty()) {
+    Error() << "Unknown QP solver " << qp_solver << std::endl;
+  }
+  quality_settings.qp_cross_check |= qp_cross_check;
+  quality_settings.prune_facets |= prune_facets;
+  psg.SetQualitySettings(quality_settings);
+  Log() << "QP solver: "
+        << psg::kQPSolvers[(int)quality_settings.qp_solver] << std::endl;
+  psg::core::ResetQPCrossCheckStats();
+
   size_t n_seeds = 1000;
   size_t n_candidates = 3000;
   psg::core::models::ContactPointFilter cp_filter_1;
+  cp_filter_1.min_distance = min_distance;
 
+  psg::core::ContactPointStats stats;
   auto start_time = std::chrono::high_resolution_clock::now();
   auto cps = psg::core::InitializeContactPoints(
-      psg, cp_filter_1, n_candidates, n_seeds);
+      psg, cp_filter_1, n_candidates, n_seeds, seed, &stats);
   auto stop_time = std::chrono::high_resolution_clock::now();
   long long duration = std::chrono::duration_cast<std::chrono::milliseconds>(
                            stop_time - start_time)
                            .count();
 
+  Log() << "Seeds: " << stats.n_seeds << std::endl;
+  Log() << "Triplets passing each stage:" << std::endl;
+  const std::pair<const char*, size_t> stages[] = {
+      {"trials", stats.n_trials},
+      {"distinct", stats.n_distinct},
+      {"spread", stats.n_spread},
+      {"opposition", stats.n_opposition},
+      {"partial closure", stats.n_partial_closure},
+      {"approach", stats.n_approach}};
+  size_t n_prev = stats.n_trials;
+  for (const auto& stage : stages) {
+    Log() << "  " << stage.first << ": " << stage.second << " ("
+          << (n_prev == 0 ? 0. : 100. * stage.second / n_prev) << "%)"
+          << std::endl;
+    n_prev = stage.second;
+  }
+  if (quality_settings.qp_cross_check) {
+    psg::core::QPCrossCheckStats qp_stats = psg::core::GetQPCrossCheckStats();
+    Log() << "QP cross-check: " << qp_stats.n_disagreements << "/"
+          << qp_stats.n_checks << " disagreements ("
+          << (qp_stats.n_checks == 0
+                  ? 0.
+                  : 100. * qp_stats.n_disagreements / qp_stats.n_checks)
+          << "%)" << std::endl;
+    if (quality_settings.prune_facets) {
+      Log() << "Facet pruning cross-check: " << qp_stats.n_prune_disagreements
+            << "/" << qp_stats.n_prune_checks << " disagreements ("
+            << (qp_stats.n_prune_checks == 0
+                    ? 0.
+                    : 100. * qp_stats.n_prune_disagreements /
+                          qp_stats.n_prune_checks)
+            << "%)" << std::endl;
+    }
+  }
   Log() << cps.size() << " candidates generated" << std::endl;
   Log() << "Contact Point Generation took " << duration << " ms." << std::endl;
 
@@ -0,0 +1,175 @@
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "../core/PassiveGripper.h"
+#include "../core/serialization/Container.h"
+#include "../utils.h"
+
+using namespace psg::core::serialization;
+using psg::core::PassiveGripper;
+using psg::core::models::GripperParams;
+using psg::core::models::GripperSettings;
+
+void Usage(char* argv0) {
+  Error() << "Usage: " << argv0
+          << " psg [out-psg] [--version 2|3] [--no-checksum]" << std::endl
+          << "  Prints the layout of psg if out-psg is not given" << std::endl;
+}
+
+static void PrintInfo(const std::string& psg_fn) {
+  MappedFile file(psg_fn);
+  if (!ContainerReader::IsContainer(file.GetData(), file.GetSize())) {
+    int version = 0;
+    if (file.GetSize() >= sizeof(version)) {
+      std::memcpy(&version, file.GetData(), sizeof(version));
+    }
+    Log() << psg_fn << ": version " << version << ", unchunked" << std::endl;
+    return;
+  }
+  ContainerReader reader(file.GetData(), file.GetSize());
+  const ContainerHeader& header = reader.GetHeader();
+  Log() << psg_fn << ": version " << header.version << ", "
+        << header.n_chunks << " chunks"
+        << ((header.flags & kContainerChecksumFlag) ? ", checksummed" : "")
+        << std::endl;
+  for (const ChunkEntry& entry : reader.GetEntries()) {
+    Log() << "  " << ChunkTagToString(entry.tag) << " type " << (int)entry.type
+          << " " << entry.rows << "x" << entry.cols << " at " << entry.offset
+          << " (" << entry.size << " bytes)" << std::endl;
+  }
+}
+
+// Fields of a psg, transcoded without building a PassiveGripper
+struct PsgData {
+  Eigen::MatrixXd V;
+  Eigen::MatrixXi F;
+  GripperParams params;
+  GripperSettings settings;
+  int remesh_version = 0;
+  Eigen::MatrixXd RV;
+  Eigen::MatrixXi RF;
+};
+
+static void ReadPsg(const std::string& psg_fn, PsgData& out_data) {
+  MappedFile file(psg_fn);
+  if (ContainerReader::IsContainer(file.GetData(), file.GetSize())) {
+    ContainerReader reader(file.GetData(), file.GetSize());
+    out_data.V = reader.GetMatrix<double>(PassiveGripper::kChunkV);
+    out_data.F = reader.GetMatrix<int>(PassiveGripper::kChunkF);
+    reader.GetObject(PassiveGripper::kChunkParams, out_data.params);
+    reader.GetObject(PassiveGripper::kChunkSettings, out_data.settings);
+    reader.GetObject(PassiveGripper::kChunkRemeshVersion,
+                     out_data.remesh_version);
+    out_data.RV = reader.GetMatrix<double>(PassiveGripper::kChunkRemeshV);
+    out_data.RF = reader.GetMatrix<int>(PassiveGripper::kChunkRemeshF);
+    return;
+  }
+
+  MemoryStreamBuffer buf(file.GetData(), file.GetSize());
+  std::istream f(&buf);
+  int version;
+  DESERIALIZE(version);
+  if (version != 1 && version != 2) {
+    throw std::runtime_error("Unknown psg version " + std::to_string(version));
+  }
+  DESERIALIZE(out_data.V);
+  DESERIALIZE(out_data.F);
+  DESERIALIZE(out_data.params);
+  DESERIALIZE(out_data.settings);
+  if (version == 2) {
+    DESERIALIZE(out_data.remesh_version);
+    DESERIALIZE(out_data.RV);
+    DESERIALIZE(out_data.RF);
+  } else {
+    // Version 1 has no remeshed mesh. Remesh version 0 makes the loader
+    // regenerate it.
+    Log() << "> Version 1 has no remeshed mesh, it will be regenerated on load"
+          << std::endl;
+  }
+  if (!f) {
+    throw std::runtime_error("Truncated psg " + psg_fn);
+  }
+}
+
+static void WritePsg(const PsgData& data,
+                     std::ostream& f,
+                     int version,
+                     bool checksum) {
+  // Same layouts as PassiveGripper::Write
+  if (version == 2) {
+    SERIALIZE(version);
+    SERIALIZE(data.V);
+    SERIALIZE(data.F);
+    SERIALIZE(data.params);
+    SERIALIZE(data.settings);
+    SERIALIZE(data.remesh_version);
+    SERIALIZE(data.RV);
+    SERIALIZE(data.RF);
+  } else if (version == 3) {
+    ContainerWriter writer(f, version, checksum);
+    writer.AddMatrix(PassiveGripper::kChunkV, data.V);
+    writer.AddMatrix(PassiveGripper::kChunkF, data.F);
+    writer.AddObject(PassiveGripper::kChunkParams, data.params);
+    writer.AddObject(PassiveGripper::kChunkSettings, data.settings);
+    writer.AddObject(PassiveGripper::kChunkRemeshVersion, data.remesh_version);
+    writer.AddMatrix(PassiveGripper::kChunkRemeshV, data.RV);
+    writer.AddMatrix(PassiveGripper::kChunkRemeshF, data.RF);
+    writer.Finish();
+  } else {
+    throw std::invalid_argument("Cannot write psg version " +
+                                std::to_string(version));
+  }
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    Usage(argv[0]);
+    return 1;
+  }
+
+  std::string psg_fn = argv[1];
+  std::string out_psg_fn;
+  int version = PassiveGripper::kSerializeVersion;
+  bool checksum = true;
+  for (int i = 2; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--version" && i + 1 < argc) {
+      version = std::stoi(argv[i + 1]);
+      i++;
+    } else if (arg == "--no-checksum") {
+      checksum = false;
+    } else if (out_psg_fn.empty() && arg.rfind("--", 0) != 0) {
+      out_psg_fn = arg;
+    } else {
+      Usage(argv[0]);
+      return 1;
+    }
+  }
+
+  try {
+    if (out_psg_fn.empty()) {
+      PrintInfo(psg_fn);
+      return 0;
+    }
+
+    PsgData data;
+    ReadPsg(psg_fn, data);
+    Log() << "> Loaded " << psg_fn << std::endl;
+
+    std::ofstream out_psg_f(out_psg_fn, std::ios::out | std::ios::binary);
+    if (!out_psg_f.is_open()) {
+      Error() << "Cannot open " << out_psg_fn << std::endl;
+      return 1;
+    }
+    WritePsg(data, out_psg_f, version, checksum);
+    Log() << "> Version " << version << " written to " << out_psg_fn
+          << std::endl;
+  } catch (const std::exception& e) {
+    Error() << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
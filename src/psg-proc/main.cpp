@@ -25,7 +25,7 @@ namespace bp = boost::process;
 void Usage(char* argv0) {
   Error() << "Usage: " << argv0
           << " psg [-s stgo] [--refine bin out-stl] [--gen-tpd out-tpd] "
-             "[--dump-traj out-traj-csv]"
+             "[--dump-traj out-traj-csv] [--check-grad step]"
           << std::endl;
 }
 
@@ -74,6 +74,10 @@ int main(int argc, char** argv) {
   // --dump-viz
   bool dump_viz = false;
 
+  // --check-grad step
+  bool check_grad_set = false;
+  double check_grad_step;
+
   for (int i = 2; i < argc; i++) {
     std::string arg = argv[i];
     if (arg == "-s") {
@@ -103,17 +107,20 @@ int main(int argc, char** argv) {
       i++;
     } else if (arg == "--dump-viz") {
       dump_viz = true;
+    } else if (arg == "--check-grad") {
+      check_grad_set = true;
+      check_grad_step = std::stod(argv[i + 1]);
+      i++;
     } else {
       Error() << "Unknown option " << arg << std::endl;
     }
   }
 
+  // Mesh acceleration structures are cached next to the psg
+  psg::core::models::MeshDependentResource::SetCacheDirectory(
+      fs::absolute(psg_fn).parent_path().string());
   psg::core::PassiveGripper psg;
-  std::ifstream psg_file(psg_fn, std::ios::in | std::ios::binary);
-  if (!psg_file.is_open()) {
-    throw std::invalid_argument("> Cannot open psg file " + psg_fn);
-  }
-  psg.Deserialize(psg_file);
+  psg.Load(psg_fn);
   Log() << "> Loaded " << psg_fn << std::endl;
 
   if (stgo_set) {
@@ -206,6 +213,35 @@ int main(int argc, char** argv) {
     }
   }
 opt_done:
+  if (check_grad_set) {
+    const auto& settings = psg.GetSettings();
+    const auto& cost_function =
+        psg::core::kCostFunctions[(int)settings.cost.cost_function];
+    Log() << "> Checking " << cost_function.name << " gradient" << std::endl;
+    if (!cost_function.has_grad) {
+      Error() << ">> Cost function has no gradient" << std::endl;
+    } else {
+      Eigen::VectorXd analytic;
+      Eigen::VectorXd numeric;
+      psg::core::CheckGradient(cost_function.cost_function,
+                               psg.GetParams(),
+                               psg.GetParams(),
+                               settings,
+                               psg.GetRemeshedMDR(),
+                               check_grad_step,
+                               analytic,
+                               numeric);
+      Eigen::Index worst;
+      double max_error = (analytic - numeric).cwiseAbs().maxCoeff(&worst);
+      for (Eigen::Index i = 0; i < analytic.size(); i++) {
+        Log() << ">> " << i << ": " << analytic(i) << " " << numeric(i)
+              << std::endl;
+      }
+      Log() << ">> Max error " << max_error << " at " << worst
+            << ", relative to the gradient norm "
+            << max_error / std::max(numeric.norm(), 1e-12) << std::endl;
+    }
+  }
   if (refine_set) {
     Log() << "> Refining mesh.." << std::endl;
     Eigen::MatrixXd bin_V;
@@ -0,0 +1,169 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <exception>
+#include <filesystem>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../Constants.h"
+#include "../core/GeometryUtils.h"
+#include "../core/Initialization.h"
+#include "../core/PassiveGripper.h"
+#include "../core/QualityMetric.h"
+#include "../utils.h"
+
+using namespace psg::core;
+
+void Usage(char* argv0) {
+  Error() << "Usage: " << argv0
+          << " psg [--grasps n] [--seed seed] [--qp exact|fast]" << std::endl
+          << "  Compares the min wrench metrics of random grasps with and"
+             " without facet pruning"
+          << std::endl;
+}
+
+// Metric values of one grasp
+struct Metrics {
+  double min_wrench;
+  double partial_min_wrench;
+};
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    Usage(argv[0]);
+    return 1;
+  }
+
+  std::string psg_fn = argv[1];
+  size_t n_grasps = 1000;
+  unsigned int seed = 0;
+  std::string qp_solver;
+  for (int i = 2; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--grasps" && i + 1 < argc) {
+      n_grasps = std::stoull(argv[i + 1]);
+      i++;
+    } else if (arg == "--seed" && i + 1 < argc) {
+      seed = (unsigned int)std::stoul(argv[i + 1]);
+      i++;
+    } else if (arg == "--qp" && i + 1 < argc) {
+      qp_solver = argv[i + 1];
+      i++;
+    } else {
+      Usage(argv[0]);
+      return 1;
+    }
+  }
+
+  try {
+    MeshDependentResource::SetCacheDirectory(
+        std::filesystem::absolute(psg_fn).parent_path().string());
+    PassiveGripper psg;
+    psg.Load(psg_fn);
+    Log() << "> Loaded " << psg_fn << std::endl;
+
+    QualitySettings full_settings = psg.GetQualitySettings();
+    if (qp_solver == "exact") {
+      full_settings.qp_solver = psg::QPSolverEnum::kExact;
+    } else if (qp_solver == "fast") {
+      full_settings.qp_solver = psg::QPSolverEnum::kFast;
+    } else if (!qp_solver.empty()) {
+      Error() << "Unknown QP solver " << qp_solver << std::endl;
+      return 1;
+    }
+    full_settings.qp_cross_check = false;
+    full_settings.prune_facets = false;
+    QualitySettings pruned_settings = full_settings;
+    pruned_settings.prune_facets = true;
+    Log() << "QP solver: " << psg::kQPSolvers[(int)full_settings.qp_solver]
+          << std::endl;
+
+    // Random triplets of surface points, with the cones of the gripper
+    const MeshDependentResource& mdr = psg.GetMDR();
+    const ContactSettings& contact_settings = psg.GetContactSettings();
+    ContactPointFilter filter;
+    std::vector<int> FI;
+    std::vector<Eigen::Vector3d> X;
+    InitializeContactPointSeeds(psg, 1000, filter, FI, X, seed);
+    if (X.size() < 3) {
+      Error() << "Not enough contact point seeds" << std::endl;
+      return 1;
+    }
+    std::mt19937 gen(seed);
+    std::uniform_int_distribution<size_t> pick(0, X.size() - 1);
+    std::vector<std::vector<ContactPoint>> grasps;
+    grasps.reserve(n_grasps);
+    while (grasps.size() < n_grasps) {
+      size_t pids[3] = {pick(gen), pick(gen), pick(gen)};
+      if (pids[0] == pids[1] || pids[1] == pids[2] || pids[0] == pids[2])
+        continue;
+      std::vector<ContactPoint> cones;
+      for (size_t pid : pids) {
+        ContactPoint contact_point;
+        contact_point.position = X[pid];
+        contact_point.normal = mdr.GetFN().row(FI[pid]);
+        contact_point.fid = FI[pid];
+        auto cone = GenerateContactCone(contact_point,
+                                        contact_settings.cone_res,
+                                        contact_settings.friction);
+        cones.insert(cones.end(), cone.begin(), cone.end());
+      }
+      grasps.push_back(std::move(cones));
+    }
+
+    auto Evaluate = [&grasps, &mdr](const QualitySettings& settings,
+                                     std::vector<Metrics>& out_metrics) {
+      out_metrics.resize(grasps.size());
+      auto start_time = std::chrono::high_resolution_clock::now();
+#pragma omp parallel for schedule(dynamic)
+      for (long long i = 0; i < (long long)grasps.size(); i++) {
+        GraspAnalysis analysis(grasps[i],
+                               mdr.center_of_mass,
+                               -Eigen::Vector3d::UnitY(),
+                               Eigen::Vector3d::Zero(),
+                               settings);
+        out_metrics[i].min_wrench = analysis.GetMinWrench();
+        out_metrics[i].partial_min_wrench = analysis.GetPartialMinWrench();
+      }
+      auto stop_time = std::chrono::high_resolution_clock::now();
+      return std::chrono::duration_cast<std::chrono::milliseconds>(stop_time -
+                                                                   start_time)
+          .count();
+    };
+    std::vector<Metrics> full;
+    std::vector<Metrics> pruned;
+    long long full_duration = Evaluate(full_settings, full);
+    long long pruned_duration = Evaluate(pruned_settings, pruned);
+
+    // Same agreement criterion as the runtime cross-check
+    size_t n_min_wrench = 0;
+    size_t n_partial_min_wrench = 0;
+    for (size_t i = 0; i < grasps.size(); i++) {
+      if (psg::core::QPValuesDisagree(pruned[i].min_wrench,
+                                      full[i].min_wrench)) {
+        n_min_wrench++;
+        Error() << "Grasp " << i << ": min wrench " << pruned[i].min_wrench
+                << " pruned, " << full[i].min_wrench << " full" << std::endl;
+      }
+      if (psg::core::QPValuesDisagree(pruned[i].partial_min_wrench,
+                                      full[i].partial_min_wrench)) {
+        n_partial_min_wrench++;
+        Error() << "Grasp " << i << ": partial min wrench "
+                << pruned[i].partial_min_wrench << " pruned, "
+                << full[i].partial_min_wrench << " full" << std::endl;
+      }
+    }
+    Log() << grasps.size() << " grasps, full scan " << full_duration
+          << " ms, pruned " << pruned_duration << " ms" << std::endl;
+    Log() << "Disagreements: min wrench " << n_min_wrench
+          << ", partial min wrench " << n_partial_min_wrench << std::endl;
+    if (n_min_wrench + n_partial_min_wrench > 0) return 1;
+  } catch (const std::exception& e) {
+    Error() << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
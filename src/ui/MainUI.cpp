@@ -215,6 +215,33 @@ void MainUI::DrawMetricPanel() {
     ImGui::Text("Cost: %.4e", vm_.PSG().GetCost());
     ImGui::Text("Min Dist: %.4e", vm_.PSG().GetMinDist());
     ImGui::Text("Intersecting: %s", kFalseTrue[vm_.PSG().GetIntersecting()]);
+    QualitySettings quality_settings = vm_.PSG().GetQualitySettings();
+    bool quality_update = false;
+    if (ImGui::BeginCombo("QP Solver",
+                          kQPSolvers[(int)quality_settings.qp_solver])) {
+      for (int i = 0; i < 2; i++) {
+        bool is_selected = ((int)quality_settings.qp_solver == i);
+        if (ImGui::Selectable(kQPSolvers[i], is_selected)) {
+          quality_settings.qp_solver = (QPSolverEnum)i;
+          quality_update = true;
+        }
+        if (is_selected) {
+          ImGui::SetItemDefaultFocus();
+        }
+      }
+      ImGui::EndCombo();
+    }
+    quality_update |=
+        ImGui::Checkbox("Prune Hull Facets", &quality_settings.prune_facets);
+    quality_update |=
+        ImGui::Checkbox("QP Cross Check", &quality_settings.qp_cross_check);
+    if (quality_settings.qp_cross_check) {
+      QPCrossCheckStats stats = GetQPCrossCheckStats();
+      ImGui::Text("QP Disagreements: %llu/%llu",
+                  (unsigned long long)stats.n_disagreements,
+                  (unsigned long long)stats.n_checks);
+    }
+    if (quality_update) vm_.PSG().SetQualitySettings(quality_settings);
     ImGui::PopID();
   }
 }
@@ -490,12 +517,40 @@ void MainUI::DrawOptimizationPanel() {
     }
     opt_update |=
         ImGui::InputInt("Population", (int*)&opt_settings.population, 1000);
+    opt_update |= ImGui::Checkbox("Batched Population",
+                                  &opt_settings.batched_population);
+    opt_update |= ImGui::Checkbox("Incremental Cost",
+                                  &opt_settings.incremental_cost);
+    opt_update |= ImGui::InputInt("Starts", (int*)&opt_settings.n_starts, 1);
+    if (opt_settings.n_starts > 1) {
+      opt_update |= ImGui::InputDouble(
+          "Start Perturbation", &opt_settings.start_perturbation, 0.1);
+    }
 
     cost_update |= ImGui::InputDouble("Floor", &cost_settings.floor, 0.001);
     cost_update |= ImGui::InputInt(
         "Finger Subdivision", (int*)&cost_settings.n_finger_steps, 1);
     cost_update |= ImGui::InputInt(
         "Trajectory Subdivision", (int*)&cost_settings.n_trajectory_steps, 1);
+    cost_update |=
+        ImGui::Checkbox("Flat Parallel Cost", &cost_settings.flat_parallel);
+    cost_update |= ImGui::Checkbox("Hierarchical Min Distance",
+                                   &cost_settings.hierarchical_min_dist);
+    cost_update |= ImGui::InputInt(
+        "Float Evaluations", (int*)&cost_settings.float_evals, 100);
+    cost_update |= ImGui::Checkbox("SDF Grid", &cost_settings.sdf_grid);
+    if (cost_settings.sdf_grid) {
+      cost_update |= ImGui::InputDouble("SDF Grid Res (m)",
+                                        &cost_settings.sdf_grid_res,
+                                        0.0001,
+                                        0.001,
+                                        "%.4f");
+      cost_update |= ImGui::InputDouble("SDF Grid Band (m)",
+                                        &cost_settings.sdf_grid_band,
+                                        0.001,
+                                        0.01,
+                                        "%.3f");
+    }
     if (opt_update) vm_.PSG().SetOptSettings(opt_settings);
     if (cost_update) vm_.PSG().SetCostSettings(cost_settings);
     if (ImGui::Button("Optimize", ImVec2(w, 0))) {
@@ -754,6 +809,7 @@ void MainUI::DrawDebugPanel() {
     ImGui::InputDouble(
         "Filter Curvature Radius", &cp_filter.curvature_radius, 0.001);
     MyInputDoubleConvert("Filter Angle", &cp_filter.angle, kRadToDeg, 1);
+    ImGui::InputDouble("Filter Min Distance", &cp_filter.min_distance, 0.001);
     if (ImGui::Button("Dump CSV", ImVec2(w, 0))) {
       std::string filename = igl::file_dialog_save();
       if (!filename.empty()) {